@@ -146,7 +146,7 @@ static AVLnode *avl_fix(AVLnode *node) {
         else if (slope == -2) {
             node = avl_fix_right(node);
         }
-        if (from) {
+        if (!from) {
             return node;
         }
         *from = node;  // update value 
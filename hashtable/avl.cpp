@@ -0,0 +1,317 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avl.h"
+
+static uint32_t max(uint32_t lhs, uint32_t rhs) {
+    return lhs < rhs ? rhs : lhs;
+}
+
+// maintaining the depth and the cnt field 
+
+static void avl_update(AVLnode *node) {
+    node->depth = 1 + max(avl_depth(node->left), avl_depth(node->right));
+    node->cnt = 1 + avl_cnt(node->left) + avl_cnt(node->right);
+}
+
+/**
+ * @brief we make the node->right as the new root for this subtree,
+ * First we shift the left of new_node to right of node and then make the node 
+ * as left of new_node, 
+ *  Assume the below recurrent data structure
+ *  node - [L][R]  
+ *  node - [L][new_node (R-L)(R-R)]
+ *  final transformation
+ *   
+ *  new_node [node(L)(R-L)][R-R]
+ * 
+ * @param node : The node which you want to balance, when left subtree is lighter as compare to right
+ * @return AVLnode* return the new node at the which occupy the position of @param node i.e new_node
+ */
+static AVLnode *root_left(AVLnode *node) {
+    AVLnode *new_node = node->right; 
+    if (new_node->left) {
+        new_node->left->parent = node;
+    }
+    node->right = new_node->left; 
+    new_node->left = node;
+    new_node->parent = node->parent;
+    node->parent = new_node;
+    // update info bottom up
+    avl_update(node);
+    avl_update(new_node);
+    return new_node;
+}
+
+/**
+ * @brief From the above explanation this is same except we are doing thing with the left 
+ * 
+ * Initial state
+ * node - [L][R]
+ * node - [new_node (L-L)(L-R)][R]
+ * final state
+ * 
+ * new_node [L-L][node (L-R)(R)]
+ * @param node 
+ * @return AVLnode* 
+ */
+static AVLnode *root_right (AVLnode *node) {
+    AVLnode *new_node = node->left; 
+    if (new_node->right) {
+        new_node->right->parent = node;
+    }
+    node->left = new_node->right;
+    new_node->right = node;
+    new_node->parent = node->parent;
+    node->parent = new_node;
+    // update info from bottom up
+    avl_update(node);
+    avl_update(new_node);
+    return new_node;
+}
+
+/**
+ * @brief asking to fix the left tree, if the root->left's left node is having lower height than
+ * root->left's rigth child then we are fixing root_left (to fix the lighter child)
+ * Since this might update the left child for root now, because of re-shift, thus we are updating
+ * root->left and finally we are calling root_right to balance and return new root;
+ * 
+ * @param root 
+ * @return AVLnode* 
+ */
+static AVLnode *avl_fix_left(AVLnode *root) {
+    if (avl_depth(root->left->left) < avl_depth(root->left->right)) {
+        root->left = root_left(root->left);
+    }
+    return root_right(root); // return new root
+}
+
+/**
+ * @brief Similar to avl_fix left
+ * 
+ * @param root 
+ * @return AVLnode* 
+ */
+static AVLnode *avl_fix_right(AVLnode *root) {
+    if (avl_depth(root->right->right) < avl_depth(root->right->left)) {
+        root->right = root_right(root->right);
+    }
+    return root_left(root);
+}
+
+// do fixing bottom-up 
+
+/**
+ * @brief this is used to fix the avl tree, check the left and right if they are unbalanced
+ * i.e slope = {-2, +2}, then we have to fix that particular tree
+ * 
+ * @param node 
+ * @return AVLnode* 
+ */
+AVLnode *avl_fix(AVLnode *node) {
+    while (true) {
+        // fixthe height 
+        avl_update(node);
+        uint32_t l = avl_depth(node->left);
+        uint32_t r = avl_depth(node->right);
+        AVLnode **from = NULL;
+        if (node->parent) {
+            from = (node->parent->left == node) ? &node->parent->left : &node->parent->right;
+        }
+
+        // find slope
+        if (l == r + 2) {
+            node = avl_fix_left(node);
+        }
+        else if (l + 2 == r) {
+            node = avl_fix_right(node);
+        }
+        if (!from) {
+            return node; // the root
+        }
+        *from = node;  // update value 
+        node = node->parent;
+    }
+}
+
+AVLnode *avl_del(AVLnode *node) {
+    if (node->right == NULL) {
+        AVLnode * parent = node->parent; 
+        if (node->left) {
+            node->left->parent = parent;
+        }
+        if (parent) {
+            (parent->left == node ? parent->left : parent->right) = node->left; 
+            return avl_fix(parent);
+        }
+        else {
+            return node->left;
+        }
+    }  
+    else {
+        AVLnode *victim = node->right;
+        while (victim->left) {
+            victim = victim->left;
+        }
+        AVLnode *root = avl_del(victim);
+        *victim = *node;
+        if (victim->left) {
+            victim->left->parent = victim;
+        }
+        if (victim->right) {
+            victim->right->parent = victim;
+        }
+        AVLnode *parent = node->parent;
+        if (parent) {
+            (parent->left == node ? parent->left : parent->right) = victim;
+            return root;
+        }
+        else {
+            return victim;
+        }
+    }
+}
+
+/**
+ * @brief the rank of a node, its position in the order of the tree from 0: the nodes left of
+ * it are its left subtree, plus every ancestor it is right of with the left subtree of that one
+ * @param node 
+ * @return uint64_t O(log n), the path up to the root
+ */
+uint64_t avl_rank(AVLnode *node) {
+    uint64_t rank = avl_cnt(node->left);
+    for (AVLnode *parent = node->parent; parent; node = parent, parent = parent->parent) {
+        if (parent->right == node) {
+            rank += avl_cnt(parent->left) + 1;
+        }
+    }
+    return rank;
+}
+
+/**
+ * @brief the node of a rank, walking down from the root: the cnt of the left subtree tells
+ * whether the rank is there, here, or right of here
+ * @param root 
+ * @param rank : from 0
+ * @return AVLnode* NULL if the tree has no more than rank nodes
+ */
+AVLnode *avl_at(AVLnode *root, uint64_t rank) {
+    AVLnode *node = root;
+    while (node) {
+        uint64_t left = avl_cnt(node->left);
+        if (rank == left) {
+            return node;
+        }
+        if (rank < left) {
+            node = node->left;
+        }
+        else {
+            rank -= left + 1;
+            node = node->right;
+        }
+    }
+    return NULL;
+}
+
+static AVLnode *build(AVLnode **nodes, size_t n, AVLnode *parent) {
+    if (n == 0) {
+        return NULL;
+    }
+    size_t mid = n / 2;
+    AVLnode *node = nodes[mid];
+    node->parent = parent;
+    node->left = build(nodes, mid, node);
+    node->right = build(nodes + mid + 1, n - mid - 1, node);
+    avl_update(node);
+    return node;
+}
+
+/**
+ * @brief a tree of nodes which are in order already, without a single comparison nor rotation:
+ * the middle node is the root and the halves on either side are its subtrees, built the same
+ * way. The halves differ by one node at most, thus so do the depths, and every node is written
+ * once: O(n), where n inserts are O(n log n) and a cache miss per level
+ * @param nodes : in order, whatever their links were, they are all set
+ * @param n 
+ * @return AVLnode* the root, NULL if n is 0
+ */
+AVLnode *avl_build(AVLnode **nodes, size_t n) {
+    return build(nodes, n, NULL); // recursion as deep as the tree, log2(n)
+}
+
+/**
+ * @brief the node after this one in the order: the leftmost of the right subtree, else the
+ * first ancestor this one is left of. Walking all the tree this way crosses every link twice
+ * @param node 
+ * @return AVLnode* NULL after the last node
+ */
+AVLnode *avl_next(AVLnode *node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return node;
+    }
+    while (node->parent && node->parent->right == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/**
+ * @brief the node before this one, the mirror of avl_next()
+ * @param node 
+ * @return AVLnode* NULL before the first node
+ */
+AVLnode *avl_prev(AVLnode *node) {
+    if (node->left) {
+        node = node->left;
+        while (node->right) {
+            node = node->right;
+        }
+        return node;
+    }
+    while (node->parent && node->parent->left == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/**
+ * @brief the node offset ranks away from this one, without visiting those in between: pos is
+ * the rank of the current node relative to the start. The target is either in a subtree of
+ * the current node, which the cnt of the subtree tells, then we go down into it, or else
+ * somewhere above, then we go up to the parent. Up then down, thus O(log n)
+ * @param node : where to start
+ * @param offset : ranks to move, negative is towards the first node
+ * @return AVLnode* NULL if it is out of the tree
+ */
+AVLnode *avl_offset(AVLnode *node, int64_t offset) {
+    int64_t pos = 0;
+    while (pos != offset) {
+        if (pos < offset && pos + avl_cnt(node->right) >= offset) {
+            // in the right subtree, its root is past the nodes of its left subtree
+            node = node->right;
+            pos += avl_cnt(node->left) + 1;
+        }
+        else if (pos > offset && pos - avl_cnt(node->left) <= offset) {
+            node = node->left;
+            pos -= avl_cnt(node->right) + 1;
+        }
+        else {
+            AVLnode *parent = node->parent;
+            if (!parent) {
+                return NULL;
+            }
+            if (parent->right == node) {
+                pos -= avl_cnt(node->left) + 1;
+            }
+            else {
+                pos += avl_cnt(node->right) + 1;
+            }
+            node = parent;
+        }
+    }
+    return node;
+}
@@ -0,0 +1,43 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// intrusive AVL tree of avl_tree/, the order of the sorted sets: a node is embedded in the
+// struct it orders (like Hnode) and the caller walks down from the root to insert. Every node
+// keeps the size of its subtree (cnt), thus the rank of a node and the node of a rank are found
+// in O(log n) without visiting the nodes in between
+
+struct AVLnode {
+    uint32_t depth = 0;
+    uint32_t cnt = 0;
+    AVLnode *left = NULL;
+    AVLnode *right = NULL;
+    AVLnode *parent = NULL;
+};
+
+static inline void avl_init(AVLnode *node) {
+    node->depth = node->cnt = 1;
+    node->left = node->right = node->parent = NULL;
+}
+
+static inline uint32_t avl_depth(AVLnode *node) {
+    return node ? node->depth : 0;
+}
+
+static inline uint32_t avl_cnt(AVLnode *node) {
+    return node ? node->cnt : 0;
+}
+
+// basic api to the tree i.e fix after an insert, delete, rank and select
+
+AVLnode *avl_fix(AVLnode *node);
+AVLnode *avl_del(AVLnode *node);
+uint64_t avl_rank(AVLnode *node);
+AVLnode *avl_at(AVLnode *root, uint64_t rank);
+AVLnode *avl_build(AVLnode **nodes, size_t n);
+
+// walking the tree in order from a node, without recursion nor a stack: the neighbours in
+// O(1) on average, a node k ranks away in O(log n) whatever k is
+
+AVLnode *avl_next(AVLnode *node);
+AVLnode *avl_prev(AVLnode *node);
+AVLnode *avl_offset(AVLnode *node, int64_t offset);
@@ -0,0 +1,1284 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "hashmap.h"
+#include "buffer.h"
+#include "protocol.h"
+#include "command.h"
+#include "hash.h"
+#include "slab.h"
+#include "avl.h"
+#include "btree.h"
+#include "zset.h"
+#include "entry.h"
+
+// in-process microbenchmarks of the building blocks of the server, no sockets involved
+// usage:
+//   ./bench get [keys] [ops]
+//      the GET path: parse a request, look the key up, queue the response. Reports ns and
+//      heap allocations per GET, next to the same work done with the old parser which put
+//      every argument into a std::string of a std::vector
+//   ./bench mget [keys] [batch] [batches]
+//      looking up batch random keys of a table of keys entries, one hashmap_lookup() after
+//      the other against one hashmap_lookup_batch(). The default table (8M keys, ~700MB) is
+//      far larger than the last level cache, thus nearly every bucket and node is a miss
+//   ./bench table [keys] [ops]
+//      the hashmap backend this was built with (make HASHTABLE=chain|swiss): inserting keys
+//      entries, then random lookups of keys which exist (hit) and which do not (miss)
+//   ./bench entry [keys] [ops] [value_bytes]
+//      keys of 30 bytes stored as an entry with a std::string key and an RcBuf value, against
+//      the single allocation Entry of entry.h: heap bytes and mallocs per key (table included)
+//      and ns per hit which reads the value
+//   ./bench hmap [keys] [ops]
+//      inserts and random lookups through the C api of libhashtable.so, whose comparator is a
+//      function pointer, against the HMap template of hashmap.h, with the same backend
+//   ./bench resize [keys]
+//      latency percentiles of the inserts of keys entries while the table grows, by rehash
+//      budget (see HashMap), then the slots left after popping 9 in 10 of the entries
+//   ./bench hash [ops] [keys]
+//      the key hash of hash.h against the 32 bit byte at a time hash it replaced: ns per
+//      hash by key length, then how evenly keys spread over the buckets of either backend and
+//      how many keys share their hash with another
+//   ./bench dispatch [ops]
+//      finding the command of a request among 32 names: the perfect hash of command.h
+//      against the chain of case insensitive compares it replaced, for the first, a middle
+//      and the last command of the chain
+//   ./bench slab [objects] [ops] [thp]
+//      churn of objects of 48 to 320 bytes, the sizes of entries: a random one is freed and
+//      another allocated, with malloc against the slabs of slab.h (on huge pages with thp).
+//      Reports ns per free and alloc, the bytes held per live object after the churn, and ns
+//      per read of a random object
+//   ./bench zrange [members] [queries] [count]
+//      pages of count members at a random offset of a sorted set (ZRANGEBYSCORE -inf +inf
+//      LIMIT offset count): stepping to the offset member by member with avl_next() against
+//      avl_offset(), then ns per member of a walk of the whole set, avl_next() against the
+//      recursive in order walk of avl_tree/
+//   ./bench zbuild [members]
+//      loading a sorted set of members with random scores: a zset_add() per member against
+//      zset_add_many() in one batch, which sorts them and builds the tree with avl_build(),
+//      then avl_build() alone over the members already in order
+//   ./bench ordered [members] [ops]
+//      the order of a sorted set as an AVL tree against a B+tree (btree.h): ns per member added
+//      one by one with random scores, per rank of a random member (ZRANK), per page of 10
+//      members from a random score (ZRANGEBYSCORE ... LIMIT 0 10), per member of a random rank
+//      (ZRANGE) and per member removed, then the bytes held per member
+
+#define get_outer_wrapper_of_hnode(ptr, type, member) ({                  \
+    const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
+    (type *)( (char *)__mptr - offsetof(type, member) );})
+
+// every malloc of the process is counted, operator new ends up here as well
+extern "C" void *__libc_malloc(size_t size);
+static size_t g_mallocs = 0;
+
+extern "C" void *malloc(size_t size) {
+    g_mallocs++;
+    return __libc_malloc(size);
+}
+
+static void die(const char *msg) {
+    int err = errno;
+    fprintf(stderr, "[%d] %s\n", err, msg);
+    abort();
+}
+
+static uint64_t now_ns() {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// a key and its value the way the server stored them before entry.h, the benches of the table
+// only need the key
+struct StrEntry {
+    struct Hnode node;
+    std::string key;
+    RcBuf *val = NULL;
+};
+
+struct LookupKey {
+    struct Hnode node;
+    Slice key;
+};
+
+static uint64_t g_hash_seed = hash_seed_random();
+
+static uint64_t str_hash(const uint8_t *data, size_t len) {
+    return hash_bytes(data, len, g_hash_seed);
+}
+
+// the byte at a time 32 bit hash the server had before hash.h, for the hash bench
+static uint64_t fnv_hash(const uint8_t *data, size_t len) {
+    uint32_t h = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        h = (h + data[i]) * 0x01000193;
+    }
+    return h;
+}
+
+static bool entry_eq(Hnode *lhs, Hnode *rhs) {
+    StrEntry *le = get_outer_wrapper_of_hnode(lhs, StrEntry, node);
+    LookupKey *rk = get_outer_wrapper_of_hnode(rhs, LookupKey, node);
+    return lhs->hcode == rhs->hcode && le->key.size() == rk->key.len
+        && memcmp(le->key.data(), rk->key.ptr, rk->key.len) == 0;
+}
+
+static bool entry_eq_legacy(Hnode *lhs, Hnode *rhs) {
+    StrEntry *le = get_outer_wrapper_of_hnode(lhs, StrEntry, node);
+    StrEntry *re = get_outer_wrapper_of_hnode(rhs, StrEntry, node);
+    return lhs->hcode == rhs->hcode && le->key == re->key;
+}
+
+/// @brief the parser of the server before it produced views, for comparison
+static int32_t parse_request_legacy(const uint8_t *raw, size_t end_pos, std::vector<std::string> &out) {
+    uint32_t nstr = 0;
+    memcpy(&nstr, raw, 4);
+    size_t pos = 4;
+    while (nstr--) {
+        uint32_t len = 0;
+        if (pos + 4 > end_pos) {
+            return -1;
+        }
+        memcpy(&len, &raw[pos], 4);
+        if (pos + 4 + len > end_pos) {
+            return -1;
+        }
+        out.push_back(std::string((const char *)&raw[pos + 4], len));
+        pos += 4 + len;
+    }
+    return pos == end_pos ? 0 : -1;
+}
+
+/// @brief a request in the wire format without the length header (nstr, len, str1, ...)
+static std::string encode_args(const std::vector<std::string> &cmd) {
+    std::string out;
+    uint32_t n = (uint32_t)cmd.size();
+    out.append((const char *)&n, 4);
+    for (const std::string &s : cmd) {
+        uint32_t len = (uint32_t)s.size();
+        out.append((const char *)&len, 4);
+        out.append(s);
+    }
+    return out;
+}
+
+/// @brief append the response frame of a GET and send it right away
+static void respond(OutQueue *out, RcBuf *val) {
+    uint8_t *header = outq_alloc(out, 8);
+    if (!header || !outq_append_ref(out, val)) {
+        die("out of memory");
+    }
+    outq_consume(out, out->bytes);
+}
+
+static void bench_get(size_t keys, size_t ops) {
+    HashMap db;
+    std::string value(16, 'v');
+    for (size_t i = 0; i < keys; i++) {
+        StrEntry *entry = new StrEntry();
+        entry->key = "bench:user:key:" + std::to_string(i);
+        entry->node.hcode = str_hash((const uint8_t *)entry->key.data(), entry->key.size());
+        entry->val = rcbuf_new(value.data(), value.size());
+        hashmap_insert(&db, &entry->node);
+    }
+    // keys long enough not to fit the small string buffer, like most real keys
+    std::vector<std::string> requests;
+    for (size_t i = 0; i < 1024; i++) {
+        requests.push_back(encode_args({"get", "bench:user:key:" + std::to_string(i * 7919 % keys)}));
+    }
+    OutQueue out;
+    size_t found = 0;
+
+    uint64_t start = now_ns();
+    size_t mallocs = g_mallocs;
+    for (size_t i = 0; i < ops; i++) {
+        const std::string &req = requests[i & 1023];
+        Args args;
+        if (parse_request((const uint8_t *)req.data(), req.size(), &args) || !slice_is(args.v[0], "get")) {
+            die("parse");
+        }
+        LookupKey cur;
+        cur.key = args.v[1];
+        cur.node.hcode = str_hash(cur.key.ptr, cur.key.len);
+        Hnode *node = hashmap_lookup(&db, &cur.node, &entry_eq);
+        if (node) {
+            respond(&out, get_outer_wrapper_of_hnode(node, StrEntry, node)->val);
+            found++;
+        }
+        args_free(&args);
+    }
+    double views_allocs = (double)(g_mallocs - mallocs) / ops;
+    double views_ns = (double)(now_ns() - start) / ops;
+
+    start = now_ns();
+    mallocs = g_mallocs;
+    for (size_t i = 0; i < ops; i++) {
+        const std::string &req = requests[i & 1023];
+        std::vector<std::string> parsed;
+        if (parse_request_legacy((const uint8_t *)req.data(), req.size(), parsed) || parsed[0] != "get") {
+            die("parse");
+        }
+        StrEntry cur;
+        cur.key.swap(parsed[1]);
+        cur.node.hcode = str_hash((const uint8_t *)cur.key.data(), cur.key.size());
+        Hnode *node = hashmap_lookup(&db, &cur.node, &entry_eq_legacy);
+        if (node) {
+            respond(&out, get_outer_wrapper_of_hnode(node, StrEntry, node)->val);
+            found++;
+        }
+    }
+    double strings_allocs = (double)(g_mallocs - mallocs) / ops;
+    double strings_ns = (double)(now_ns() - start) / ops;
+
+    if (found != 2 * ops) {
+        die("missing keys");
+    }
+    printf("%-10s %12s %16s\n", "parser", "ns_per_get", "allocs_per_get");
+    printf("%-10s %12.1f %16.2f\n", "views", views_ns, views_allocs);
+    printf("%-10s %12.1f %16.2f\n", "strings", strings_ns, strings_allocs);
+}
+
+// names of keys for lookups, random and too many to stay in the cache. They sit in fixed size
+// slots read in order, thus they cost every lookup the same whatever the table does
+static const size_t NAME_SLOT = 24;
+
+struct KeyNames {
+    std::vector<char> slots;
+    std::vector<uint8_t> len;
+    size_t n = 0;
+};
+
+/// @brief n names of the keys key:0 .. key:keys-1, one in miss_one_in of them (if not 0) is
+/// nokey:i instead, which does not exist
+static void key_names_init(KeyNames *names, size_t n, size_t keys, size_t miss_one_in) {
+    names->slots.resize(n * NAME_SLOT);
+    names->len.resize(n);
+    names->n = n;
+    uint64_t rnd = 88172645463325252ULL;
+    for (size_t j = 0; j < n; j++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        size_t i = rnd % keys;
+        bool miss = miss_one_in && (rnd >> 40) % miss_one_in == 0;
+        names->len[j] = (uint8_t)snprintf(&names->slots[j * NAME_SLOT], NAME_SLOT, "%s:%zu", miss ? "nokey" : "key", i);
+    }
+}
+
+static Slice key_name(const KeyNames *names, size_t j) {
+    Slice name;
+    name.ptr = (const uint8_t *)&names->slots[j * NAME_SLOT];
+    name.len = names->len[j];
+    return name;
+}
+
+/// @brief a table with the keys key:0 .. key:keys-1, all the entries share value
+static std::vector<StrEntry *> fill_table(HashMap *db, size_t keys, RcBuf *value) {
+    std::vector<StrEntry *> entries(keys);
+    for (size_t i = 0; i < keys; i++) {
+        StrEntry *entry = new StrEntry();
+        entry->key = "key:" + std::to_string(i);
+        entry->node.hcode = str_hash((const uint8_t *)entry->key.data(), entry->key.size());
+        entry->val = value;
+        hashmap_insert(db, &entry->node);
+        entries[i] = entry;
+    }
+    return entries;
+}
+
+/// @brief finish the last resize, the lookups would look into both tables otherwise
+static void finish_resize(HashMap *db) {
+    while (hashmap_rehash(db, UINT64_MAX)) {
+    }
+}
+
+static void bench_mget(size_t keys, size_t batch, size_t batches) {
+    HashMap db;
+    RcBuf *value = rcbuf_new("v", 1); // shared by all the entries, only the table matters here
+    fill_table(&db, keys, value);
+    finish_resize(&db);
+    // the request keys, one in 8 does not exist
+    KeyNames names;
+    key_names_init(&names, 1 << 20, keys, 8);
+    std::vector<LookupKey> cur(batch);
+    std::vector<Hnode *> nodes(batch);
+    std::vector<Hnode *> found(batch);
+    double ns[2] = {};
+    size_t hits[2] = {};
+    // each mode runs twice, taking turns, the first round warms up the page tables and caches
+    for (int round = 0; round < 4; round++) {
+        int mode = round % 2;
+        hits[mode] = 0;
+        uint64_t start = now_ns();
+        for (size_t b = 0; b < batches; b++) {
+            // like a request: hash the keys, then look them up
+            size_t first = (b * batch) % (names.n - batch + 1);
+            for (size_t i = 0; i < batch; i++) {
+                cur[i].key = key_name(&names, first + i);
+                cur[i].node.hcode = str_hash(cur[i].key.ptr, cur[i].key.len);
+                nodes[i] = &cur[i].node;
+            }
+            if (mode == 0) {
+                for (size_t i = 0; i < batch; i++) {
+                    found[i] = hashmap_lookup(&db, nodes[i], &entry_eq);
+                }
+            }
+            else {
+                hashmap_lookup_batch(&db, nodes.data(), batch, &entry_eq, found.data());
+            }
+            for (size_t i = 0; i < batch; i++) {
+                hits[mode] += found[i] != NULL;
+            }
+        }
+        ns[mode] = (double)(now_ns() - start) / (batches * batch);
+    }
+    if (hits[0] != hits[1]) {
+        die("batch lookup differs");
+    }
+    printf("keys=%zu batch=%zu hit_rate=%.3f\n", keys, batch, (double)hits[0] / (batches * batch));
+    printf("%-12s %12s\n", "lookup", "ns_per_key");
+    printf("%-12s %12.1f\n", "sequential", ns[0]);
+    printf("%-12s %12.1f\n", "batch", ns[1]);
+}
+
+#ifdef HASHTABLE_SWISS
+static const char *BACKEND = "swiss";
+#else
+static const char *BACKEND = "chain";
+#endif
+
+/// @brief ns per lookup of names in db
+static double time_lookups(HashMap *db, const KeyNames *names, size_t ops, size_t *hits) {
+    *hits = 0;
+    uint64_t start = now_ns();
+    for (size_t j = 0; j < ops; j++) {
+        LookupKey cur;
+        cur.key = key_name(names, j % names->n);
+        cur.node.hcode = str_hash(cur.key.ptr, cur.key.len);
+        *hits += hashmap_lookup(db, &cur.node, &entry_eq) != NULL;
+    }
+    return (double)(now_ns() - start) / ops;
+}
+
+// the same entries in an HMap, whose policies are inlined
+struct BenchHash {
+    uint64_t operator()(Slice key) const {
+        return str_hash(key.ptr, key.len);
+    }
+};
+
+struct BenchEq {
+    bool operator()(const StrEntry *entry, Slice key) const {
+        return entry->key.size() == key.len && memcmp(entry->key.data(), key.ptr, key.len) == 0;
+    }
+};
+
+typedef HMap<StrEntry, BenchHash, BenchEq> BenchMap;
+
+static double time_hmap_lookups(BenchMap *db, const KeyNames *names, size_t ops, size_t *hits) {
+    *hits = 0;
+    uint64_t start = now_ns();
+    for (size_t j = 0; j < ops; j++) {
+        *hits += hmap_lookup(db, key_name(names, j % names->n)) != NULL;
+    }
+    return (double)(now_ns() - start) / ops;
+}
+
+static void bench_table(size_t keys, size_t ops) {
+    HashMap db;
+    RcBuf *value = rcbuf_new("v", 1);
+    // the entries exist before the clock starts, only the inserts into the table are timed
+    std::vector<StrEntry *> entries(keys);
+    for (size_t i = 0; i < keys; i++) {
+        entries[i] = new StrEntry();
+        entries[i]->key = "key:" + std::to_string(i);
+        entries[i]->node.hcode = str_hash((const uint8_t *)entries[i]->key.data(), entries[i]->key.size());
+        entries[i]->val = value;
+    }
+    uint64_t start = now_ns();
+    for (StrEntry *entry : entries) {
+        hashmap_insert(&db, &entry->node);
+    }
+    double insert_ns = (double)(now_ns() - start) / keys;
+    finish_resize(&db);
+
+    KeyNames hit_names;
+    KeyNames miss_names;
+    key_names_init(&hit_names, 1 << 20, keys, 0);
+    key_names_init(&miss_names, 1 << 20, keys, 1);
+    size_t hits = 0;
+    size_t misses = 0;
+    (void)time_lookups(&db, &hit_names, ops / 4, &hits); // warm up
+    double hit_ns = time_lookups(&db, &hit_names, ops, &hits);
+    double miss_ns = time_lookups(&db, &miss_names, ops, &misses);
+    if (hits != ops || misses != 0) {
+        die("lookup results");
+    }
+    printf("%-8s %12s %12s %12s %12s\n", "backend", "keys", "insert_ns", "hit_ns", "miss_ns");
+    printf("%-8s %12zu %12.1f %12.1f %12.1f\n", BACKEND, keys, insert_ns, hit_ns, miss_ns);
+}
+
+/// @brief the same inserts and lookups through libhashtable.so, whose comparator is called through
+/// a pointer, and through an HMap of the same backend, compiled into the bench
+static void bench_hmap(size_t keys, size_t ops) {
+    RcBuf *value = rcbuf_new("v", 1);
+    std::vector<StrEntry *> entries[2];
+    for (std::vector<StrEntry *> &e : entries) {
+        e.resize(keys);
+        for (size_t i = 0; i < keys; i++) {
+            e[i] = new StrEntry();
+            e[i]->key = "key:" + std::to_string(i);
+            e[i]->node.hcode = str_hash((const uint8_t *)e[i]->key.data(), e[i]->key.size());
+            e[i]->val = value;
+        }
+    }
+    // a small table stays in the cache, and so do its names, then the calls are what costs
+    size_t n_names = keys * 4 < ((size_t)1 << 20) ? keys * 4 : (size_t)1 << 20;
+    KeyNames hit_names;
+    KeyNames miss_names;
+    key_names_init(&hit_names, n_names, keys, 0);
+    key_names_init(&miss_names, n_names, keys, 1);
+    size_t hits = 0;
+    size_t misses = 0;
+    double ns[2][3] = {};
+
+    HashMap so;
+    uint64_t start = now_ns();
+    for (StrEntry *entry : entries[0]) {
+        hashmap_insert(&so, &entry->node);
+    }
+    ns[0][0] = (double)(now_ns() - start) / keys;
+    finish_resize(&so);
+    (void)time_lookups(&so, &hit_names, ops / 4, &hits);
+    ns[0][1] = time_lookups(&so, &hit_names, ops, &hits);
+    ns[0][2] = time_lookups(&so, &miss_names, ops, &misses);
+    if (hits != ops || misses != 0) {
+        die("lookup results");
+    }
+
+    BenchMap hm;
+    start = now_ns();
+    for (StrEntry *entry : entries[1]) {
+        hmap_insert(&hm, entry);
+    }
+    ns[1][0] = (double)(now_ns() - start) / keys;
+    finish_resize(&hm.map);
+    (void)time_hmap_lookups(&hm, &hit_names, ops / 4, &hits);
+    ns[1][1] = time_hmap_lookups(&hm, &hit_names, ops, &hits);
+    ns[1][2] = time_hmap_lookups(&hm, &miss_names, ops, &misses);
+    if (hits != ops || misses != 0) {
+        die("lookup results");
+    }
+
+    printf("%-8s %-6s %12s %12s %12s %12s\n", "backend", "map", "keys", "insert_ns", "hit_ns", "miss_ns");
+    const char *names[2] = {".so", "HMap"};
+    for (int m = 0; m < 2; m++) {
+        printf("%-8s %-6s %12zu %12.1f %12.1f %12.1f\n", BACKEND, names[m], keys, ns[m][0], ns[m][1], ns[m][2]);
+    }
+}
+
+struct StrEntryEq {
+    bool operator()(const StrEntry *entry, Slice key) const {
+        return entry->key.size() == key.len && memcmp(entry->key.data(), key.ptr, key.len) == 0;
+    }
+};
+
+struct PackedEq {
+    bool operator()(const Entry *entry, Slice key) const {
+        return entry->key_len == key.len && memcmp(entry_bytes(entry), key.ptr, key.len) == 0;
+    }
+};
+
+/// @brief ns per GET-like hit (the lookup, then reading the value) of random keys of map
+template <typename Map, typename ValueOf>
+static double time_entry_hits(Map *map, const std::vector<char> &names, size_t name_slot, size_t ops, ValueOf value_of) {
+    size_t n = names.size() / name_slot;
+    uint64_t sum = 0;
+    uint64_t start = now_ns();
+    for (size_t j = 0; j < ops; j++) {
+        Slice key;
+        key.ptr = (const uint8_t *)&names[(j % n) * name_slot];
+        key.len = strlen((const char *)key.ptr);
+        auto *entry = hmap_lookup(map, key);
+        if (!entry) {
+            die("lookup");
+        }
+        Slice val = value_of(entry);
+        sum += val.ptr[0] + val.ptr[val.len - 1];
+    }
+    double ns = (double)(now_ns() - start) / ops;
+    if (sum == 42) {
+        printf("\n"); // keep the sum alive
+    }
+    return ns;
+}
+
+/// @brief bytes malloc handed out, the large blocks it maps (the tables) included, and the
+/// slabs cut so far
+static size_t heap_bytes() {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd + (size_t)slab_stats().slab_bytes;
+}
+
+/// @brief Heap bytes and allocations per key, and the cost of a hit, of keys of 30 bytes with
+/// values of val_len bytes: stored as a StrEntry (an entry, a std::string key and an RcBuf
+/// value) against the single allocation Entry of entry.h
+static void bench_entry(size_t keys, size_t ops, size_t val_len) {
+    const size_t KEY_SLOT = 40; // the room snprintf() wants for any size_t, the keys take 30
+    std::string val(val_len, 'v');
+    Slice val_slice;
+    val_slice.ptr = (const uint8_t *)val.data();
+    val_slice.len = val.size();
+    // the names of random keys to look up, read in order
+    std::vector<char> names(((size_t)1 << 20) * KEY_SLOT);
+    uint64_t rnd = 88172645463325252ULL;
+    for (size_t j = 0; j < names.size() / KEY_SLOT; j++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        snprintf(&names[j * KEY_SLOT], KEY_SLOT, "user:session:%017zu", (size_t)(rnd % keys));
+    }
+
+    HMap<StrEntry, BenchHash, StrEntryEq> old_map;
+    HMap<Entry, BenchHash, PackedEq> new_map;
+    char key[KEY_SLOT];
+    double bytes[2] = {};
+    double mallocs[2] = {};
+    double hit_ns[2] = {};
+
+    size_t heap = heap_bytes();
+    size_t count = g_mallocs;
+    for (size_t i = 0; i < keys; i++) {
+        snprintf(key, sizeof(key), "user:session:%017zu", i);
+        StrEntry *entry = new StrEntry();
+        entry->key = key;
+        entry->node.hcode = str_hash((const uint8_t *)key, entry->key.size());
+        entry->val = rcbuf_new(val.data(), val.size());
+        hmap_insert(&old_map, entry);
+    }
+    finish_resize(&old_map.map);
+    bytes[0] = (double)(heap_bytes() - heap) / keys;
+    mallocs[0] = (double)(g_mallocs - count) / keys;
+
+    heap = heap_bytes();
+    count = g_mallocs;
+    for (size_t i = 0; i < keys; i++) {
+        Slice name;
+        name.ptr = (const uint8_t *)key;
+        name.len = (size_t)snprintf(key, sizeof(key), "user:session:%017zu", i);
+        hmap_insert(&new_map, entry_new(name, str_hash(name.ptr, name.len), val_slice));
+    }
+    finish_resize(&new_map.map);
+    bytes[1] = (double)(heap_bytes() - heap) / keys;
+    mallocs[1] = (double)(g_mallocs - count) / keys;
+
+    auto old_val = [](StrEntry *entry) {
+        Slice v;
+        v.ptr = entry->val->data;
+        v.len = entry->val->len;
+        return v;
+    };
+    // each layout runs twice, taking turns, the first round warms up
+    for (int round = 0; round < 4; round++) {
+        if (round % 2 == 0) {
+            hit_ns[0] = time_entry_hits(&old_map, names, KEY_SLOT, ops, old_val);
+        }
+        else {
+            hit_ns[1] = time_entry_hits(&new_map, names, KEY_SLOT, ops, &entry_val);
+        }
+    }
+    printf("%zu keys of 30 bytes, values of %zu bytes\n", keys, val_len);
+    printf("%-10s %14s %14s %10s\n", "entry", "heap_bytes/key", "mallocs/key", "hit_ns");
+    const char *layouts[2] = {"StrEntry", "Entry"};
+    for (int m = 0; m < 2; m++) {
+        printf("%-10s %14.1f %14.2f %10.1f\n", layouts[m], bytes[m], mallocs[m], hit_ns[m]);
+    }
+}
+
+/// @brief ns per hash of keys of len bytes, a ring of them stays in the L1 cache
+static double time_hash(uint64_t (*hash)(const uint8_t *, size_t), size_t len, size_t ops) {
+    const size_t RING = 64;
+    std::vector<uint8_t> keys(RING * len);
+    uint64_t rnd = 88172645463325252ULL;
+    for (uint8_t &c : keys) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        c = (uint8_t)('a' + rnd % 26);
+    }
+    uint64_t sum = 0;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < ops; i++) {
+        // the sum feeds the next key, so the hashes are not computed in parallel
+        keys[(i % RING) * len] ^= (uint8_t)(sum & 1);
+        sum += hash(&keys[(i % RING) * len], len);
+    }
+    double ns = (double)(now_ns() - start) / ops;
+    if (sum == 42) {
+        printf("\n"); // keep the sum alive
+    }
+    return ns;
+}
+
+/// @brief How evenly n keys of the form prefix + i spread over the 2^bits buckets picked by
+/// the hash bits from shift up: chi-square over the buckets divided by their number (about 1 if
+/// uniform, far above if the hash clusters) and the fullest bucket
+static void hash_spread(uint64_t (*hash)(const uint8_t *, size_t), const char *prefix, size_t n, uint32_t shift, uint32_t bits, double *chi2, size_t *max) {
+    std::vector<uint32_t> count((size_t)1 << bits);
+    char key[128];
+    for (size_t i = 0; i < n; i++) {
+        int len = snprintf(key, sizeof(key), "%s%zu", prefix, i);
+        count[(hash((const uint8_t *)key, (size_t)len) >> shift) & (count.size() - 1)]++;
+    }
+    double expect = (double)n / count.size();
+    *chi2 = 0;
+    *max = 0;
+    for (uint32_t c : count) {
+        *chi2 += (c - expect) * (c - expect) / expect;
+        *max = c > *max ? c : *max;
+    }
+    *chi2 /= count.size();
+}
+
+/// @brief keys of n which share their full hash with an other key
+static size_t hash_collisions(uint64_t (*hash)(const uint8_t *, size_t), const char *prefix, size_t n) {
+    std::vector<uint64_t> h(n);
+    char key[128];
+    for (size_t i = 0; i < n; i++) {
+        int len = snprintf(key, sizeof(key), "%s%zu", prefix, i);
+        h[i] = hash((const uint8_t *)key, (size_t)len);
+    }
+    std::sort(h.begin(), h.end());
+    size_t same = 0;
+    for (size_t i = 1; i < n; i++) {
+        same += h[i] == h[i - 1];
+    }
+    return same;
+}
+
+static void bench_hash(size_t ops, size_t keys) {
+    struct {
+        const char *name;
+        uint64_t (*hash)(const uint8_t *, size_t);
+    } hashes[] = {{"fnv32", &fnv_hash}, {"hash64", &str_hash}};
+    const size_t lens[] = {8, 16, 40, 64, 100, 1000};
+    printf("%-8s %6s %10s %10s\n", "hash", "bytes", "ns", "GB/s");
+    for (auto &h : hashes) {
+        for (size_t len : lens) {
+            double ns = time_hash(h.hash, len, len >= 1000 ? ops / 10 : ops);
+            printf("%-8s %6zu %10.2f %10.2f\n", h.name, len, ns, len / ns);
+        }
+    }
+    // the buckets of the chained table are the low bits, the groups of the swiss table the
+    // bits from 7 up; 1 key per bucket on average, 16 per group
+    const char *prefixes[] = {"key:", "user:session:4f1c9a2e-0b7d-4e55-9c1a:"};
+    uint32_t bits = 0;
+    while (((size_t)2 << bits) <= keys) {
+        bits++;
+    }
+    printf("\n%zu keys, chi2 per bucket (1.0 is uniform) and fullest bucket\n", keys);
+    printf("%-8s %-10s %12s %8s %12s %8s %10s\n", "hash", "keys", "chain_chi2", "max", "group_chi2", "max", "same_hash");
+    for (auto &h : hashes) {
+        for (const char *prefix : prefixes) {
+            double chain_chi2 = 0;
+            double group_chi2 = 0;
+            size_t chain_max = 0;
+            size_t group_max = 0;
+            hash_spread(h.hash, prefix, keys, 0, bits, &chain_chi2, &chain_max);
+            hash_spread(h.hash, prefix, keys, 7, bits - 4, &group_chi2, &group_max);
+            printf("%-8s %-10.10s %12.2f %8zu %12.2f %8zu %10zu\n", h.name, prefix, chain_chi2, chain_max,
+                   group_chi2, group_max, hash_collisions(h.hash, prefix, keys));
+        }
+    }
+}
+
+static uint64_t table_slots(const HashTable *t) {
+    return t->mask ? t->mask + 1 : 0;
+}
+
+static bool hnode_same(Hnode *lhs, Hnode *rhs) {
+    return lhs == rhs;
+}
+
+/// @brief Latency of every insert while a table grows to keys entries, for some rehash
+/// budgets: the least (one step of nodes per insert), the default, and no limit (the whole
+/// move is done by the insert which starts a resize). Then 9 in 10 keys are popped, and the
+/// slots the table keeps are reported
+static void bench_resize(size_t keys) {
+    RcBuf *value = rcbuf_new("v", 1);
+    std::vector<StrEntry *> entries(keys);
+    for (size_t i = 0; i < keys; i++) {
+        entries[i] = new StrEntry();
+        entries[i]->key = "key:" + std::to_string(i);
+        entries[i]->node.hcode = str_hash((const uint8_t *)entries[i]->key.data(), entries[i]->key.size());
+        entries[i]->val = value;
+    }
+    const uint64_t budgets[] = {0, HashMap{}.rehash_budget_ns, UINT64_MAX};
+    std::vector<uint64_t> lat(keys);
+    printf("%-8s %10s %8s %8s %8s %10s %10s %8s %12s %12s\n", "backend", "budget_ns", "p50_ns", "p99_ns",
+           "p99.9_ns", "max_ns", "moved", "grows", "slots_full", "slots_after");
+    for (uint64_t budget : budgets) {
+        HashMap db;
+        db.rehash_budget_ns = budget;
+        for (size_t i = 0; i < keys; i++) {
+            uint64_t start = now_ns();
+            hashmap_insert(&db, &entries[i]->node);
+            lat[i] = now_ns() - start;
+        }
+        finish_resize(&db);
+        uint64_t slots_full = table_slots(&db.ht1);
+        for (size_t i = 0; i < keys; i++) {
+            if (i % 10 != 0 && hashmap_pop(&db, &entries[i]->node, &hnode_same) != &entries[i]->node) {
+                die("pop");
+            }
+        }
+        finish_resize(&db);
+        std::sort(lat.begin(), lat.end());
+        printf("%-8s %10s %8llu %8llu %8llu %10llu %10llu %8llu %12llu %12llu\n", BACKEND,
+               budget == UINT64_MAX ? "none" : std::to_string(budget).c_str(),
+               (unsigned long long)lat[keys / 2], (unsigned long long)lat[keys - keys / 100],
+               (unsigned long long)lat[keys - keys / 1000], (unsigned long long)lat[keys - 1],
+               (unsigned long long)db.moved, (unsigned long long)db.grows,
+               (unsigned long long)slots_full, (unsigned long long)table_slots(&db.ht1));
+        for (size_t i = 0; i < keys; i += 10) {
+            hashmap_pop(&db, &entries[i]->node, &hnode_same);
+        }
+        hashmap_destroy(&db);
+    }
+}
+
+static void bench_cmd(Args *args, Reply *res) {
+    (void)args;
+    (void)res;
+}
+
+// as many commands as a redis with strings, hashes and sorted sets, spelled the usual way
+static constexpr Command g_bench_commands[] = {
+    {"get", 2, 0, 1, 1, 1, &bench_cmd}, {"set", 3, 0, 1, 1, 1, &bench_cmd},
+    {"del", 2, 0, 1, 1, 1, &bench_cmd}, {"mget", -2, 0, 1, -1, 1, &bench_cmd},
+    {"mset", -3, 0, 1, -1, 2, &bench_cmd}, {"incr", 2, 0, 1, 1, 1, &bench_cmd},
+    {"decr", 2, 0, 1, 1, 1, &bench_cmd}, {"exists", -2, 0, 1, -1, 1, &bench_cmd},
+    {"expire", 3, 0, 1, 1, 1, &bench_cmd}, {"pexpire", 3, 0, 1, 1, 1, &bench_cmd},
+    {"ttl", 2, 0, 1, 1, 1, &bench_cmd}, {"pttl", 2, 0, 1, 1, 1, &bench_cmd},
+    {"persist", 2, 0, 1, 1, 1, &bench_cmd}, {"type", 2, 0, 1, 1, 1, &bench_cmd},
+    {"strlen", 2, 0, 1, 1, 1, &bench_cmd}, {"append", 3, 0, 1, 1, 1, &bench_cmd},
+    {"hget", 3, 0, 1, 1, 1, &bench_cmd}, {"hset", -4, 0, 1, 1, 1, &bench_cmd},
+    {"hdel", -3, 0, 1, 1, 1, &bench_cmd}, {"hlen", 2, 0, 1, 1, 1, &bench_cmd},
+    {"zadd", -4, 0, 1, 1, 1, &bench_cmd}, {"zrem", -3, 0, 1, 1, 1, &bench_cmd},
+    {"zscore", 3, 0, 1, 1, 1, &bench_cmd}, {"zrank", 3, 0, 1, 1, 1, &bench_cmd},
+    {"zrange", -4, 0, 1, 1, 1, &bench_cmd}, {"zcard", 2, 0, 1, 1, 1, &bench_cmd},
+    {"scan", -2, 0, 0, 0, 0, &bench_cmd}, {"dbsize", 1, 0, 0, 0, 0, &bench_cmd},
+    {"ping", -1, 0, 0, 0, 0, &bench_cmd}, {"hello", -1, 0, 0, 0, 0, &bench_cmd},
+    {"info", -1, 0, 0, 0, 0, &bench_cmd}, {"stats", 1, 0, 0, 0, 0, &bench_cmd},
+};
+static constexpr size_t BENCH_CMDS = sizeof(g_bench_commands) / sizeof(g_bench_commands[0]);
+static constexpr CmdIndex g_bench_index = cmd_index_build(g_bench_commands);
+static_assert(g_bench_index.seed != 0, "no perfect hash for the command names");
+
+static const Command *lookup_chain(Slice name) {
+    for (size_t i = 0; i < BENCH_CMDS; i++) {
+        if (slice_is(name, g_bench_commands[i].name)) {
+            return &g_bench_commands[i];
+        }
+    }
+    return NULL;
+}
+
+static const Command *lookup_hash(Slice name) {
+    int32_t i = cmd_index_find(g_bench_index, g_bench_commands, name.ptr, name.len);
+    if (i < 0) {
+        return NULL;
+    }
+    return &g_bench_commands[i];
+}
+
+static void bench_dispatch(size_t ops) {
+    printf("%-10s %14s %14s\n", "command", "chain_ns", "hash_ns");
+    for (const char *word : {"GET", "zadd", "STATS"}) {
+        Slice name;
+        name.ptr = (const uint8_t *)word;
+        name.len = strlen(word);
+        const Command *(*lookups[2])(Slice) = {&lookup_chain, &lookup_hash};
+        double ns[2] = {};
+        for (int l = 0; l < 2; l++) {
+            size_t found = 0;
+            uint64_t start = now_ns();
+            for (size_t i = 0; i < ops; i++) {
+                // keep the compiler from hoisting the lookup out of the loop
+                asm volatile("" : "+r"(name.ptr));
+                found += lookups[l](name) != NULL;
+            }
+            ns[l] = (double)(now_ns() - start) / ops;
+            if (found != ops) {
+                die("command not found");
+            }
+        }
+        printf("%-10s %14.1f %14.1f\n", word, ns[0], ns[1]);
+    }
+}
+
+/// @brief reads the first word of ops random objects, the cost is the cache and TLB misses
+static double time_reads(const std::vector<uint8_t *> &objs, size_t ops) {
+    uint64_t rnd = 2463534242ULL;
+    uint64_t sum = 0;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < ops; i++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        sum += *(uint64_t *)objs[rnd % objs.size()];
+    }
+    double ns = (double)(now_ns() - start) / ops;
+    if (sum == 42) {
+        printf("\n"); // keep the sum alive
+    }
+    return ns;
+}
+
+/// @brief objects live objects of random sizes, then ops times a random one is freed and one of
+/// another size allocated in its place, by malloc and by the slabs, each in turn
+static void bench_slab(size_t objects, size_t ops, bool thp) {
+    const size_t MIN_SIZE = 48;
+    const size_t MAX_SIZE = 320;
+    slab_set_thp(thp);
+    std::vector<uint8_t *> objs(objects);
+    std::vector<uint32_t> sizes(objects);
+    double churn_ns[2] = {};
+    double bytes[2] = {};
+    double read_ns[2] = {};
+    for (int a = 0; a < 2; a++) {
+        auto alloc = [a](size_t size) {
+            uint8_t *obj = (uint8_t *)(a == 0 ? malloc(size) : slab_alloc(size));
+            if (!obj) {
+                die("out of memory");
+            }
+            memset(obj, 0, 8);
+            return obj;
+        };
+        auto release = [a](uint8_t *obj, size_t size) {
+            if (a == 0) {
+                free(obj);
+            }
+            else {
+                slab_free(obj, size);
+            }
+        };
+        struct mallinfo2 mi = mallinfo2();
+        size_t before = a == 0 ? mi.arena + mi.hblkhd : (size_t)slab_stats().slab_bytes;
+        uint64_t rnd = 88172645463325252ULL;
+        for (size_t i = 0; i < objects; i++) {
+            sizes[i] = (uint32_t)(MIN_SIZE + rnd % (MAX_SIZE - MIN_SIZE + 1));
+            rnd ^= rnd << 13;
+            rnd ^= rnd >> 7;
+            rnd ^= rnd << 17;
+            objs[i] = alloc(sizes[i]);
+        }
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < ops; i++) {
+            rnd ^= rnd << 13;
+            rnd ^= rnd >> 7;
+            rnd ^= rnd << 17;
+            size_t j = rnd % objects;
+            release(objs[j], sizes[j]);
+            sizes[j] = (uint32_t)(MIN_SIZE + (rnd >> 32) % (MAX_SIZE - MIN_SIZE + 1));
+            objs[j] = alloc(sizes[j]);
+        }
+        churn_ns[a] = (double)(now_ns() - start) / ops;
+        // what the allocator holds, free memory in its lists included
+        mi = mallinfo2();
+        size_t after = a == 0 ? mi.arena + mi.hblkhd : (size_t)slab_stats().slab_bytes;
+        bytes[a] = (double)(after - before) / objects;
+        read_ns[a] = time_reads(objs, ops);
+        for (size_t i = 0; i < objects; i++) {
+            release(objs[i], sizes[i]);
+        }
+    }
+    SlabStats stats = slab_stats();
+    printf("%zu objects of %zu to %zu bytes, %zu churn ops, slabs on %s pages\n", objects,
+        MIN_SIZE, MAX_SIZE, ops, thp ? "huge" : "4KB");
+    printf("%-8s %10s %14s %10s\n", "alloc", "churn_ns", "bytes/object", "read_ns");
+    const char *allocs[2] = {"malloc", "slab"};
+    for (int a = 0; a < 2; a++) {
+        printf("%-8s %10.1f %14.1f %10.1f\n", allocs[a], churn_ns[a], bytes[a], read_ns[a]);
+    }
+    printf("slabs %lld, live %lld, cached %lld\n", (long long)stats.slabs, (long long)stats.live,
+        (long long)stats.cached);
+}
+
+/// @brief the member after this one in the AVL tree of a set, NULL after the last one
+static ZNode *znode_next(ZNode *znode) {
+    return znode_of(avl_next(&znode->tree));
+}
+
+/// @brief the member offset ranks away in the AVL tree of a set
+static ZNode *znode_offset(ZNode *znode, int64_t offset) {
+    return znode_of(avl_offset(&znode->tree, offset));
+}
+
+/// @brief the recursive walk of the extract() of avl_tree/avl_test.cpp
+static void walk_recursive(AVLnode *node, double *sum) {
+    if (!node) {
+        return;
+    }
+    walk_recursive(node->left, sum);
+    *sum += znode_of(node)->score;
+    walk_recursive(node->right, sum);
+}
+
+static void bench_zrange(size_t members, size_t queries, size_t count) {
+    zset_set_btree_min(0); // the walks of the AVL tree
+    ZSet *zset = zset_new();
+    if (!zset) {
+        die("out of memory");
+    }
+    uint64_t rnd = 88172645463325252ULL;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < members; i++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        char name[24];
+        Slice slice;
+        slice.ptr = (const uint8_t *)name;
+        slice.len = (size_t)snprintf(name, sizeof(name), "member:%zu", i);
+        bool added = false;
+        if (!zset_add(zset, slice, (double)(rnd % (members * 4)), &added)) {
+            die("out of memory");
+        }
+    }
+    printf("%zu members added in %.1f s, %zu bytes per member\n", members,
+        (double)(now_ns() - start) / 1e9, zset_mem(zset) / members);
+
+    ZNode *first = zset_at(zset, 0);
+    // stepping is O(offset), it gets fewer queries
+    size_t linear_queries = std::max<size_t>(queries / 10000, 1);
+    double page_ns[2] = {};
+    double sum = 0;
+    for (int way = 0; way < 2; way++) {
+        size_t n = way == 0 ? linear_queries : queries;
+        uint64_t q_rnd = 2463534242ULL;
+        start = now_ns();
+        for (size_t q = 0; q < n; q++) {
+            q_rnd ^= q_rnd << 13;
+            q_rnd ^= q_rnd >> 7;
+            q_rnd ^= q_rnd << 17;
+            size_t offset = q_rnd % (members - count);
+            ZNode *znode = first;
+            if (way == 0) {
+                for (size_t i = 0; i < offset; i++) {
+                    znode = znode_next(znode);
+                }
+            }
+            else {
+                znode = znode_offset(first, (int64_t)offset);
+            }
+            for (size_t i = 0; i < count; i++, znode = znode_next(znode)) {
+                sum += znode->score;
+            }
+        }
+        page_ns[way] = (double)(now_ns() - start) / n;
+    }
+    // both ways land on the same member
+    for (size_t offset : {(size_t)0, members / 3, members - 1}) {
+        ZNode *znode = first;
+        for (size_t i = 0; i < offset; i++) {
+            znode = znode_next(znode);
+        }
+        if (znode != znode_offset(first, (int64_t)offset) || zset_rank(zset, znode) != offset) {
+            die("avl_offset() is off");
+        }
+    }
+
+    double walk_ns[2] = {};
+    start = now_ns();
+    walk_recursive(zset->tree, &sum);
+    walk_ns[1] = (double)(now_ns() - start) / members;
+    start = now_ns();
+    for (ZNode *znode = first; znode; znode = znode_next(znode)) {
+        sum += znode->score;
+    }
+    walk_ns[0] = (double)(now_ns() - start) / members;
+    if (sum == 42) {
+        printf("\n"); // keep the sum alive
+    }
+
+    printf("pages of %zu members at a random offset\n", count);
+    printf("%-14s %8s %14s\n", "seek", "queries", "ns/query");
+    printf("%-14s %8zu %14.1f\n", "avl_next", linear_queries, page_ns[0]);
+    printf("%-14s %8zu %14.1f\n", "avl_offset", queries, page_ns[1]);
+    printf("walk of all members: avl_next %.1f ns, recursive %.1f ns per member\n", walk_ns[0], walk_ns[1]);
+    zset_del(zset);
+}
+
+static void bench_zbuild(size_t members) {
+    const size_t NAME_LEN = 24;
+    std::vector<char> text(members * NAME_LEN);
+    std::vector<Slice> names(members);
+    std::vector<double> scores(members);
+    uint64_t rnd = 88172645463325252ULL;
+    for (size_t i = 0; i < members; i++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        names[i].ptr = (const uint8_t *)&text[i * NAME_LEN];
+        names[i].len = (size_t)snprintf(&text[i * NAME_LEN], NAME_LEN, "member:%zu", i);
+        scores[i] = (double)(rnd % (members * 4));
+    }
+    zset_set_btree_min(0); // avl_build() against the inserts
+    double load_ns[2] = {};
+    uint32_t depth[2] = {};
+    for (int way = 0; way < 2; way++) {
+        ZSet *zset = zset_new();
+        if (!zset) {
+            die("out of memory");
+        }
+        uint64_t start = now_ns();
+        if (way == 0) {
+            for (size_t i = 0; i < members; i++) {
+                bool added = false;
+                if (!zset_add(zset, names[i], scores[i], &added)) {
+                    die("out of memory");
+                }
+            }
+        }
+        else {
+            size_t added = 0;
+            if (!zset_add_many(zset, names.data(), scores.data(), members, &added)) {
+                die("out of memory");
+            }
+        }
+        load_ns[way] = (double)(now_ns() - start) / members;
+        depth[way] = avl_depth(zset->tree);
+        if (zset_len(zset) != members) {
+            die("members lost");
+        }
+        zset_del(zset);
+    }
+    // the tree alone, from the nodes in order
+    ZSet *zset = zset_new();
+    size_t added = 0;
+    if (!zset || !zset_add_many(zset, names.data(), scores.data(), members, &added)) {
+        die("out of memory");
+    }
+    std::vector<AVLnode *> nodes;
+    nodes.reserve(members);
+    for (AVLnode *node = avl_at(zset->tree, 0); node; node = avl_next(node)) {
+        nodes.push_back(node);
+    }
+    uint64_t start = now_ns();
+    zset->tree = avl_build(nodes.data(), nodes.size());
+    double build_ns = (double)(now_ns() - start) / members;
+    zset_del(zset);
+
+    printf("%zu members with random scores\n", members);
+    printf("%-16s %10s %8s\n", "load", "ns/member", "depth");
+    printf("%-16s %10.1f %8u\n", "zset_add", load_ns[0], depth[0]);
+    printf("%-16s %10.1f %8u\n", "zset_add_many", load_ns[1], depth[1]);
+    printf("avl_build of the nodes in order: %.1f ns per member\n", build_ns);
+}
+
+static void bench_ordered(size_t members, size_t ops) {
+    const size_t NAME_LEN = 24;
+    const size_t PAGE = 10;
+    std::vector<char> text(members * NAME_LEN);
+    std::vector<Slice> names(members);
+    std::vector<double> scores(members);
+    std::vector<size_t> picks(ops); // members, in a random order
+    uint64_t rnd = 88172645463325252ULL;
+    for (size_t i = 0; i < members; i++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        names[i].ptr = (const uint8_t *)&text[i * NAME_LEN];
+        names[i].len = (size_t)snprintf(&text[i * NAME_LEN], NAME_LEN, "member:%zu", i);
+        scores[i] = (double)(rnd % (members * 4));
+    }
+    for (size_t q = 0; q < ops; q++) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        picks[q] = rnd % members;
+    }
+    const char *trees[] = {"avl", "btree"};
+    double ns[2][5] = {};
+    size_t bytes[2] = {};
+    double sum = 0;
+    for (int way = 0; way < 2; way++) {
+        zset_set_btree_min(way == 0 ? 0 : 1);
+        ZSet *zset = zset_new();
+        if (!zset) {
+            die("out of memory");
+        }
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < members; i++) {
+            bool added = false;
+            if (!zset_add(zset, names[i], scores[i], &added)) {
+                die("out of memory");
+            }
+        }
+        ns[way][0] = (double)(now_ns() - start) / members;
+        if (zset->use_btree != (way == 1) || zset_len(zset) != members) {
+            die("not the tree asked for");
+        }
+        bytes[way] = zset_mem(zset) / members;
+
+        std::vector<ZNode *> znodes(ops); // found before, the rank alone is timed
+        for (size_t q = 0; q < ops; q++) {
+            znodes[q] = zset_lookup(zset, names[picks[q]]);
+        }
+        uint64_t ranks = 0;
+        start = now_ns();
+        for (size_t q = 0; q < ops; q++) {
+            ranks += zset_rank(zset, znodes[q]);
+        }
+        ns[way][1] = (double)(now_ns() - start) / ops;
+
+        start = now_ns();
+        for (size_t q = 0; q < ops; q++) {
+            uint64_t rank = zset_seek(zset, scores[picks[q]], false);
+            ZIter it = zset_iter(zset, rank);
+            for (size_t i = 0; i < PAGE && it.znode; i++, zset_iter_next(zset, &it)) {
+                sum += it.znode->score;
+            }
+        }
+        ns[way][2] = (double)(now_ns() - start) / ops;
+
+        start = now_ns();
+        for (size_t q = 0; q < ops; q++) {
+            sum += zset_at(zset, picks[q])->score;
+        }
+        ns[way][3] = (double)(now_ns() - start) / ops;
+
+        // both trees agree on the order
+        for (size_t q = 0; q < std::min<size_t>(ops, 1000); q++) {
+            if (zset_at(zset, zset_rank(zset, znodes[q])) != znodes[q]) {
+                die("rank and select disagree");
+            }
+        }
+        sum += (double)ranks;
+
+        start = now_ns();
+        for (size_t i = 0; i < members; i++) {
+            if (!zset_pop(zset, names[i])) {
+                die("member lost");
+            }
+        }
+        ns[way][4] = (double)(now_ns() - start) / members;
+        if (zset_len(zset) != 0) {
+            die("members left");
+        }
+        zset_del(zset);
+    }
+    if (sum == 42) {
+        printf("\n"); // keep the sum alive
+    }
+
+    printf("%zu members with random scores, %zu ops\n", members, ops);
+    printf("%-8s %10s %10s %12s %10s %10s %12s\n", "tree", "add", "rank", "range 10", "at", "pop",
+        "bytes/member");
+    for (int way = 0; way < 2; way++) {
+        printf("%-8s %10.1f %10.1f %12.1f %10.1f %10.1f %12zu\n", trees[way], ns[way][0], ns[way][1],
+            ns[way][2], ns[way][3], ns[way][4], bytes[way]);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "get") == 0) {
+        size_t keys = argc >= 3 ? strtoul(argv[2], NULL, 10) : 100000;
+        size_t ops = argc >= 4 ? strtoul(argv[3], NULL, 10) : 5000000;
+        bench_get(keys, ops);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "mget") == 0) {
+        size_t keys = argc >= 3 ? strtoul(argv[2], NULL, 10) : 8000000;
+        size_t batch = argc >= 4 ? strtoul(argv[3], NULL, 10) : 100;
+        size_t batches = argc >= 5 ? strtoul(argv[4], NULL, 10) : 20000;
+        bench_mget(keys, batch, batches);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "table") == 0) {
+        size_t keys = argc >= 3 ? strtoul(argv[2], NULL, 10) : 1000000;
+        size_t ops = argc >= 4 ? strtoul(argv[3], NULL, 10) : 5000000;
+        bench_table(keys, ops);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "entry") == 0) {
+        size_t keys = argc >= 3 ? strtoul(argv[2], NULL, 10) : 2000000;
+        size_t ops = argc >= 4 ? strtoul(argv[3], NULL, 10) : 5000000;
+        size_t val_len = argc >= 5 ? strtoul(argv[4], NULL, 10) : 60;
+        bench_entry(keys, ops, val_len);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "hmap") == 0) {
+        size_t keys = argc >= 3 ? strtoul(argv[2], NULL, 10) : 10000;
+        size_t ops = argc >= 4 ? strtoul(argv[3], NULL, 10) : 10000000;
+        bench_hmap(keys, ops);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "resize") == 0) {
+        size_t keys = argc >= 3 ? strtoul(argv[2], NULL, 10) : 4000000;
+        bench_resize(keys);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "hash") == 0) {
+        size_t ops = argc >= 3 ? strtoul(argv[2], NULL, 10) : 20000000;
+        size_t keys = argc >= 4 ? strtoul(argv[3], NULL, 10) : 1 << 20;
+        bench_hash(ops, keys);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "dispatch") == 0) {
+        size_t ops = argc >= 3 ? strtoul(argv[2], NULL, 10) : 20000000;
+        bench_dispatch(ops);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "slab") == 0) {
+        size_t objects = argc >= 3 ? strtoul(argv[2], NULL, 10) : 4000000;
+        size_t ops = argc >= 4 ? strtoul(argv[3], NULL, 10) : 20000000;
+        bool thp = argc >= 5 && strcmp(argv[4], "thp") == 0;
+        bench_slab(objects, ops, thp);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "zrange") == 0) {
+        size_t members = argc >= 3 ? strtoul(argv[2], NULL, 10) : 10000000;
+        size_t queries = argc >= 4 ? strtoul(argv[3], NULL, 10) : 100000;
+        size_t count = argc >= 5 ? strtoul(argv[4], NULL, 10) : 10;
+        if (members <= count) {
+            die("members must be more than count");
+        }
+        bench_zrange(members, queries, count);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "zbuild") == 0) {
+        size_t members = argc >= 3 ? strtoul(argv[2], NULL, 10) : 10000000;
+        bench_zbuild(members);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "ordered") == 0) {
+        size_t members = argc >= 3 ? strtoul(argv[2], NULL, 10) : 1000000;
+        size_t ops = argc >= 4 ? strtoul(argv[3], NULL, 10) : 1000000;
+        bench_ordered(members, ops);
+        return 0;
+    }
+    fprintf(stderr, "usage: %s get [keys] [ops]\n", argv[0]);
+    fprintf(stderr, "       %s mget [keys] [batch] [batches]\n", argv[0]);
+    fprintf(stderr, "       %s table [keys] [ops]\n", argv[0]);
+    fprintf(stderr, "       %s entry [keys] [ops] [value_bytes]\n", argv[0]);
+    fprintf(stderr, "       %s hmap [keys] [ops]\n", argv[0]);
+    fprintf(stderr, "       %s resize [keys]\n", argv[0]);
+    fprintf(stderr, "       %s hash [ops] [keys]\n", argv[0]);
+    fprintf(stderr, "       %s dispatch [ops]\n", argv[0]);
+    fprintf(stderr, "       %s slab [objects] [ops] [thp]\n", argv[0]);
+    fprintf(stderr, "       %s zrange [members] [queries] [count]\n", argv[0]);
+    fprintf(stderr, "       %s zbuild [members]\n", argv[0]);
+    fprintf(stderr, "       %s ordered [members] [ops]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,476 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <new>
+#include <vector>
+
+#include "slab.h"
+#include "btree.h"
+
+static const uint32_t BT_FILL = BT_FANOUT * 3 / 4; // entries per node of a bulk build, room is left for inserts
+
+/**
+ * @brief the number of keys of a node below key (or equal with or_equal), the keys are sorted
+ * thus it is the position of the first key which is not. Branch free, two keys per compare
+ * @param n : keys, at most BT_FANOUT
+ */
+static inline uint32_t keys_below(const double *keys, uint32_t n, double key, bool or_equal) {
+#ifdef __SSE2__
+    __m128d k = _mm_set1_pd(key);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i += 2) {
+        __m128d pair = _mm_loadu_pd(keys + i);
+        uint32_t bits = (uint32_t)_mm_movemask_pd(or_equal ? _mm_cmple_pd(pair, k) : _mm_cmplt_pd(pair, k));
+        if (i + 1 == n) {
+            bits &= 1; // the key past the last one, n is odd
+        }
+        count += (bits & 1) + (bits >> 1); // no popcnt instruction in the baseline x86-64
+    }
+    return count;
+#else
+    uint32_t count = 0;
+    while (count < n && (or_equal ? keys[count] <= key : keys[count] < key)) {
+        count++;
+    }
+    return count;
+#endif
+}
+
+/// @brief the number of entries of a node up to (key, item), those with an equal key are
+/// ordered by bt->less
+static uint32_t entries_upto(BTree *bt, BtNode *node, double key, const void *item) {
+    uint32_t i = keys_below(node->keys, node->n, key, false);
+    while (i < node->n && node->keys[i] == key && !bt->less(item, node->items[i])) {
+        i++;
+    }
+    return i;
+}
+
+/// @brief the child of an inner node (key, item) is under, or would be: the last one whose
+/// smallest entry is not above it, the first if there is none
+static uint32_t child_of(BTree *bt, BtNode *node, double key, const void *item) {
+    uint32_t i = entries_upto(bt, node, key, item);
+    return i > 0 ? i - 1 : 0;
+}
+
+static BtInner *as_inner(BtNode *node) {
+    return (BtInner *)node;
+}
+
+static uint64_t node_count(BtNode *node) {
+    if (node->leaf) {
+        return node->n;
+    }
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < node->n; i++) {
+        count += as_inner(node)->counts[i];
+    }
+    return count;
+}
+
+/// @return NULL if out of memory
+static BtNode *node_new(BTree *bt, bool leaf) {
+    size_t size = leaf ? sizeof(BtLeaf) : sizeof(BtInner);
+    void *mem = slab_alloc(size);
+    if (!mem) {
+        return NULL;
+    }
+    bt->bytes += slab_size(size);
+    if (leaf) {
+        BtLeaf *node = new (mem) BtLeaf();
+        node->head.leaf = 1;
+        return &node->head;
+    }
+    return &(new (mem) BtInner())->head;
+}
+
+static void node_del(BTree *bt, BtNode *node) {
+    size_t size = node->leaf ? sizeof(BtLeaf) : sizeof(BtInner);
+    bt->bytes -= slab_size(size);
+    slab_free(node, size);
+}
+
+/// @brief move n entries, with the children and counts of an inner node, the ranges may overlap
+static void move_entries(BtNode *dst, uint32_t dpos, BtNode *src, uint32_t spos, uint32_t n) {
+    memmove(&dst->keys[dpos], &src->keys[spos], n * sizeof(double));
+    memmove(&dst->items[dpos], &src->items[spos], n * sizeof(void *));
+    if (!src->leaf) {
+        memmove(&as_inner(dst)->children[dpos], &as_inner(src)->children[spos], n * sizeof(BtNode *));
+        memmove(&as_inner(dst)->counts[dpos], &as_inner(src)->counts[spos], n * sizeof(uint32_t));
+    }
+}
+
+/// @brief the smallest entry under child i, after it changed
+static void sep_update(BtInner *parent, uint32_t i) {
+    BtNode *child = parent->children[i];
+    parent->head.keys[i] = child->keys[0];
+    parent->head.items[i] = child->items[0];
+}
+
+static void leaf_insert(BtNode *node, uint32_t pos, double key, void *item) {
+    move_entries(node, pos + 1, node, pos, node->n - pos);
+    node->keys[pos] = key;
+    node->items[pos] = item;
+    node->n++;
+}
+
+static void inner_insert(BtInner *parent, uint32_t pos, BtNode *child) {
+    move_entries(&parent->head, pos + 1, &parent->head, pos, parent->head.n - pos);
+    parent->children[pos] = child;
+    parent->counts[pos] = (uint32_t)node_count(child);
+    parent->head.n++;
+    sep_update(parent, pos);
+}
+
+/// @brief move the upper half of a full node to an empty one, which follows it
+static void node_split(BtNode *node, BtNode *right) {
+    const uint32_t half = BT_FANOUT / 2;
+    move_entries(right, 0, node, half, half);
+    node->n = right->n = half;
+    if (node->leaf) {
+        BtLeaf *l = (BtLeaf *)node;
+        BtLeaf *r = (BtLeaf *)right;
+        r->next = l->next;
+        r->prev = l;
+        if (l->next) {
+            l->next->prev = r;
+        }
+        l->next = r;
+    }
+}
+
+/**
+ * @brief insert an item which is not in the tree yet. The nodes a split needs (the leaf, the
+ * full inner nodes above it and a new root if every one is full) are allocated before anything
+ * changes, thus running out of memory leaves the tree as it was
+ * @return false if out of memory
+ */
+bool bt_insert(BTree *bt, double key, void *item) {
+    if (!bt->root) {
+        if (!(bt->root = node_new(bt, true))) {
+            return false;
+        }
+        leaf_insert(bt->root, 0, key, item);
+        bt->len = 1;
+        return true;
+    }
+    BtInner *path[BT_MAX_DEPTH];
+    uint32_t slots[BT_MAX_DEPTH];
+    uint32_t depth = 0;
+    BtNode *node = bt->root;
+    while (!node->leaf) {
+        uint32_t i = child_of(bt, node, key, item);
+        path[depth] = as_inner(node);
+        slots[depth++] = i;
+        node = as_inner(node)->children[i];
+    }
+    uint32_t splits = 0;
+    if (node->n == BT_FANOUT) {
+        splits = 1;
+        while (splits <= depth && path[depth - splits]->head.n == BT_FANOUT) {
+            splits++;
+        }
+    }
+    // fresh[0] is the right half of the leaf, fresh[k] of path[depth - k], the last the root
+    BtNode *fresh[BT_MAX_DEPTH + 1];
+    uint32_t need = splits + (splits == depth + 1 ? 1 : 0);
+    for (uint32_t k = 0; k < need; k++) {
+        if (!(fresh[k] = node_new(bt, k == 0))) {
+            while (k > 0) {
+                node_del(bt, fresh[--k]);
+            }
+            return false;
+        }
+    }
+    uint32_t pos = entries_upto(bt, node, key, item);
+    BtNode *sibling = NULL; // the new right half of the node below, its parent links it
+    if (node->n < BT_FANOUT) {
+        leaf_insert(node, pos, key, item);
+    }
+    else {
+        sibling = fresh[0];
+        node_split(node, sibling);
+        if (pos <= BT_FANOUT / 2) {
+            leaf_insert(node, pos, key, item);
+        }
+        else {
+            leaf_insert(sibling, pos - BT_FANOUT / 2, key, item);
+        }
+    }
+    for (uint32_t d = depth; d-- > 0;) {
+        BtInner *parent = path[d];
+        uint32_t s = slots[d];
+        if (!sibling) {
+            parent->counts[s]++;
+            sep_update(parent, s); // the item may be the smallest of the child now
+            continue;
+        }
+        parent->counts[s] = (uint32_t)node_count(parent->children[s]);
+        sep_update(parent, s);
+        if (parent->head.n < BT_FANOUT) {
+            inner_insert(parent, s + 1, sibling);
+            sibling = NULL;
+            continue;
+        }
+        BtInner *right = as_inner(fresh[depth - d]);
+        node_split(&parent->head, &right->head);
+        if (s + 1 <= BT_FANOUT / 2) {
+            inner_insert(parent, s + 1, sibling);
+        }
+        else {
+            inner_insert(right, s + 1 - BT_FANOUT / 2, sibling);
+        }
+        sibling = &right->head;
+    }
+    if (sibling) {
+        BtInner *root = as_inner(fresh[need - 1]);
+        inner_insert(root, 0, bt->root);
+        inner_insert(root, 1, sibling);
+        bt->root = &root->head;
+    }
+    bt->len++;
+    return true;
+}
+
+/**
+ * @brief child i of parent has fewer than BT_MIN entries: merge it with a sibling if both fit
+ * in one node, else move entries over from the sibling until they have half each
+ */
+static void rebalance(BTree *bt, BtInner *parent, uint32_t i) {
+    if (parent->head.n < 2) {
+        return; // the root, which is collapsed by the caller
+    }
+    uint32_t j = i + 1 < parent->head.n ? i : i - 1; // children j and j + 1
+    BtNode *a = parent->children[j];
+    BtNode *b = parent->children[j + 1];
+    if (a->n + b->n <= BT_FANOUT) {
+        move_entries(a, a->n, b, 0, b->n);
+        a->n += b->n;
+        if (a->leaf) {
+            BtLeaf *la = (BtLeaf *)a;
+            la->next = ((BtLeaf *)b)->next;
+            if (la->next) {
+                la->next->prev = la;
+            }
+        }
+        node_del(bt, b);
+        move_entries(&parent->head, j + 1, &parent->head, j + 2, parent->head.n - j - 2);
+        parent->head.n--;
+        parent->counts[j] = (uint32_t)node_count(a);
+        sep_update(parent, j);
+        return;
+    }
+    uint32_t half = (a->n + b->n) / 2;
+    if (a->n < half) {
+        uint32_t k = half - a->n;
+        move_entries(a, a->n, b, 0, k);
+        move_entries(b, 0, b, k, b->n - k);
+        a->n += k;
+        b->n -= k;
+    }
+    else {
+        uint32_t k = a->n - half;
+        move_entries(b, k, b, 0, b->n);
+        move_entries(b, 0, a, a->n - k, k);
+        a->n -= k;
+        b->n += k;
+    }
+    parent->counts[j] = (uint32_t)node_count(a);
+    parent->counts[j + 1] = (uint32_t)node_count(b);
+    sep_update(parent, j);
+    sep_update(parent, j + 1);
+}
+
+/**
+ * @brief take an item out of the tree, the nodes left with fewer than BT_MIN entries are merged
+ * or refilled on the way up
+ * @return false if it is not in the tree
+ */
+bool bt_delete(BTree *bt, double key, void *item) {
+    if (!bt->root) {
+        return false;
+    }
+    BtInner *path[BT_MAX_DEPTH];
+    uint32_t slots[BT_MAX_DEPTH];
+    uint32_t depth = 0;
+    BtNode *node = bt->root;
+    while (!node->leaf) {
+        uint32_t i = child_of(bt, node, key, item);
+        path[depth] = as_inner(node);
+        slots[depth++] = i;
+        node = as_inner(node)->children[i];
+    }
+    uint32_t pos = entries_upto(bt, node, key, item);
+    if (pos == 0 || node->items[pos - 1] != item) {
+        return false;
+    }
+    pos--;
+    move_entries(node, pos, node, pos + 1, node->n - pos - 1);
+    node->n--;
+    bt->len--;
+    for (uint32_t d = depth; d-- > 0;) {
+        path[d]->counts[slots[d]]--;
+        if (path[d]->children[slots[d]]->n > 0) {
+            sep_update(path[d], slots[d]);
+        }
+    }
+    for (uint32_t d = depth; d-- > 0;) {
+        if (path[d]->children[slots[d]]->n >= BT_MIN) {
+            break; // the nodes above did not change
+        }
+        rebalance(bt, path[d], slots[d]);
+    }
+    while (!bt->root->leaf && bt->root->n == 1) {
+        BtNode *old = bt->root;
+        bt->root = as_inner(old)->children[0];
+        node_del(bt, old);
+    }
+    if (bt->root->leaf && bt->root->n == 0) {
+        node_del(bt, bt->root);
+        bt->root = NULL;
+    }
+    return true;
+}
+
+/// @brief the rank of an item in the tree from 0, the counts of the children left of the way
+/// down to it are summed, O(log n)
+uint64_t bt_rank(BTree *bt, double key, const void *item) {
+    uint64_t rank = 0;
+    BtNode *node = bt->root;
+    while (!node->leaf) {
+        uint32_t i = child_of(bt, node, key, item);
+        for (uint32_t k = 0; k < i; k++) {
+            rank += as_inner(node)->counts[k];
+        }
+        node = as_inner(node)->children[i];
+    }
+    return rank + entries_upto(bt, node, key, item) - 1;
+}
+
+/**
+ * @brief the rank of the first item of a key range, a walk down from the root
+ * @param after : the first item whose key is above key, else at least key
+ * @return bt->len if there is none
+ */
+uint64_t bt_seek(BTree *bt, double key, bool after) {
+    uint64_t rank = 0;
+    BtNode *node = bt->root;
+    if (!node) {
+        return 0;
+    }
+    while (!node->leaf) {
+        // the last child whose smallest key is below, the ones after have none
+        uint32_t i = keys_below(node->keys, node->n, key, after);
+        i = i > 0 ? i - 1 : 0;
+        for (uint32_t k = 0; k < i; k++) {
+            rank += as_inner(node)->counts[k];
+        }
+        node = as_inner(node)->children[i];
+    }
+    return rank + keys_below(node->keys, node->n, key, after);
+}
+
+/// @brief the position of a rank, going down the child whose counts cover it, O(log n)
+/// @return a position past the end if the tree has no more than rank items
+BtPos bt_at(BTree *bt, uint64_t rank) {
+    BtPos pos;
+    if (rank >= bt->len) {
+        return pos;
+    }
+    BtNode *node = bt->root;
+    while (!node->leaf) {
+        uint32_t i = 0;
+        while (rank >= as_inner(node)->counts[i]) {
+            rank -= as_inner(node)->counts[i];
+            i++;
+        }
+        node = as_inner(node)->children[i];
+    }
+    pos.leaf = (BtLeaf *)node;
+    pos.slot = (uint32_t)rank;
+    return pos;
+}
+
+/**
+ * @brief build the tree of an empty BTree from items which are in order, in O(n): the leaves
+ * are filled to BT_FILL each and linked, then every level above them the same way, until a
+ * level has a single node
+ * @param keys : of the items
+ * @return false if out of memory, the tree is empty then
+ */
+bool bt_build(BTree *bt, const double *keys, void *const *items, size_t n) {
+    assert(!bt->root);
+    if (n == 0) {
+        return true;
+    }
+    std::vector<BtNode *> made; // every node, freed if one can't be allocated
+    std::vector<BtNode *> level((n + BT_FILL - 1) / BT_FILL);
+    bool ok = true;
+    BtLeaf *prev = NULL;
+    for (size_t k = 0; k < level.size() && ok; k++) {
+        if (!(level[k] = node_new(bt, true))) {
+            ok = false;
+            break;
+        }
+        made.push_back(level[k]);
+        // the items spread evenly, every leaf gets n / leaves of them or one more
+        size_t lo = n * k / level.size();
+        size_t hi = n * (k + 1) / level.size();
+        memcpy(level[k]->keys, keys + lo, (hi - lo) * sizeof(double));
+        memcpy(level[k]->items, items + lo, (hi - lo) * sizeof(void *));
+        level[k]->n = (uint32_t)(hi - lo);
+        BtLeaf *leaf = (BtLeaf *)level[k];
+        leaf->prev = prev;
+        if (prev) {
+            prev->next = leaf;
+        }
+        prev = leaf;
+    }
+    while (ok && level.size() > 1) {
+        std::vector<BtNode *> up((level.size() + BT_FILL - 1) / BT_FILL);
+        for (size_t k = 0; k < up.size() && ok; k++) {
+            if (!(up[k] = node_new(bt, false))) {
+                ok = false;
+                break;
+            }
+            made.push_back(up[k]);
+            size_t lo = level.size() * k / up.size();
+            size_t hi = level.size() * (k + 1) / up.size();
+            for (size_t c = lo; c < hi; c++) {
+                inner_insert(as_inner(up[k]), (uint32_t)(c - lo), level[c]);
+            }
+        }
+        level.swap(up);
+    }
+    if (!ok) {
+        for (BtNode *node : made) {
+            node_del(bt, node);
+        }
+        return false;
+    }
+    bt->root = level[0];
+    bt->len = n;
+    return true;
+}
+
+static void free_nodes(BTree *bt, BtNode *node) {
+    if (!node->leaf) {
+        for (uint32_t i = 0; i < node->n; i++) {
+            free_nodes(bt, as_inner(node)->children[i]);
+        }
+    }
+    node_del(bt, node);
+}
+
+/// @brief free the nodes, not the items, the tree is empty then
+void bt_free(BTree *bt) {
+    if (bt->root) {
+        free_nodes(bt, bt->root);
+    }
+    bt->root = NULL;
+    bt->len = 0;
+}
@@ -0,0 +1,71 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// order statistic B+tree, the order of the large sorted sets: items (a ZNode) sorted by a double
+// key (the score), then by a function of the items for equal keys (the name). A node holds up
+// to BT_FANOUT entries whose keys are next to each other, thus finding the child to go down to
+// is a count of the keys below the one searched, BT_FANOUT / 2 SSE2 compares over 4 cache lines
+// which the prefetcher brings in together, where an AVL tree has a dependent cache miss per
+// level and 5 times the levels. An inner node keeps the number of items under each child, the
+// rank of an item and the item of a rank are found on the way down. The items are only in the
+// leaves, which are linked in order, a range is walked leaf by leaf
+
+static const uint32_t BT_FANOUT = 32; // entries of a node, even
+static const uint32_t BT_MIN = BT_FANOUT / 4; // a node with fewer is merged with a sibling
+static const uint32_t BT_MAX_DEPTH = 16; // BT_MIN^16 items, far more than memory holds
+
+// the common part of the nodes: the keys and the items, for an inner node the smallest key and
+// item under each child
+struct BtNode {
+    double keys[BT_FANOUT] = {};
+    void *items[BT_FANOUT] = {};
+    uint32_t n = 0;
+    uint32_t leaf = 0;
+};
+
+struct BtLeaf {
+    BtNode head;
+    BtLeaf *prev = NULL;
+    BtLeaf *next = NULL;
+};
+
+struct BtInner {
+    BtNode head;
+    BtNode *children[BT_FANOUT] = {};
+    uint32_t counts[BT_FANOUT] = {}; // items under each child
+};
+
+struct BTree {
+    BtNode *root = NULL;
+    size_t len = 0; // items
+    size_t bytes = 0; // of the nodes
+    bool (*less)(const void *a, const void *b) = NULL; // the order of items whose keys are equal
+};
+
+// a position in the tree, for walking it in order
+struct BtPos {
+    BtLeaf *leaf = NULL; // NULL past the end
+    uint32_t slot = 0;
+};
+
+static inline void *bt_item(BtPos pos) {
+    return pos.leaf ? pos.leaf->head.items[pos.slot] : NULL;
+}
+
+/// @brief the position after pos, in O(1)
+static inline void bt_next(BtPos *pos) {
+    if (++pos->slot == pos->leaf->head.n) {
+        pos->leaf = pos->leaf->next;
+        pos->slot = 0;
+    }
+}
+
+// basic api to the tree i.e insert, delete, rank, seek, select and bulk build
+
+bool bt_insert(BTree *bt, double key, void *item);
+bool bt_delete(BTree *bt, double key, void *item);
+uint64_t bt_rank(BTree *bt, double key, const void *item);
+uint64_t bt_seek(BTree *bt, double key, bool after);
+BtPos bt_at(BTree *bt, uint64_t rank);
+bool bt_build(BTree *bt, const double *keys, void *const *items, size_t n);
+void bt_free(BTree *bt);
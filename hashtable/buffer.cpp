@@ -0,0 +1,350 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "buffer.h"
+
+const size_t POOL_CHUNK = 16 * 1024; // most of the frames fit in one chunk
+const size_t POOL_MAX_FREE = 1024; // chunks a thread keeps for later, more go back to malloc
+const size_t BUF_MIN_CAP = POOL_CHUNK; // first allocation, a chunk of the pool
+const size_t OUT_BLOCK_SIZE = POOL_CHUNK - sizeof(OutBlock); // many small responses are coalesced in one block
+const size_t OUT_COPY_MAX = 4 * 1024; // a smaller value is copied, cheaper than one more block and iovec
+
+// the chunks behind the read buffers and the output blocks. A buffer holds a chunk only while
+// it has bytes in it, thus an idle connection holds no memory. Each thread has its own pool, no
+// lock is taken to get or put a chunk. A chunk may be put back by another thread than the one
+// it came from (the messages between shards), the per thread in_use is then off but the sum is
+// right. The counters are only written by the owner thread, they are atomic for buf_pool_stats()
+struct BufPool {
+    std::vector<uint8_t *> free;
+    std::atomic<int64_t> in_use{0};
+    std::atomic<int64_t> cached{0};
+    std::atomic<int64_t> mallocs{0};
+    std::atomic<int64_t> reuses{0};
+};
+
+static std::mutex g_pools_mu;
+static std::vector<BufPool *> g_pools; // the pools of all the threads, they are never freed
+static thread_local BufPool *t_pool = NULL;
+
+static BufPool *pool_self() {
+    if (!t_pool) {
+        t_pool = new BufPool();
+        std::lock_guard<std::mutex> lock(g_pools_mu);
+        g_pools.push_back(t_pool);
+    }
+    return t_pool;
+}
+
+/// @brief bump a counter which only this thread writes, no atomic read-modify-write needed
+static void counter_add(std::atomic<int64_t> &counter, int64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/// @brief a chunk of POOL_CHUNK bytes
+/// @return NULL if out of memory
+static uint8_t *pool_get() {
+    BufPool *pool = pool_self();
+    uint8_t *chunk = NULL;
+    if (!pool->free.empty()) {
+        chunk = pool->free.back();
+        pool->free.pop_back();
+        counter_add(pool->cached, -1);
+        counter_add(pool->reuses, 1);
+    }
+    else {
+        chunk = (uint8_t *)malloc(POOL_CHUNK);
+        if (!chunk) {
+            return NULL;
+        }
+        counter_add(pool->mallocs, 1);
+    }
+    counter_add(pool->in_use, 1);
+    return chunk;
+}
+
+/// @brief give a chunk back to the pool of this thread
+static void pool_put(uint8_t *chunk) {
+    BufPool *pool = pool_self();
+    counter_add(pool->in_use, -1);
+    if (pool->free.size() >= POOL_MAX_FREE) {
+        free(chunk);
+        return;
+    }
+    pool->free.push_back(chunk);
+    counter_add(pool->cached, 1);
+}
+
+/// @brief a chunk grows past POOL_CHUNK, from now on it is plain malloc memory
+static void pool_forget() {
+    counter_add(pool_self()->in_use, -1);
+}
+
+/// @brief usage of the buffer pools of all the threads
+BufPoolStats buf_pool_stats() {
+    BufPoolStats stats = {};
+    stats.chunk_size = POOL_CHUNK;
+    std::lock_guard<std::mutex> lock(g_pools_mu);
+    for (BufPool *pool : g_pools) {
+        stats.in_use += pool->in_use.load(std::memory_order_relaxed);
+        stats.cached += pool->cached.load(std::memory_order_relaxed);
+        stats.mallocs += pool->mallocs.load(std::memory_order_relaxed);
+        stats.reuses += pool->reuses.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+/// @brief make sure n bytes can be written after end, first by reusing the room before begin
+/// and only then by growing the memory
+/// @param buf
+/// @param n : bytes we are going to append
+/// @return false if out of memory
+bool buf_reserve(Buffer *buf, size_t n) {
+    if (buf_room(buf) >= n) {
+        return true; // the common case, nothing to do
+    }
+    size_t size = buf_size(buf);
+    if (buf->begin > 0 && buf->cap - size >= n) {
+        // enough room in total, move the unread bytes to the front
+        memmove(buf->data, buf_head(buf), size);
+        buf->begin = 0;
+        buf->end = size;
+        return true;
+    }
+    size_t cap = buf->cap ? buf->cap : BUF_MIN_CAP;
+    while (cap - size < n) {
+        cap *= 2;
+    }
+    if (cap == POOL_CHUNK) {
+        assert(!buf->data); // only an empty buffer is that small and short of room
+        buf->data = pool_get();
+        if (!buf->data) {
+            return false;
+        }
+        buf->cap = cap;
+        return true;
+    }
+    if (buf->begin > 0) {
+        memmove(buf->data, buf_head(buf), size);
+        buf->begin = 0;
+        buf->end = size;
+    }
+    uint8_t *data = (uint8_t *)realloc(buf->data, cap);
+    if (!data) {
+        return false;
+    }
+    if (buf->cap == POOL_CHUNK) {
+        pool_forget();
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return true;
+}
+
+/// @brief copy n bytes to the end of the buffer
+/// @return false if out of memory
+bool buf_append(Buffer *buf, const void *data, size_t n) {
+    if (!buf_reserve(buf, n)) {
+        return false;
+    }
+    memcpy(buf_tail(buf), data, n);
+    buf->end += n;
+    return true;
+}
+
+/// @brief drop n bytes from the front, this never moves the remaining bytes, an empty buffer
+/// gives its memory back
+void buf_consume(Buffer *buf, size_t n) {
+    assert(n <= buf_size(buf));
+    buf->begin += n;
+    buf_trim(buf);
+}
+
+/// @brief release the memory of an empty buffer, e.g. one reserved for a read() which got nothing
+void buf_trim(Buffer *buf) {
+    if (buf->begin == buf->end) {
+        buf_free(buf);
+    }
+}
+
+void buf_free(Buffer *buf) {
+    if (buf->cap == POOL_CHUNK) {
+        pool_put(buf->data);
+    }
+    else {
+        free(buf->data);
+    }
+    *buf = Buffer{};
+}
+
+/// @brief a new buffer holding a copy of data, with one reference
+/// @return NULL if out of memory
+RcBuf *rcbuf_new(const void *data, size_t len) {
+    RcBuf *buf = (RcBuf *)malloc(sizeof(RcBuf) + len);
+    if (!buf) {
+        return NULL;
+    }
+    new (buf) RcBuf();
+    buf->len = len;
+    buf->data = (uint8_t *)(buf + 1);
+    memcpy(buf->data, data, len);
+    return buf;
+}
+
+/// @brief drop a reference, the last one frees the buffer
+void rcbuf_unref(RcBuf *buf) {
+    if (buf->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        buf->~RcBuf();
+        free(buf);
+    }
+}
+
+/// @brief link a block at the end of the queue
+static void outq_push(OutQueue *q, OutBlock *block) {
+    if (q->tail) {
+        q->tail->next = block;
+    }
+    else {
+        q->head = block;
+    }
+    q->tail = block;
+}
+
+/// @brief release a block which is off the queue
+static void outq_block_free(OutBlock *block) {
+    if (block->ref) {
+        rcbuf_unref(block->ref);
+    }
+    if (!block->ref && block->cap == OUT_BLOCK_SIZE) {
+        pool_put((uint8_t *)block);
+        return;
+    }
+    free(block);
+}
+
+/// @brief n contiguous bytes at the end of the queue, the caller fills them in. The bytes
+/// never move, so the pointer stays valid while more is appended (e.g. to patch a header)
+/// @param q
+/// @param n : bytes to append
+/// @return where to write them, NULL if out of memory
+uint8_t *outq_alloc(OutQueue *q, size_t n) {
+    OutBlock *block = q->tail;
+    if (!block || block->cap - block->end < n) {
+        size_t cap = n > OUT_BLOCK_SIZE ? n : OUT_BLOCK_SIZE;
+        if (cap == OUT_BLOCK_SIZE) {
+            block = (OutBlock *)pool_get(); // the block header is at the front of the chunk
+        }
+        else {
+            block = (OutBlock *)malloc(sizeof(OutBlock) + cap);
+        }
+        if (!block) {
+            return NULL;
+        }
+        *block = OutBlock{};
+        block->cap = cap;
+        block->data = (uint8_t *)(block + 1);
+        outq_push(q, block);
+    }
+    uint8_t *p = &block->data[block->end];
+    block->end += n;
+    q->bytes += n;
+    return p;
+}
+
+/// @brief copy n bytes to the end of the queue
+/// @return false if out of memory
+bool outq_append(OutQueue *q, const void *data, size_t n) {
+    uint8_t *p = outq_alloc(q, n);
+    if (!p) {
+        return false;
+    }
+    memcpy(p, data, n);
+    return true;
+}
+
+/// @brief queue the bytes of buf, a large buffer is referenced instead of copied and the
+/// queue holds a reference to it until the bytes are sent
+/// @return false if out of memory
+bool outq_append_ref(OutQueue *q, RcBuf *buf) {
+    if (buf->len <= OUT_COPY_MAX) {
+        return outq_append(q, buf->data, buf->len);
+    }
+    OutBlock *block = (OutBlock *)malloc(sizeof(OutBlock));
+    if (!block) {
+        return false;
+    }
+    *block = OutBlock{};
+    block->end = block->cap = buf->len; // full, the next append starts a new block
+    block->data = buf->data;
+    block->ref = rcbuf_ref(buf);
+    outq_push(q, block);
+    q->bytes += buf->len;
+    return true;
+}
+
+/// @brief describe the unsent bytes for writev()
+/// @param q
+/// @param iov : filled with one entry per block
+/// @param max : size of iov
+/// @return number of entries used
+size_t outq_iov(OutQueue *q, struct iovec *iov, size_t max) {
+    size_t n = 0;
+    for (OutBlock *block = q->head; block && n < max; block = block->next) {
+        if (block->end == block->begin) {
+            continue;
+        }
+        iov[n].iov_base = &block->data[block->begin];
+        iov[n].iov_len = block->end - block->begin;
+        n++;
+    }
+    return n;
+}
+
+/// @brief n bytes were sent, release the blocks which are done, an empty queue holds no memory
+void outq_consume(OutQueue *q, size_t n) {
+    assert(n <= q->bytes);
+    q->bytes -= n;
+    while (q->head) {
+        OutBlock *block = q->head;
+        size_t left = block->end - block->begin;
+        if (n < left) {
+            block->begin += n;
+            return;
+        }
+        n -= left;
+        q->head = block->next;
+        if (!q->head) {
+            q->tail = NULL;
+        }
+        outq_block_free(block);
+    }
+}
+
+/// @brief move all the blocks of src to the end of dst, no bytes are copied
+void outq_splice(OutQueue *dst, OutQueue *src) {
+    if (!src->head) {
+        return;
+    }
+    if (dst->tail) {
+        dst->tail->next = src->head;
+    }
+    else {
+        dst->head = src->head;
+    }
+    dst->tail = src->tail;
+    dst->bytes += src->bytes;
+    *src = OutQueue{};
+}
+
+void outq_free(OutQueue *q) {
+    while (q->head) {
+        OutBlock *next = q->head->next;
+        outq_block_free(q->head);
+        q->head = next;
+    }
+    *q = OutQueue{};
+}
@@ -0,0 +1,102 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// growable byte buffer for the connections, bytes are appended at end and consumed from
+// begin. Consuming only moves begin, the unread bytes are moved to the front only when the
+// free room at the end is not enough, and the memory grows only when the bytes do not fit.
+// An empty buffer holds no memory, the first chunk comes from a per thread pool
+
+struct Buffer {
+    uint8_t *data = NULL;
+    size_t cap = 0;
+    size_t begin = 0; // first unread byte
+    size_t end = 0; // one past the last byte
+};
+
+static inline size_t buf_size(const Buffer *buf) {
+    return buf->end - buf->begin;
+}
+
+static inline uint8_t *buf_head(Buffer *buf) {
+    return &buf->data[buf->begin];
+}
+
+static inline uint8_t *buf_tail(Buffer *buf) {
+    return &buf->data[buf->end];
+}
+
+// free room after end
+static inline size_t buf_room(const Buffer *buf) {
+    return buf->cap - buf->end;
+}
+
+// basic api to the buffer i.e reserve, append, consume and free
+
+bool buf_reserve(Buffer *buf, size_t n);
+bool buf_append(Buffer *buf, const void *data, size_t n);
+void buf_consume(Buffer *buf, size_t n);
+void buf_trim(Buffer *buf);
+void buf_free(Buffer *buf);
+
+// usage of the per thread pools of fixed size chunks, the memory behind the buffers and the
+// output blocks, summed over all the threads
+struct BufPoolStats {
+    int64_t chunk_size = 0;
+    int64_t in_use = 0; // held by buffers which have bytes in them
+    int64_t cached = 0; // free, kept for the next buffer
+    int64_t mallocs = 0; // chunks which had to come from malloc
+    int64_t reuses = 0; // chunks which came from the pool
+};
+
+BufPoolStats buf_pool_stats();
+
+// immutable reference counted bytes, a stored value is one of these so that a response can
+// point at it instead of copying it. The count is atomic as the last reference may be dropped
+// by another reactor thread (the origin of a forwarded GET sends the owner's value)
+
+struct RcBuf {
+    std::atomic<uint32_t> refs{1};
+    size_t len = 0;
+    uint8_t *data = NULL; // right after the struct, same allocation
+};
+
+RcBuf *rcbuf_new(const void *data, size_t len);
+void rcbuf_unref(RcBuf *buf);
+
+static inline RcBuf *rcbuf_ref(RcBuf *buf) {
+    buf->refs.fetch_add(1, std::memory_order_relaxed);
+    return buf;
+}
+
+// output queue of a connection: the responses are appended to a chain of blocks and the
+// whole chain goes out with one writev(), a block is freed as soon as it is fully sent. A
+// block either owns its bytes or references a RcBuf (a large value), which is then kept 
+// alive until it is sent even if the key is overwritten or deleted meanwhile
+
+struct OutBlock {
+    OutBlock *next = NULL;
+    size_t begin = 0; // first unsent byte
+    size_t end = 0; // one past the last byte
+    size_t cap = 0;
+    uint8_t *data = NULL; // right after the struct, same allocation, or ref->data
+    RcBuf *ref = NULL; // referenced bytes, nothing is appended to such a block
+};
+
+struct OutQueue {
+    OutBlock *head = NULL;
+    OutBlock *tail = NULL;
+    size_t bytes = 0; // appended but not sent yet
+};
+
+struct iovec;
+
+// basic api to the output queue i.e alloc, append, iov, consume, splice and free
+
+uint8_t *outq_alloc(OutQueue *q, size_t n);
+bool outq_append(OutQueue *q, const void *data, size_t n);
+bool outq_append_ref(OutQueue *q, RcBuf *buf);
+size_t outq_iov(OutQueue *q, struct iovec *iov, size_t max);
+void outq_consume(OutQueue *q, size_t n);
+void outq_splice(OutQueue *dst, OutQueue *src);
+void outq_free(OutQueue *q);
@@ -11,7 +11,7 @@
 #include <string>
 #include <netinet/ip.h>
 
-static const size_t MSG_MAX_LEN = 4096;
+static const size_t MSG_MAX_LEN = 512 * 1024 * 1024; // same as the default max request size of the server
 static const uint8_t HEADER_LEN = 4;
 
 static void die(const char *msg) {
@@ -67,7 +67,7 @@ static int32_t send_request(int fd, const std::vector<std::string> &raw_request)
     if (len > MSG_MAX_LEN) {
         return -1;
     }
-    char write_buffer[4 + MSG_MAX_LEN];
+    std::vector<char> write_buffer(4 + len);
     memcpy(&write_buffer[0], &len, 4); // total length of string (max length of request)
     uint32_t n = raw_request.size(); // total length of request 
     memcpy(&write_buffer[4], &n, 4);
@@ -80,14 +80,14 @@ static int32_t send_request(int fd, const std::vector<std::string> &raw_request)
         cur_pos += s.size() + 4; 
     }
 
-    return write_all(fd, write_buffer, 4 + len); // 4 is the length of header
+    return write_all(fd, write_buffer.data(), 4 + len); // 4 is the length of header
 
 }
 
 static int32_t read_response(int fd) {
-    char read_buffer[HEADER_LEN + MSG_MAX_LEN + 1];
+    std::vector<char> read_buffer(HEADER_LEN);
     errno = 0;
-    int32_t err = read_full(fd, read_buffer, 4); // read first four character from fd to read_buffer
+    int32_t err = read_full(fd, read_buffer.data(), 4); // read first four character from fd to read_buffer
     if (err) {
         if (errno == 0) {
             msg("EOF");
@@ -98,11 +98,12 @@ static int32_t read_response(int fd) {
         return err;
     }
     uint32_t len = 0;
-    memcpy(&len, read_buffer, 4); // the first four character were length thus get those to len
+    memcpy(&len, read_buffer.data(), 4); // the first four character were length thus get those to len
     if (len > MSG_MAX_LEN) {
         msg("too long");
         return -1;
     }
+    read_buffer.resize(HEADER_LEN + len);
 
     // reply body 
     err = read_full(fd, &read_buffer[4], len); // write data from fd to read_buffer starting @HEADER_LEN 
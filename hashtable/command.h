@@ -0,0 +1,111 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// the command table of the server: name, arity, flags, where the keys are and the handler.
+// A command is found with a perfect hash which is computed at compile time over the names of
+// the table, thus a lookup hashes the name once and compares it with a single entry, no matter
+// how many commands there are
+
+struct Args;
+struct Reply;
+struct MultiKey;
+
+enum {
+    CMD_WRITE = 1, // changes the keyspace
+    CMD_READONLY = 2, // only reads the keyspace
+    CMD_ADMIN = 4, // about the server or the connection, no keys
+    CMD_DENYOOM = 8, // may add memory, refused once maxmemory is reached and nothing can be evicted
+};
+
+struct Command {
+    const char *name; // lower case
+    int32_t arity; // number of arguments including the name, -n means at least n
+    uint32_t flags; // CMD_*
+    int32_t first_key; // position of the first key, 0 if the command takes none
+    int32_t last_key; // position of the last key, -1 is the last argument
+    int32_t key_step; // from one key to the next, e.g. 2 for MSET key value key value
+    void (*handler)(Args *args, Reply *res);
+    // multi key commands have these instead of a handler: the work for some of the keys,
+    // done by the shard owning them, and the reply once every key is done. Thus a request
+    // whose keys live in several shards is split among them
+    void (*multi_part)(MultiKey *mk, const uint32_t *idx, size_t n) = NULL;
+    void (*multi_reply)(MultiKey *mk, Reply *res) = NULL;
+};
+
+static const size_t CMD_SLOTS = 128; // power of 2, well above the number of commands
+
+// the perfect hash: the seed for which no two commands share a slot, and the command in
+// every slot (its index + 1, 0 is empty) with the length of its name
+struct CmdIndex {
+    uint32_t seed = 0;
+    uint8_t slot[CMD_SLOTS] = {};
+    uint8_t name_len[CMD_SLOTS] = {};
+};
+
+/// @brief ASCII lower case without a branch, the other bytes are left alone
+static constexpr uint8_t cmd_fold(uint8_t c) {
+    return (uint8_t)(c | ((uint8_t)(c - 'A') < 26 ? 0x20 : 0));
+}
+
+/// @brief case insensitive hash of a command name, FNV-1a with a final mix
+static constexpr uint32_t cmd_hash(const char *name, size_t len, uint32_t seed) {
+    uint32_t h = 0x811C9DC5 ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ cmd_fold((uint8_t)name[i])) * 0x01000193;
+    }
+    h ^= h >> 15;
+    h *= 0x2C1B3C6D;
+    h ^= h >> 12;
+    return h;
+}
+
+static constexpr size_t cmd_name_len(const char *name) {
+    size_t len = 0;
+    while (name[len]) {
+        len++;
+    }
+    return len;
+}
+
+/// @brief search the first seed which puts every command in a slot of its own, run by the
+/// compiler. A seed of 0 means there is none, which a static_assert catches
+template <size_t N>
+static constexpr CmdIndex cmd_index_build(const Command (&cmds)[N]) {
+    static_assert(N < CMD_SLOTS / 2, "grow CMD_SLOTS");
+    for (uint32_t seed = 1; seed < 65536; seed++) {
+        CmdIndex index;
+        index.seed = seed;
+        bool unique = true;
+        for (size_t i = 0; i < N && unique; i++) {
+            size_t len = cmd_name_len(cmds[i].name);
+            uint32_t s = cmd_hash(cmds[i].name, len, seed) & (CMD_SLOTS - 1);
+            unique = (index.slot[s] == 0) && len < 256;
+            index.slot[s] = (uint8_t)(i + 1);
+            index.name_len[s] = (uint8_t)len;
+        }
+        if (unique) {
+            return index;
+        }
+    }
+    return CmdIndex{};
+}
+
+/// @brief the command the name is, if any
+/// @return index into the table, -1 if there is no such command
+template <size_t N>
+static inline int32_t cmd_index_find(const CmdIndex &index, const Command (&cmds)[N], const uint8_t *name, size_t len) {
+    uint32_t s = cmd_hash((const char *)name, len, index.seed) & (CMD_SLOTS - 1);
+    int32_t i = (int32_t)index.slot[s] - 1;
+    if (i < 0 || index.name_len[s] != len) {
+        return -1;
+    }
+    // the one candidate, of the same length, compared as folded ASCII (the table names are
+    // lower case). A name may hold any byte, a 0 as well, thus the length goes first
+    const char *cand = cmds[i].name;
+    for (size_t k = 0; k < len; k++) {
+        if (cmd_fold(name[k]) != (uint8_t)cand[k]) {
+            return -1;
+        }
+    }
+    return i;
+}
@@ -0,0 +1,174 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+// a key and its value in one allocation: the Hnode, the lengths, then the bytes of the key and
+// of the value. A lookup which hits touches the node and compares the key in the same cache
+// lines, and a key costs a single allocation from a size class of slab.h rather than three
+// mallocs (the entry, a key longer than the 15 bytes of std::string and the value). A value
+// larger than ENTRY_INLINE_MAX is kept out of line in an RcBuf instead, which a GET of a large
+// value sends without copying it. The value of a sorted set key is a ZSet, in place of the
+// RcBuf.
+// Goes after hashtable.h, buffer.h, protocol.h, slab.h and zset.h, for Hnode, RcBuf, Slice,
+// slab_alloc() and ZSet
+
+static const size_t ENTRY_INLINE_MAX = 256;
+static_assert(ENTRY_INLINE_MAX < (1 << 12), "the inline value capacity is 12 bits");
+
+// the type of the value of a key
+enum {
+    ENTRY_STR = 0,
+    ENTRY_ZSET = 1,
+};
+
+struct Entry {
+    struct Hnode node;
+    uint32_t key_len = 0;
+    uint16_t val_len = 0; // of the inline value, 0 if it is big
+    uint16_t val_cap : 12; // room for an inline value after the key, from the size class
+    uint16_t type : 4; // ENTRY_*, both 0 as Entry() zeroes them
+    uint32_t expire_pos = 0; // of its deadline in the shard's expiry heap + 1, 0 if none
+    uint32_t access = 0; // when and how often it was used, for the eviction (see the server)
+    union {
+        // immutable, a SET puts a new one in place, queued responses may hold the old one
+        RcBuf *big = NULL;
+        ZSet *zset; // ENTRY_ZSET
+    };
+    // the key, then the inline value
+};
+
+static inline uint8_t *entry_bytes(const Entry *entry) {
+    return (uint8_t *)(entry + 1);
+}
+
+static inline Slice entry_key(const Entry *entry) {
+    Slice key;
+    key.ptr = entry_bytes(entry);
+    key.len = entry->key_len;
+    return key;
+}
+
+/// @brief the value of an ENTRY_STR, valid until the entry is set again or deleted
+static inline Slice entry_val(const Entry *entry) {
+    Slice val;
+    if (entry->big) {
+        val.ptr = entry->big->data;
+        val.len = entry->big->len;
+    }
+    else {
+        val.ptr = entry_bytes(entry) + entry->key_len;
+        val.len = entry->val_len;
+    }
+    return val;
+}
+
+/// @brief put val into the entry, in place if it is big or fits the room of the inline value
+/// @return false if it does not fit or the key is not a string, then a new entry has to take
+/// the place of this one
+static inline bool entry_set_val(Entry *entry, Slice val) {
+    if (entry->type != ENTRY_STR) {
+        return false;
+    }
+    if (val.len > ENTRY_INLINE_MAX) {
+        RcBuf *big = rcbuf_new(val.ptr, val.len);
+        if (!big) {
+            return false;
+        }
+        if (entry->big) {
+            rcbuf_unref(entry->big);
+        }
+        entry->big = big;
+        entry->val_len = 0;
+        return true;
+    }
+    if (val.len > entry->val_cap) {
+        return false;
+    }
+    if (entry->big) {
+        rcbuf_unref(entry->big);
+        entry->big = NULL;
+    }
+    memcpy(entry_bytes(entry) + entry->key_len, val.ptr, val.len);
+    entry->val_len = (uint16_t)val.len;
+    return true;
+}
+
+/// @brief a new entry, the hash of the key set, not in any map yet
+/// @return NULL if out of memory
+static inline Entry *entry_new(Slice key, uint64_t hcode, Slice val) {
+    size_t inline_len = val.len > ENTRY_INLINE_MAX ? 0 : val.len;
+    size_t size = sizeof(Entry) + key.len + inline_len;
+    void *mem = slab_alloc(size);
+    if (!mem) {
+        return NULL;
+    }
+    Entry *entry = new (mem) Entry();
+    entry->node.hcode = hcode;
+    entry->key_len = (uint32_t)key.len;
+    // the class rounds the size up, the slack takes a later value which is a bit longer
+    size_t room = slab_size(size) - sizeof(Entry) - key.len;
+    entry->val_cap = (uint16_t)(room < ENTRY_INLINE_MAX ? room : ENTRY_INLINE_MAX);
+    memcpy(entry_bytes(entry), key.ptr, key.len);
+    if (!entry_set_val(entry, val)) {
+        slab_free(mem, size);
+        return NULL;
+    }
+    return entry;
+}
+
+/// @brief a new entry holding an empty sorted set, see entry_new()
+/// @return NULL if out of memory
+static inline Entry *entry_new_zset(Slice key, uint64_t hcode) {
+    size_t size = sizeof(Entry) + key.len;
+    void *mem = slab_alloc(size);
+    if (!mem) {
+        return NULL;
+    }
+    Entry *entry = new (mem) Entry();
+    entry->node.hcode = hcode;
+    entry->key_len = (uint32_t)key.len;
+    entry->type = ENTRY_ZSET;
+    memcpy(entry_bytes(entry), key.ptr, key.len);
+    if (!(entry->zset = zset_new())) {
+        slab_free(mem, size);
+        return NULL;
+    }
+    return entry;
+}
+
+/// @brief bytes the entry holds: its own and those of a big value or of a sorted set
+static inline size_t entry_mem(const Entry *entry) {
+    size_t mem = slab_size(sizeof(Entry) + entry->key_len + entry->val_cap);
+    if (entry->type == ENTRY_ZSET) {
+        mem += zset_mem(entry->zset);
+    }
+    else if (entry->big) {
+        mem += sizeof(RcBuf) + entry->big->len;
+    }
+    return mem;
+}
+
+static inline void entry_del(Entry *entry) {
+    if (entry->type == ENTRY_ZSET) {
+        zset_del(entry->zset);
+    }
+    else if (entry->big) {
+        rcbuf_unref(entry->big);
+    }
+    // of the same class as the size it was allocated with, val_cap is at most the rounding
+    size_t size = sizeof(Entry) + entry->key_len + entry->val_cap;
+    entry->~Entry();
+    slab_free(entry, size);
+}
+
+/// @brief a reference to the value of an ENTRY_STR which outlives the entry: the big value
+/// itself, or a copy of the inline one
+/// @return NULL if out of memory
+static inline RcBuf *entry_val_ref(const Entry *entry) {
+    if (entry->big) {
+        return rcbuf_ref(entry->big);
+    }
+    return rcbuf_new(entry_bytes(entry) + entry->key_len, entry->val_len);
+}
@@ -0,0 +1,94 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+// the hash of the keys, after wyhash: 8 or 16 bytes are read at a time and mixed with a
+// 64x64->128 bit multiply folded back to 64 bits, which is a single instruction on x86-64.
+// A key of 40 bytes costs about as much as 4 bytes of the byte at a time hash it replaced.
+// Every process draws a random seed, thus a client can't pick keys which all land in one bucket
+
+static const uint64_t HASH_SECRET[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL,
+};
+
+/// @brief the high and low halves of the 128 bit product, xor'ed
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hash_read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t hash_read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/// @brief 64 bit hash of len bytes
+/// @param seed : hash_seed_random() of the process, the same for all its hashes
+static inline uint64_t hash_bytes(const uint8_t *p, size_t len, uint64_t seed) {
+    seed ^= hash_mix(seed ^ HASH_SECRET[0], HASH_SECRET[1]);
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (len <= 16) {
+        if (len >= 4) {
+            // two overlapping pairs of 4 bytes cover 4..16 bytes without a loop
+            size_t mid = (len >> 3) << 2;
+            a = (hash_read4(p) << 32) | hash_read4(p + mid);
+            b = (hash_read4(p + len - 4) << 32) | hash_read4(p + len - 4 - mid);
+        }
+        else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+        }
+    }
+    else {
+        size_t i = len;
+        if (i > 48) {
+            // three independent lanes, so that the multiplies overlap
+            uint64_t lane1 = seed;
+            uint64_t lane2 = seed;
+            do {
+                seed = hash_mix(hash_read8(p) ^ HASH_SECRET[1], hash_read8(p + 8) ^ seed);
+                lane1 = hash_mix(hash_read8(p + 16) ^ HASH_SECRET[2], hash_read8(p + 24) ^ lane1);
+                lane2 = hash_mix(hash_read8(p + 32) ^ HASH_SECRET[3], hash_read8(p + 40) ^ lane2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= lane1 ^ lane2;
+        }
+        while (i > 16) {
+            seed = hash_mix(hash_read8(p) ^ HASH_SECRET[1], hash_read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // the last 16 bytes, overlapping the ones already mixed if need be
+        a = hash_read8(p + i - 16);
+        b = hash_read8(p + i - 8);
+    }
+    a ^= HASH_SECRET[1];
+    b ^= seed;
+    __uint128_t r = (__uint128_t)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+    return hash_mix(a ^ HASH_SECRET[0] ^ len, b ^ HASH_SECRET[1]);
+}
+
+/// @brief a seed no client can guess, drawn once at start up
+static inline uint64_t hash_seed_random() {
+    uint64_t seed = 0;
+    if (getrandom(&seed, sizeof(seed), 0) != (ssize_t)sizeof(seed)) {
+        // no entropy source, the clock and the pid at least differ between runs
+        struct timespec ts = {};
+        clock_gettime(CLOCK_REALTIME, &ts);
+        seed = hash_mix((uint64_t)ts.tv_nsec ^ HASH_SECRET[2], (uint64_t)ts.tv_sec ^ ((uint64_t)getpid() << 32));
+    }
+    return seed;
+}
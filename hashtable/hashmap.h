@@ -0,0 +1,116 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashtable.h"
+
+// the hashmap as a header, so that the compiler sees all of it. The backend is picked at build
+// time (make HASHTABLE=chain|swiss), its functions take the key as a hash and a match functor,
+// thus they are generated for every kind of key. libhashtable.so (hashtable.cpp) is the C api
+// of hashtable.h on top of them, whose comparator is called through a pointer for every
+// candidate node; HMap below is the typed one, whose policies are inlined into the probe loops
+
+#ifdef HASHTABLE_SWISS
+#include "hashtable_swiss.h"
+#else
+#include "hashtable_chain.h"
+#endif
+
+/**
+ * @brief a hashmap of Node, an intrusive struct with an Hnode named node (whose hcode is the
+ * hash of its key), like the C api. Keys of any type K the policies take can be looked up:
+ *   Hash: uint64_t operator()(const K &key) const
+ *   Eq: bool operator()(const Node *node, const K &key) const
+ * The Hash of a key and of the key of its node must be the same
+ */
+template <typename Node, typename Hash, typename Eq>
+struct HMap {
+    HashMap map; // the tables and the resize figures
+};
+
+/// @brief the Node an Hnode is embedded in, NULL for NULL
+template <typename Node>
+static inline Node *hmap_node(Hnode *node) {
+    return node ? (Node *)((char *)node - offsetof(Node, node)) : NULL;
+}
+
+/// @param hcode : Hash()(key), if the caller has it already
+template <typename Node, typename Hash, typename Eq, typename K>
+static inline Node *hmap_lookup(HMap<Node, Hash, Eq> *hmap, const K &key, uint64_t hcode) {
+    return hmap_node<Node>(hm_lookup(&hmap->map, hcode, [&key](Hnode *node) {
+        return Eq()(hmap_node<Node>(node), key);
+    }));
+}
+
+template <typename Node, typename Hash, typename Eq, typename K>
+static inline Node *hmap_lookup(HMap<Node, Hash, Eq> *hmap, const K &key) {
+    return hmap_lookup(hmap, key, Hash()(key));
+}
+
+/// @brief look n keys up at once, see hashmap_lookup_batch()
+/// @param found : the node of every key, NULL if it does not exist
+template <typename Node, typename Hash, typename Eq, typename K>
+static inline void hmap_lookup_batch(HMap<Node, Hash, Eq> *hmap, const K *keys, size_t n, Node **found) {
+    // the nodes go into found, then become the Node they are in, which has the same size
+    static_assert(sizeof(Node *) == sizeof(Hnode *), "pointers of a size");
+    Hnode **nodes = (Hnode **)found;
+    hm_lookup_batch(&hmap->map, n, [keys](size_t i) { return Hash()(keys[i]); },
+        [keys](Hnode *node, size_t i) { return Eq()(hmap_node<Node>(node), keys[i]); }, nodes);
+    for (size_t i = 0; i < n; i++) {
+        found[i] = hmap_node<Node>(nodes[i]);
+    }
+}
+
+/// @brief insert a node whose key is not in the map yet, node->node.hcode is the Hash of its key
+template <typename Node, typename Hash, typename Eq>
+static inline void hmap_insert(HMap<Node, Hash, Eq> *hmap, Node *node) {
+    hm_insert(&hmap->map, &node->node);
+}
+
+/// @brief take the node of key out of the map
+/// @return the node, NULL if the key is not there
+template <typename Node, typename Hash, typename Eq, typename K>
+static inline Node *hmap_pop(HMap<Node, Hash, Eq> *hmap, const K &key, uint64_t hcode) {
+    return hmap_node<Node>(hm_pop(&hmap->map, hcode, [&key](Hnode *node) {
+        return Eq()(hmap_node<Node>(node), key);
+    }));
+}
+
+template <typename Node, typename Hash, typename Eq, typename K>
+static inline Node *hmap_pop(HMap<Node, Hash, Eq> *hmap, const K &key) {
+    return hmap_pop(hmap, key, Hash()(key));
+}
+
+/// @brief up to n nodes picked at random, see hm_sample()
+/// @return number of nodes in out
+template <typename Node, typename Hash, typename Eq>
+static inline size_t hmap_sample(HMap<Node, Hash, Eq> *hmap, uint64_t rnd, Node **out, size_t n) {
+    static_assert(sizeof(Node *) == sizeof(Hnode *), "pointers of a size");
+    Hnode **nodes = (Hnode **)out;
+    n = hm_sample(&hmap->map, rnd, nodes, n);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = hmap_node<Node>(nodes[i]);
+    }
+    return n;
+}
+
+/// @brief bytes of the tables, see hm_bytes()
+template <typename Node, typename Hash, typename Eq>
+static inline size_t hmap_bytes(const HMap<Node, Hash, Eq> *hmap) {
+    return hm_bytes(&hmap->map);
+}
+
+/// @brief see hashmap_rehash()
+template <typename Node, typename Hash, typename Eq>
+static inline size_t hmap_rehash(HMap<Node, Hash, Eq> *hmap, uint64_t budget_ns) {
+    return hm_rehash(&hmap->map, budget_ns);
+}
+
+/// @brief free the tables, the map must be empty
+template <typename Node, typename Hash, typename Eq>
+static inline void hmap_destroy(HMap<Node, Hash, Eq> *hmap) {
+    hm_destroy(&hmap->map);
+}
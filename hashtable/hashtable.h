@@ -9,21 +9,50 @@ struct Hnode {
     Hnode* next = NULL;
 };
 
+#ifdef HASHTABLE_SWISS
+
+// open addressing backend (hashtable_swiss.h, make HASHTABLE=swiss): every slot holds a
+// pointer to a node and has a 1 byte control tag, empty, deleted, or 7 bits of the hash of
+// its node. A lookup compares the tags of 16 slots at once and only looks at the nodes whose
+// tag matches. The next pointer of Hnode is not used
+struct HashTable {
+    uint8_t *ctrl = NULL; // a tag per slot
+    Hnode **slots = NULL;
+    size_t mask = 0; // slots - 1, a multiple of 16 slots
+    size_t size = 0;
+    size_t growth_left = 0; // empty slots which may still be used before it has to grow
+};
+
+#else
+
 struct HashTable {
     Hnode **container = NULL;
     size_t mask = 0;
     size_t size = 0;
 };
 
+#endif
+
+// A resize is incremental: ht1 is the new table, ht2 the old one whose nodes move over to ht1
+// a few at a time, by inserts and pops (for at most rehash_budget_ns each) and by
+// hashmap_rehash(), which the server calls when it has nothing else to do
 struct HashMap {
     HashTable ht1; 
     HashTable ht2; 
     size_t resizing_pos = 0;
+    uint64_t rehash_budget_ns = 1000; // an insert or pop moves nodes for this long at most, at least a few
+    // progress of the resizes, over the life of the map
+    uint64_t grows = 0;
+    uint64_t shrinks = 0; // after pops left the table mostly empty
+    uint64_t moved = 0; // nodes moved from ht2 to ht1
+    uint64_t rehash_ns = 0; // time spent moving them
 };
 
 // basic api to the hashmap i.e lookup, insert, pop and destroy
 
 Hnode *hashmap_lookup(HashMap *hash_map, Hnode* key, bool(*cmp)(Hnode*, Hnode*));
+void hashmap_lookup_batch(HashMap *hash_map, Hnode **keys, size_t n, bool(*cmp)(Hnode*, Hnode*), Hnode **found);
 void hashmap_insert(HashMap *hash_map, Hnode* node);
 Hnode * hashmap_pop(HashMap *hash_map, Hnode *key, bool(*cmp)(Hnode *, Hnode *));
-void hashmap_destroy(HashMap *hash_map);
\ No newline at end of file
+void hashmap_destroy(HashMap *hash_map);
+size_t hashmap_rehash(HashMap *hash_map, uint64_t budget_ns);
\ No newline at end of file
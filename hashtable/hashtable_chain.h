@@ -0,0 +1,357 @@
+// chained backend of the hashmap (the default), included by hashmap.h: every bucket is a
+// singly linked list of the nodes whose hash ends in its index
+
+static const size_t MAX_LOAD_FACTOR = 8;
+static const size_t MIN_LOAD_FACTOR = 1; // below 1 node per bucket the table shrinks
+static const size_t MIN_SLOTS = 4;
+static const size_t RESIZE_STEP = 8; // nodes moved from ht2 between two reads of the clock
+static const size_t RESIZE_SCAN = 128; // or empty buckets of ht2 skipped
+static const size_t LOOKUP_GROUP = 32; // keys of a batch lookup whose memory accesses are in flight together
+static const size_t SAMPLE_SCAN = 64; // buckets hm_sample() looks at, at most
+
+
+/// @brief initialize the hashtable with default value, like size
+/// @param hash_table : pointer to the HashTable for which we are doing init 
+/// @param n : size of hashtable, for simplicity this is kept as a power of 2
+static inline void hashtable_init(HashTable *hash_table, size_t n) {
+    assert (n > 0 && ((n - 1) & n) == 0);
+    hash_table->container = (Hnode **) calloc (sizeof(Hnode *), n);
+    hash_table->mask = n - 1; // this is all set n = 2^k thus 2^k - 1
+    hash_table->size = 0;
+}
+
+/// @brief Insert a new node the given hashtable
+/// @param hash_table : Table in which you want to insert 
+/// @param node : node which you want to insert
+static inline void hashtable_insert(HashTable *hash_table, Hnode *node) {
+    size_t pos = node->hcode & hash_table->mask; // isn't this is same as node->hcode ? 
+    assert(pos <= hash_table->mask);
+    Hnode *next = hash_table->container[pos];
+    // insert at the head;
+    node->next = next;
+    hash_table->container[pos] = node;
+    hash_table->size++;  // total elements
+}
+
+/// @brief Lookup a given key in the hashtable
+/// @param hash_table : Table in which you want to lookup
+/// @param hcode : hash of the key which you want to look
+/// @param match : true for the node of the key, only called on nodes with the same hash
+/// @return the node if that exists
+template <typename Match>
+static inline Hnode **hashtable_lookup(HashTable *hash_table, uint64_t hcode, Match &match) {
+    if (!hash_table->container) {
+        return NULL;
+    }
+    size_t pos = hcode & hash_table->mask;
+    assert (pos <= hash_table->mask);
+    Hnode **from = &hash_table->container[pos]; // to hold the address of a pointer we need pointer to pointer 
+    while (*from) {
+        if ((*from)->hcode == hcode && match(*from)) {
+            return from; // ok, got that.
+        }
+        from = &(*from)->next; // since from is a pointer to pointer to Hnode, thus we are passing & of the next Hnode
+    }
+    return NULL; // doesn't exists
+}
+
+/// @brief Remove a given node from the hashtable
+/// @param hash_table : A pointer to the hashtable
+/// @param from : match existing node in the hashtable to this node
+/// @return exact ref to the node in the hashtable which matches from for further operation
+static inline Hnode * hashtable_pop(HashTable *hash_table, Hnode **from) {
+    Hnode *node = *from;
+    *from = (*from)->next; 
+    hash_table->size--;
+    return node;
+}
+
+
+static inline uint64_t clock_ns() {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/// @brief move up to RESIZE_STEP nodes from ht2 to ht1, looking at RESIZE_SCAN buckets at most
+static inline void resizing_step(HashMap *hash_map) {
+    size_t work = 0;
+    size_t scanned = 0;
+    while (work < RESIZE_STEP && scanned < RESIZE_SCAN && hash_map->ht2.size > 0) {
+        Hnode **from = &hash_map->ht2.container[hash_map->resizing_pos]; // get the node from hashtable2
+        if (!*from) {
+            // If the list is empty then nothing to do, simply go to the next index
+            hash_map->resizing_pos++; 
+            scanned++;
+            continue;
+        }
+        // insert the value which are temporary passed to the hashtable 2 back to the hashtable 1
+        // wondering why we are not increasing resizing pos here ? Note that we are poping out from from hash_map 
+        hashtable_insert(&hash_map->ht1, hashtable_pop(&hash_map->ht2, from));
+        work++;
+    }
+    hash_map->moved += work;
+    // if nothing to pick from the hashtable then congrats, you have successfully moved
+    // note here container is not NULL, but size is 0, thus we are marking container null at the end of this
+    if (hash_map->ht2.size == 0) { 
+        free(hash_map->ht2.container); // free the table
+        hash_map->ht2 = HashTable{};
+    }
+}
+
+/// @brief This is helper function for dynamic resizing, without putting load: one step of
+/// the move, then more steps as long as they fit in the budget. The work is bounded by time
+/// rather than by a number of nodes, since a node which is not in the cache costs 10 times
+/// more to move than one which is
+/// @param hash_map 
+/// @param budget_ns : time it may take, the first step is done whatever the budget
+static inline void helper_resizing(HashMap *hash_map, uint64_t budget_ns) {
+    // if nothing to move from hashtable 2
+    if (hash_map->ht2.container == NULL) {
+        return;
+    }
+    uint64_t start = clock_ns();
+    uint64_t now = start;
+    do {
+        resizing_step(hash_map);
+        now = clock_ns();
+    } while (hash_map->ht2.container && now - start < budget_ns);
+    hash_map->rehash_ns += now - start;
+}
+
+/**
+ * @brief move nodes of an ongoing resize for up to budget_ns, the server calls it when it
+ * has nothing else to do
+ * @return number of nodes which are still to move, 0 if there is no resize going on
+ */
+static inline size_t hm_rehash(HashMap *hash_map, uint64_t budget_ns) {
+    helper_resizing(hash_map, budget_ns);
+    return hash_map->ht2.size;
+}
+
+/// @brief Lookup function, a lookup does not move nodes of a resize, thus reads cost the same
+/// during a resize, only looking into both tables. Inserts, pops and hm_rehash() move them
+/// @param hash_map : Pointer to hash_map
+/// @param hcode : hash of the key which we are searching
+/// @param match : true for the node of the key
+/// @return node which are looking, actual pointer to the location, so that we can erase that
+template <typename Match>
+static inline Hnode *hm_lookup(HashMap *hash_map, uint64_t hcode, Match match) {
+    Hnode **from = hashtable_lookup(&hash_map->ht1, hcode, match);
+    if (!from) {
+        from = hashtable_lookup(&hash_map->ht2, hcode, match);
+    }
+    return from ? *from : NULL; // If rust was then we don't have to worry about the NULL pointer de-ref :)
+}
+
+
+/// @brief the bucket of a key in the table, NULL if the table is not there
+static inline Hnode **hashtable_bucket(HashTable *hash_table, uint64_t hcode) {
+    if (!hash_table->container) {
+        return NULL;
+    }
+    return &hash_table->container[hcode & hash_table->mask];
+}
+
+/**
+ * @brief Lookup of many keys at once. A single lookup waits for a cache miss at every step
+ * (the bucket, then every node of the chain), one after another. Here the keys go in groups:
+ * first the buckets of the whole group are prefetched, then the chains are walked one step
+ * per key and round, the next node of every chain being prefetched while the other chains
+ * are looked at. Thus the misses of a group overlap instead of adding up
+ * @param hash_map : Pointer to hash_map
+ * @param n : number of keys
+ * @param hcode_of : hcode_of(i) is the hash of key i
+ * @param match : match(node, i) is true for the node of key i
+ * @param found : the node of every key, NULL if it does not exist
+ */
+template <typename HcodeOf, typename Match>
+static inline void hm_lookup_batch(HashMap *hash_map, size_t n, HcodeOf hcode_of, Match match, Hnode **found) {
+    for (size_t base = 0; base < n; base += LOOKUP_GROUP) {
+        size_t m = (n - base < LOOKUP_GROUP) ? n - base : LOOKUP_GROUP;
+        uint64_t hcode[LOOKUP_GROUP];
+        Hnode *cur[LOOKUP_GROUP]; // next node to compare with, of every chain
+        uint8_t table[LOOKUP_GROUP]; // the table cur is in, 1 or 2, 0 once the key is done
+        for (size_t i = 0; i < m; i++) {
+            hcode[i] = hcode_of(base + i);
+            Hnode **b1 = hashtable_bucket(&hash_map->ht1, hcode[i]);
+            Hnode **b2 = hashtable_bucket(&hash_map->ht2, hcode[i]);
+            if (b1) {
+                __builtin_prefetch(b1);
+            }
+            if (b2) {
+                __builtin_prefetch(b2);
+            }
+        }
+        for (size_t i = 0; i < m; i++) {
+            Hnode **b1 = hashtable_bucket(&hash_map->ht1, hcode[i]);
+            cur[i] = b1 ? *b1 : NULL;
+            table[i] = 1;
+            __builtin_prefetch(cur[i]);
+        }
+        size_t left = m;
+        while (left > 0) {
+            for (size_t i = 0; i < m; i++) {
+                if (!table[i]) {
+                    continue;
+                }
+                Hnode *node = cur[i];
+                if (node && node->hcode == hcode[i] && match(node, base + i)) {
+                    found[base + i] = node;
+                    table[i] = 0;
+                    left--;
+                }
+                else if (node) {
+                    cur[i] = node->next;
+                    __builtin_prefetch(cur[i]);
+                }
+                else if (table[i] == 1 && hash_map->ht2.container) {
+                    // not in ht1, while resizing it may still be in ht2
+                    cur[i] = *hashtable_bucket(&hash_map->ht2, hcode[i]);
+                    table[i] = 2;
+                    __builtin_prefetch(cur[i]);
+                }
+                else {
+                    found[base + i] = NULL;
+                    table[i] = 0;
+                    left--;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief This is a resizing function. When size of fall short then we are filling, when most
+ * of it is empty we give the memory back
+ * @param hash_map 
+ * @param n : buckets of the new table, twice as many to grow
+ */
+static inline void start_resizing(HashMap *hash_map, size_t n) {
+    assert (hash_map->ht2.container == NULL);
+    // create a bigger (or smaller) hash_table and resize
+    if (n > hash_map->ht1.mask + 1) {
+        hash_map->grows++;
+    }
+    else {
+        hash_map->shrinks++;
+    }
+    hash_map->ht2 = hash_map->ht1; 
+    hashtable_init(&hash_map->ht1, n);
+    hash_map->resizing_pos = 0; // reset so that next time, ht1 start picking from index 0 of hashtable 2.
+}
+
+/**
+ * @brief insert the node into hashmap
+ * 
+ * @param hash_map : insert into this hashmap
+ * @param node : node which is getting to the hashmap
+ */
+static inline void hm_insert(HashMap *hash_map, Hnode* node) {
+    if (hash_map->ht1.container == NULL) {
+        hashtable_init(&hash_map->ht1, 4);
+    }
+    hashtable_insert(&hash_map->ht1, node);
+
+    if (hash_map->ht2.container == NULL) {
+        // check whether we need to resize at this moment ? 
+        size_t load_factor = hash_map->ht1.size / (hash_map->ht1.mask + 1);
+        if (load_factor >= MAX_LOAD_FACTOR) {
+            start_resizing(hash_map, (hash_map->ht1.mask + 1) * 2); // double the size
+        }
+    }
+    // dealying and slowing doing the operation 
+    helper_resizing(hash_map, hash_map->rehash_budget_ns);
+}
+
+/// @brief after a pop, shrink ht1 if it is mostly empty buckets: to the size at which it is
+/// half way to growing again, so that a few inserts do not make it grow right away
+static inline void maybe_shrink(HashMap *hash_map) {
+    HashTable *t = &hash_map->ht1;
+    if (hash_map->ht2.container || t->mask + 1 <= MIN_SLOTS || t->size >= (t->mask + 1) * MIN_LOAD_FACTOR) {
+        return;
+    }
+    size_t n = MIN_SLOTS;
+    while (n * MAX_LOAD_FACTOR / 2 < t->size) {
+        n *= 2;
+    }
+    start_resizing(hash_map, n);
+}
+
+
+/**
+ * @brief pop the element from the hashmap
+ * 
+ * @param hash_map : Hashmap from which we need to pop 
+ * @param hcode : hash of the key which we want to pop
+ * @param match : true for the node of the key
+ * @return Hnode* : the node which we want to pop
+ */
+template <typename Match>
+static inline Hnode * hm_pop(HashMap *hash_map, uint64_t hcode, Match match) {
+    helper_resizing(hash_map, hash_map->rehash_budget_ns); 
+    // first try to pop it from the hastable 1
+    Hnode **from = hashtable_lookup(&hash_map->ht1, hcode, match);
+
+    if (from) {
+        Hnode *node = hashtable_pop(&hash_map->ht1, from);
+        maybe_shrink(hash_map);
+        return node;
+    }
+    // and then try to pop it from hashtable 2
+    from = hashtable_lookup(&hash_map->ht2, hcode, match);
+    if (from) {
+        return hashtable_pop(&hash_map->ht2, from);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief up to n nodes picked at random, for sampling (the eviction of the server), like
+ * dictGetSomeKeys() of redis: the table is picked in proportion to its nodes while resizing,
+ * then the chains of the buckets from a random one on. The nodes of a bucket are thus sampled
+ * together, each costs the one cache miss of reading it
+ * @param rnd : a random number
+ * @param out : the nodes
+ * @return number of nodes, fewer than n if SAMPLE_SCAN buckets did not have them, 0 if empty
+ */
+static inline size_t hm_sample(HashMap *hash_map, uint64_t rnd, Hnode **out, size_t n) {
+    size_t total = hash_map->ht1.size + hash_map->ht2.size;
+    if (total == 0) {
+        return 0;
+    }
+    HashTable *ht = (rnd >> 32) % total < hash_map->ht2.size ? &hash_map->ht2 : &hash_map->ht1;
+    size_t found = 0;
+    for (size_t i = 0; i < SAMPLE_SCAN && found < n; i++) {
+        for (Hnode *node = ht->container[(rnd + i) & ht->mask]; node && found < n; node = node->next) {
+            out[found++] = node;
+        }
+    }
+    return found;
+}
+
+/// @brief bytes of the bucket arrays, the nodes are not counted
+static inline size_t hm_bytes(const HashMap *hash_map) {
+    size_t slots = 0;
+    if (hash_map->ht1.container) {
+        slots += hash_map->ht1.mask + 1;
+    }
+    if (hash_map->ht2.container) {
+        slots += hash_map->ht2.mask + 1;
+    }
+    return slots * sizeof(Hnode *);
+}
+
+/**
+ * @brief Destroy the full hashmap, clean all the memory
+ * @param hash_map : hash_map which we want to clean
+ */
+static inline void hm_destroy(HashMap *hash_map) {
+    assert(hash_map->ht1.size + hash_map->ht2.size == 0);
+    free(hash_map->ht1.container); // free up container ht1
+    free(hash_map->ht2.container); // free up container ht2
+    uint64_t budget_ns = hash_map->rehash_budget_ns;
+    *hash_map = HashMap{}; // update the content to a fresh container.
+    hash_map->rehash_budget_ns = budget_ns;
+}
\ No newline at end of file
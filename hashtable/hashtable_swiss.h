@@ -0,0 +1,374 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// open addressing backend of the hashmap, built with make HASHTABLE=swiss and included by
+// hashmap.h. The slots are
+// probed in groups of 16: the control tags of a group are compared with the tag of the key in
+// one SSE2 instruction, so a lookup touches the tags, then only the nodes whose tag matches
+// (1 in 128 of the others by chance), instead of every node of a chain. Resizing is
+// incremental as in the chained backend: the old table stays in ht2 and every insert or pop moves
+// some of its slots over to ht1
+
+static const size_t GROUP = 16; // slots whose tags are compared at once
+static const size_t MAX_LOAD_NUM = 7; // at most 7/8 of the slots are used, else the probes get long
+static const size_t MAX_LOAD_DEN = 8;
+static const size_t MIN_LOAD_DEN = 8; // below 1/8 of the slots used the table shrinks
+static const size_t MAX_SHRINK = 32; // a shrink divides the slots by this at most, see maybe_shrink()
+static const size_t RESIZE_STEP = 8; // nodes moved from ht2 between two reads of the clock
+static const size_t RESIZE_SCAN = RESIZE_STEP * GROUP; // or free slots of ht2 skipped
+static const size_t LOOKUP_GROUP = 32; // keys of a batch lookup whose memory accesses are in flight together
+static const size_t SAMPLE_SCAN = 64; // slots hm_sample() looks at, at most
+
+static const uint8_t CTRL_EMPTY = 0x80; // never used since the last resize, a probe stops here
+static const uint8_t CTRL_DELETED = 0xFE; // used before, a probe goes on
+// a used slot has the low 7 bits of the hash of its node, the high bit clear
+
+static inline uint8_t tag_of(uint64_t hcode) {
+    return (uint8_t)(hcode & 0x7F);
+}
+
+/// @brief the first slot of the group where the probe for hcode starts
+static inline size_t group_of(const HashTable *hash_table, uint64_t hcode) {
+    return (size_t)((hcode >> 7) * GROUP) & hash_table->mask;
+}
+
+/// @brief bit i is set if slot i of the group at ctrl has the tag
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t tag) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP; i++) {
+        mask |= (uint32_t)(ctrl[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+/// @brief bit i is set if slot i of the group at ctrl is empty or deleted, i.e. has the high bit
+static inline uint32_t group_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP; i++) {
+        mask |= (uint32_t)(ctrl[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+static inline uint32_t group_empty(const uint8_t *ctrl) {
+    return group_match(ctrl, CTRL_EMPTY);
+}
+
+/// @brief initialize the table with n slots, all empty
+/// @param n : a power of 2, at least GROUP
+static inline void hashtable_init(HashTable *hash_table, size_t n) {
+    assert(n >= GROUP && ((n - 1) & n) == 0);
+    hash_table->ctrl = (uint8_t *)malloc(n);
+    hash_table->slots = (Hnode **)malloc(n * sizeof(Hnode *));
+    assert(hash_table->ctrl && hash_table->slots);
+    memset(hash_table->ctrl, CTRL_EMPTY, n);
+    hash_table->mask = n - 1;
+    hash_table->size = 0;
+    hash_table->growth_left = n / MAX_LOAD_DEN * MAX_LOAD_NUM;
+}
+
+static inline void hashtable_free(HashTable *hash_table) {
+    free(hash_table->ctrl);
+    free(hash_table->slots);
+    *hash_table = HashTable{};
+}
+
+/// @brief Insert a node whose key is not in the table yet, into the first free slot of its probe
+/// sequence. The groups are probed in triangular steps (pos, pos + 1, pos + 3, pos + 6 ...
+/// groups), which visits every group once since their number is a power of 2
+static inline void hashtable_insert(HashTable *hash_table, Hnode *node) {
+    size_t pos = group_of(hash_table, node->hcode);
+    for (size_t step = GROUP; ; step += GROUP) {
+        uint32_t free_slots = group_free(&hash_table->ctrl[pos]);
+        if (free_slots) {
+            size_t i = pos + (size_t)__builtin_ctz(free_slots);
+            if (hash_table->ctrl[i] == CTRL_EMPTY) {
+                hash_table->growth_left--; // reusing a deleted slot takes no room
+            }
+            hash_table->ctrl[i] = tag_of(node->hcode);
+            hash_table->slots[i] = node;
+            hash_table->size++;
+            return;
+        }
+        assert(step <= hash_table->mask); // the load factor leaves free slots
+        pos = (pos + step) & hash_table->mask;
+    }
+}
+
+/// @brief Lookup a given key in the table
+/// @param match : true for the node of the key, only called on nodes with the same hash
+/// @return the slot holding its node, NULL if it is not there
+template <typename Match>
+static inline Hnode **hashtable_lookup(HashTable *hash_table, uint64_t hcode, Match &match) {
+    if (!hash_table->ctrl) {
+        return NULL;
+    }
+    uint8_t tag = tag_of(hcode);
+    size_t pos = group_of(hash_table, hcode);
+    for (size_t step = GROUP; step <= hash_table->mask + 1; step += GROUP) {
+        const uint8_t *ctrl = &hash_table->ctrl[pos];
+        for (uint32_t tags = group_match(ctrl, tag); tags; tags &= tags - 1) {
+            size_t i = pos + (size_t)__builtin_ctz(tags);
+            Hnode *node = hash_table->slots[i];
+            if (node->hcode == hcode && match(node)) {
+                return &hash_table->slots[i];
+            }
+        }
+        if (group_empty(ctrl)) {
+            return NULL; // the key would have been put here
+        }
+        pos = (pos + step) & hash_table->mask;
+    }
+    return NULL;
+}
+
+/// @brief Remove the node of a slot. The slot may become empty again only if its group has an
+/// empty slot: then the group was never full, thus no probe ever went on past it
+static inline Hnode *hashtable_pop(HashTable *hash_table, Hnode **from) {
+    size_t i = (size_t)(from - hash_table->slots);
+    size_t group = i & ~(GROUP - 1);
+    if (group_empty(&hash_table->ctrl[group])) {
+        hash_table->ctrl[i] = CTRL_EMPTY;
+        hash_table->growth_left++;
+    }
+    else {
+        hash_table->ctrl[i] = CTRL_DELETED;
+    }
+    hash_table->size--;
+    return *from;
+}
+
+static inline uint64_t clock_ns() {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/// @brief move up to RESIZE_STEP nodes of the old table (ht2) to the new one (ht1). A moved slot
+/// is marked deleted, not empty, so that the probes for the keys still in ht2 go on past it
+static inline void resizing_step(HashMap *hash_map) {
+    HashTable *old = &hash_map->ht2;
+    size_t work = 0;
+    size_t scanned = 0;
+    while (work < RESIZE_STEP && scanned < RESIZE_SCAN && old->size > 0) {
+        size_t i = hash_map->resizing_pos++;
+        scanned++;
+        if (old->ctrl[i] & 0x80) {
+            continue; // empty or deleted
+        }
+        old->ctrl[i] = CTRL_DELETED;
+        old->size--;
+        hashtable_insert(&hash_map->ht1, old->slots[i]);
+        work++;
+    }
+    hash_map->moved += work;
+    if (old->size == 0) {
+        hashtable_free(old);
+    }
+}
+
+/// @brief one step of the resize, then more while they fit in budget_ns. An insert does at
+/// least one step, which empties ht2 long before the inserts can fill ht1
+static inline void helper_resizing(HashMap *hash_map, uint64_t budget_ns) {
+    if (hash_map->ht2.ctrl == NULL) {
+        return;
+    }
+    uint64_t start = clock_ns();
+    uint64_t now = start;
+    do {
+        resizing_step(hash_map);
+        now = clock_ns();
+    } while (hash_map->ht2.ctrl && now - start < budget_ns);
+    hash_map->rehash_ns += now - start;
+}
+
+/// @brief move nodes of an ongoing resize for up to budget_ns, the server calls it when it
+/// has nothing else to do
+/// @return number of nodes which are still to move, 0 if there is no resize going on
+static inline size_t hm_rehash(HashMap *hash_map, uint64_t budget_ns) {
+    helper_resizing(hash_map, budget_ns);
+    return hash_map->ht2.size;
+}
+
+/// @brief ht1 becomes the old table and a new one of n slots takes its place
+static inline void start_resizing(HashMap *hash_map, size_t n) {
+    while (hash_map->ht2.ctrl) {
+        resizing_step(hash_map); // an earlier resize is still going on, finish it first
+    }
+    if (n > hash_map->ht1.mask + 1) {
+        hash_map->grows++;
+    }
+    else if (n < hash_map->ht1.mask + 1) {
+        hash_map->shrinks++;
+    }
+    hash_map->ht2 = hash_map->ht1;
+    hashtable_init(&hash_map->ht1, n);
+    hash_map->resizing_pos = 0;
+}
+
+/// @brief ht1 has no room left: a new table twice as large, or as large if most of the used
+/// slots were deleted since
+static inline void start_growing(HashMap *hash_map) {
+    size_t slots = hash_map->ht1.mask + 1;
+    bool grow = hash_map->ht1.size >= slots / MAX_LOAD_DEN * MAX_LOAD_NUM / 2;
+    start_resizing(hash_map, grow ? slots * 2 : slots);
+}
+
+/// @brief After a pop, shrink ht1 if less than 1/8 of it is used, to the size at which it is
+/// half way to growing again. Inserts move a step of ht2 each, thus scanning ht2 takes up to
+/// slots / RESIZE_SCAN inserts, which must fit in the new table: the slots are divided by
+/// MAX_SHRINK at most, a table emptied by far more shrinks again later
+static inline void maybe_shrink(HashMap *hash_map) {
+    HashTable *t = &hash_map->ht1;
+    size_t slots = t->mask + 1;
+    if (hash_map->ht2.ctrl || slots <= GROUP || t->size >= slots / MIN_LOAD_DEN) {
+        return;
+    }
+    size_t n = GROUP;
+    while (n / MAX_LOAD_DEN * MAX_LOAD_NUM / 2 < t->size || n < slots / MAX_SHRINK) {
+        n *= 2;
+    }
+    start_resizing(hash_map, n);
+}
+
+/// @brief a lookup moves no nodes of a resize, thus reads cost the same during one
+template <typename Match>
+static inline Hnode *hm_lookup(HashMap *hash_map, uint64_t hcode, Match match) {
+    Hnode **from = hashtable_lookup(&hash_map->ht1, hcode, match);
+    if (!from) {
+        from = hashtable_lookup(&hash_map->ht2, hcode, match);
+    }
+    return from ? *from : NULL;
+}
+
+/**
+ * @brief Lookup of many keys at once: the tags and slots of the first group of every key are
+ * prefetched, then the node of the first matching tag, and only then the keys are looked up,
+ * thus the cache misses of a group of keys overlap instead of adding up
+ * @param hash_map : Pointer to hash_map
+ * @param n : number of keys
+ * @param hcode_of : hcode_of(i) is the hash of key i
+ * @param match : match(node, i) is true for the node of key i
+ * @param found : the node of every key, NULL if it does not exist
+ */
+template <typename HcodeOf, typename Match>
+static inline void hm_lookup_batch(HashMap *hash_map, size_t n, HcodeOf hcode_of, Match match, Hnode **found) {
+    HashTable *t = &hash_map->ht1;
+    for (size_t base = 0; base < n; base += LOOKUP_GROUP) {
+        size_t m = (n - base < LOOKUP_GROUP) ? n - base : LOOKUP_GROUP;
+        uint64_t hcode[LOOKUP_GROUP];
+        for (size_t i = 0; i < m; i++) {
+            hcode[i] = hcode_of(base + i);
+        }
+        if (t->ctrl) {
+            for (size_t i = 0; i < m; i++) {
+                size_t pos = group_of(t, hcode[i]);
+                __builtin_prefetch(&t->ctrl[pos]);
+                __builtin_prefetch(&t->slots[pos]);
+                __builtin_prefetch(&t->slots[pos + GROUP / 2]);
+            }
+            for (size_t i = 0; i < m; i++) {
+                size_t pos = group_of(t, hcode[i]);
+                uint32_t tags = group_match(&t->ctrl[pos], tag_of(hcode[i]));
+                if (tags) {
+                    __builtin_prefetch(t->slots[pos + (size_t)__builtin_ctz(tags)]);
+                }
+            }
+        }
+        for (size_t i = 0; i < m; i++) {
+            auto match_i = [&](Hnode *node) { return match(node, base + i); };
+            Hnode **from = hashtable_lookup(t, hcode[i], match_i);
+            if (!from) {
+                from = hashtable_lookup(&hash_map->ht2, hcode[i], match_i);
+            }
+            found[base + i] = from ? *from : NULL;
+        }
+    }
+}
+
+/**
+ * @brief insert the node into hashmap, its key must not be there yet
+ *
+ * @param hash_map : insert into this hashmap
+ * @param node : node which is getting to the hashmap
+ */
+static inline void hm_insert(HashMap *hash_map, Hnode* node) {
+    if (hash_map->ht1.ctrl == NULL) {
+        hashtable_init(&hash_map->ht1, GROUP);
+    }
+    if (hash_map->ht1.growth_left == 0) {
+        start_growing(hash_map);
+    }
+    hashtable_insert(&hash_map->ht1, node);
+    helper_resizing(hash_map, hash_map->rehash_budget_ns);
+}
+
+template <typename Match>
+static inline Hnode * hm_pop(HashMap *hash_map, uint64_t hcode, Match match) {
+    helper_resizing(hash_map, hash_map->rehash_budget_ns);
+    Hnode **from = hashtable_lookup(&hash_map->ht1, hcode, match);
+    if (from) {
+        Hnode *node = hashtable_pop(&hash_map->ht1, from);
+        maybe_shrink(hash_map);
+        return node;
+    }
+    from = hashtable_lookup(&hash_map->ht2, hcode, match);
+    if (from) {
+        return hashtable_pop(&hash_map->ht2, from);
+    }
+    return NULL;
+}
+
+/**
+ * @brief up to n nodes picked at random, for sampling (the eviction of the server): the table
+ * is picked in proportion to its nodes while resizing, then the used slots from a random one on
+ * @param rnd : a random number
+ * @param out : the nodes
+ * @return number of nodes, fewer than n if SAMPLE_SCAN slots did not have them, 0 if empty
+ */
+static inline size_t hm_sample(HashMap *hash_map, uint64_t rnd, Hnode **out, size_t n) {
+    size_t total = hash_map->ht1.size + hash_map->ht2.size;
+    if (total == 0) {
+        return 0;
+    }
+    HashTable *ht = (rnd >> 32) % total < hash_map->ht2.size ? &hash_map->ht2 : &hash_map->ht1;
+    size_t found = 0;
+    for (size_t i = 0; i < SAMPLE_SCAN && found < n; i++) {
+        size_t pos = (rnd + i) & ht->mask;
+        if (!(ht->ctrl[pos] & 0x80)) {
+            out[found++] = ht->slots[pos]; // a tag, the slot is used
+        }
+    }
+    return found;
+}
+
+/// @brief bytes of the tags and the slots, the nodes are not counted
+static inline size_t hm_bytes(const HashMap *hash_map) {
+    size_t slots = 0;
+    if (hash_map->ht1.ctrl) {
+        slots += hash_map->ht1.mask + 1;
+    }
+    if (hash_map->ht2.ctrl) {
+        slots += hash_map->ht2.mask + 1;
+    }
+    return slots * (1 + sizeof(Hnode *));
+}
+
+static inline void hm_destroy(HashMap *hash_map) {
+    assert(hash_map->ht1.size + hash_map->ht2.size == 0);
+    hashtable_free(&hash_map->ht1);
+    hashtable_free(&hash_map->ht2);
+    uint64_t budget_ns = hash_map->rehash_budget_ns;
+    *hash_map = HashMap{};
+    hash_map->rehash_budget_ns = budget_ns;
+}
@@ -0,0 +1,114 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+// binary min-heap of deadlines. Every item points back at a position field of its owner (ref),
+// which the heap keeps up to date as the item moves, thus the owner can update or remove its
+// item in O(log n) without searching for it. The field is the position + 1, 0 means the owner
+// has no item. The items are kept in chunks of HEAP_CHUNK instead of one array, thus a heap of
+// millions of items grows and shrinks a chunk at a time, it is never copied as a whole
+
+static const size_t HEAP_CHUNK_SHIFT = 16;
+static const size_t HEAP_CHUNK = (size_t)1 << HEAP_CHUNK_SHIFT; // items, 1MB
+
+struct HeapItem {
+    uint64_t val = 0; // the deadline, the smallest is at position 0
+    uint32_t *ref = NULL;
+};
+
+struct Heap {
+    std::vector<HeapItem *> chunks;
+    size_t len = 0;
+};
+
+static inline HeapItem &heap_at(Heap *h, size_t pos) {
+    return h->chunks[pos >> HEAP_CHUNK_SHIFT][pos & (HEAP_CHUNK - 1)];
+}
+
+static inline size_t heap_parent(size_t i) {
+    return (i + 1) / 2 - 1;
+}
+
+static inline size_t heap_left(size_t i) {
+    return i * 2 + 1;
+}
+
+static inline void heap_place(Heap *h, size_t pos, HeapItem t) {
+    heap_at(h, pos) = t;
+    *t.ref = (uint32_t)(pos + 1);
+}
+
+static inline void heap_up(Heap *h, size_t pos) {
+    HeapItem t = heap_at(h, pos);
+    while (pos > 0 && heap_at(h, heap_parent(pos)).val > t.val) {
+        heap_place(h, pos, heap_at(h, heap_parent(pos)));
+        pos = heap_parent(pos);
+    }
+    heap_place(h, pos, t);
+}
+
+static inline void heap_down(Heap *h, size_t pos) {
+    HeapItem t = heap_at(h, pos);
+    while (true) {
+        size_t l = heap_left(pos);
+        size_t r = l + 1;
+        size_t min_pos = pos;
+        uint64_t min_val = t.val;
+        if (l < h->len && heap_at(h, l).val < min_val) {
+            min_pos = l;
+            min_val = heap_at(h, l).val;
+        }
+        if (r < h->len && heap_at(h, r).val < min_val) {
+            min_pos = r;
+        }
+        if (min_pos == pos) {
+            break;
+        }
+        heap_place(h, pos, heap_at(h, min_pos));
+        pos = min_pos;
+    }
+    heap_place(h, pos, t);
+}
+
+/// @brief restore the order after the val of the item at pos changed
+static inline void heap_update(Heap *h, size_t pos) {
+    if (pos > 0 && heap_at(h, heap_parent(pos)).val > heap_at(h, pos).val) {
+        heap_up(h, pos);
+    }
+    else {
+        heap_down(h, pos);
+    }
+}
+
+/// @brief add an item, *item.ref is set to its position
+/// @return false if out of memory
+static inline bool heap_push(Heap *h, HeapItem item) {
+    if (h->len == h->chunks.size() * HEAP_CHUNK) {
+        HeapItem *chunk = (HeapItem *)malloc(HEAP_CHUNK * sizeof(HeapItem));
+        if (!chunk) {
+            return false;
+        }
+        h->chunks.push_back(chunk);
+    }
+    h->len++;
+    heap_at(h, h->len - 1) = item;
+    heap_up(h, h->len - 1);
+    return true;
+}
+
+/// @brief take the item at pos out, the last item takes its place. *ref of the item is 0
+static inline void heap_remove(Heap *h, size_t pos) {
+    *heap_at(h, pos).ref = 0;
+    HeapItem last = heap_at(h, h->len - 1);
+    h->len--;
+    if (pos < h->len) {
+        heap_place(h, pos, last);
+        heap_update(h, pos);
+    }
+    // a spare chunk is kept, thus an item added and removed over and over does not malloc
+    if (h->chunks.size() >= 2 && h->len + 2 * HEAP_CHUNK <= h->chunks.size() * HEAP_CHUNK) {
+        free(h->chunks.back());
+        h->chunks.pop_back();
+    }
+}
@@ -0,0 +1,36 @@
+#include <stddef.h>
+
+// intrusive circular doubly linked list, the node is embedded in the owning struct (like the
+// Hnode of the hashmap) and the list head is a node of its own, thus both moving a node to
+// the back and detaching it are O(1) without any allocation
+
+struct DList {
+    DList *prev = NULL;
+    DList *next = NULL;
+};
+
+static inline void dlist_init(DList *node) {
+    node->prev = node->next = node;
+}
+
+static inline bool dlist_empty(DList *node) {
+    return node->next == node;
+}
+
+/// @brief take node out of its list, a detached node links to itself so detaching twice is fine
+static inline void dlist_detach(DList *node) {
+    DList *prev = node->prev;
+    DList *next = node->next;
+    prev->next = next;
+    next->prev = prev;
+    dlist_init(node);
+}
+
+/// @brief insert rookie right before target, before the head node means at the back
+static inline void dlist_insert_before(DList *target, DList *rookie) {
+    DList *prev = target->prev;
+    prev->next = rookie;
+    rookie->prev = prev;
+    rookie->next = target;
+    target->prev = rookie;
+}
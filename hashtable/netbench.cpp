@@ -0,0 +1,489 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+// a small load generator for the server, it speaks the same protocol as client.cpp
+// usage:
+//   ./netbench idle <n1,n2,...> [requests]
+//      for every n, keep n idle connections open and time request round trips on one
+//      active connection, the cost per request should stay flat as n grows
+//   ./netbench pipeline <conns> <depth> [seconds] [keys] [value_size] [custom|resp]
+//      every connection sends depth requests back to back before reading the responses,
+//      reports the requests per second. With keys > 0 the requests are SET/GET pairs spread
+//      over that many keys (so they hit every shard), else all of them GET the same key,
+//      which is set to a value of value_size bytes first. The requests are in the custom
+//      protocol, or in RESP as redis-benchmark would send them
+//   ./netbench storm <conns> [rounds]
+//      reconnect storm: open conns connections at once, send a request on each and wait for
+//      all the responses, then reset all of them, reports the time to re-establish per round
+//   ./netbench fill <keys> [value_size] [depth]
+//      SETs keys distinct keys, depth of them back to back, reports the SETs per second and
+//      the slowest batch. Run against a server with a maxmemory below what the keys need, it
+//      is the cost of the eviction which every write does
+//   ./netbench expire <keys> [at_ms] [seconds]
+//      sets keys keys whose deadlines all fall at_ms after the first SET (PX is counted down
+//      as the load goes on), then times GET round trips on another connection for seconds,
+//      reports the percentiles of every 500ms, the wave of expiries must not show in them
+
+static const size_t MSG_MAX_LEN = 4096;
+static const uint8_t HEADER_LEN = 4;
+static const uint16_t PORT = 3001;
+static bool g_resp = false; // speak RESP instead of the custom protocol
+
+static void die(const char *msg) {
+    int err = errno;
+    fprintf(stderr, "[%d] %s\n", err, msg);
+    abort();
+}
+
+static uint64_t now_ns() {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static int32_t read_full(int fd, char* buffer, size_t n) {
+    while (n > 0) {
+        ssize_t return_value = read(fd, buffer, n);
+        if (return_value <= 0) {
+            return -1; // error, or unexpected EOF
+        }
+        assert((size_t)return_value <= n);
+        n -= (size_t)return_value;
+        buffer += return_value;
+    }
+    return 0;
+}
+
+static int32_t write_all(int fd, const char* buffer, size_t n) {
+    while (n > 0) {
+        ssize_t return_value = write(fd, buffer, n);
+        if (return_value <= 0) {
+            return -1; // error
+        }
+        assert((size_t)return_value <= n);
+        n -= (size_t)return_value;
+        buffer += return_value;
+    }
+    return 0;
+}
+
+static int connect_to_server() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs(PORT);
+    addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        die("connect()");
+    }
+    int val = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+    return fd;
+}
+
+/// @brief append a request in the wire format (len, nstr, len, str1, len, str2 ...) to out,
+/// or as a RESP array of bulk strings
+static void encode_request(const std::vector<std::string> &cmd, std::string &out) {
+    if (g_resp) {
+        out += "*" + std::to_string(cmd.size()) + "\r\n";
+        for (const std::string &s: cmd) {
+            out += "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+        }
+        return;
+    }
+    uint32_t len = 4;
+    for (const std::string &s: cmd) {
+        len += 4 + s.size();
+    }
+    uint32_t n = cmd.size();
+    out.append((char *)&len, 4);
+    out.append((char *)&n, 4);
+    for (const std::string &s: cmd) {
+        uint32_t cur_len = (uint32_t)s.size();
+        out.append((char *)&cur_len, 4);
+        out.append(s);
+    }
+}
+
+/// @brief length of the RESP reply at the start of data (a simple one, no arrays)
+/// @return 0 if it is not complete, -1 if it is an error reply
+static ssize_t resp_reply_len(const char *data, size_t size) {
+    const char *cr = (const char *)memchr(data, '\r', size);
+    if (!cr || (size_t)(cr - data) + 2 > size) {
+        return 0;
+    }
+    size_t line = (size_t)(cr - data) + 2;
+    if (data[0] == '-') {
+        return -1;
+    }
+    if (data[0] != '$') {
+        return (ssize_t)line;
+    }
+    long len = strtol(data + 1, NULL, 10);
+    if (len < 0) {
+        return (ssize_t)line; // nil
+    }
+    return (line + (size_t)len + 2 <= size) ? (ssize_t)(line + (size_t)len + 2) : 0;
+}
+
+/// @brief read a single response and discard the body
+static int32_t read_response(int fd) {
+    if (g_resp) {
+        std::string buffer;
+        char c = 0;
+        while (true) {
+            if (read_full(fd, &c, 1)) {
+                return -1;
+            }
+            buffer.push_back(c);
+            ssize_t len = resp_reply_len(buffer.data(), buffer.size());
+            if (len != 0) {
+                return len < 0 ? -1 : 0;
+            }
+        }
+    }
+    char read_buffer[HEADER_LEN + MSG_MAX_LEN];
+    if (read_full(fd, read_buffer, HEADER_LEN)) {
+        return -1;
+    }
+    uint32_t len = 0;
+    memcpy(&len, read_buffer, 4);
+    if (len > MSG_MAX_LEN || len < 4) {
+        return -1;
+    }
+    return read_full(fd, &read_buffer[HEADER_LEN], len);
+}
+
+/// @brief run requests round trips on fd, one at a time
+/// @return average nanoseconds per round trip
+static double round_trips(int fd, size_t requests) {
+    std::string req;
+    encode_request({"get", "netbench"}, req);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < requests; i++) {
+        if (write_all(fd, req.data(), req.size()) || read_response(fd)) {
+            die("round trip");
+        }
+    }
+    return (double)(now_ns() - start) / requests;
+}
+
+/// @brief read n responses from fd, reading as much as the socket has in one go
+static int32_t read_responses(int fd, size_t n, std::vector<char> &buffer) {
+    size_t size = 0;
+    size_t pos = 0;
+    while (n > 0) {
+        if (g_resp && size > pos) {
+            ssize_t len = resp_reply_len(&buffer[pos], size - pos);
+            if (len < 0) {
+                return -1;
+            }
+            if (len > 0) {
+                pos += (size_t)len;
+                n--;
+                continue;
+            }
+        }
+        else if (!g_resp && size - pos >= HEADER_LEN) {
+            uint32_t len = 0;
+            memcpy(&len, &buffer[pos], 4);
+            if (size - pos >= HEADER_LEN + len) {
+                pos += HEADER_LEN + len;
+                n--;
+                continue;
+            }
+        }
+        // move the partial response to the front and read more
+        memmove(buffer.data(), &buffer[pos], size - pos);
+        size -= pos;
+        pos = 0;
+        if (g_resp && size == buffer.size()) {
+            buffer.resize(buffer.size() * 2); // a response larger than the buffer
+        }
+        if (!g_resp && size >= HEADER_LEN) {
+            uint32_t len = 0;
+            memcpy(&len, buffer.data(), 4);
+            if (HEADER_LEN + len > buffer.size()) {
+                buffer.resize(HEADER_LEN + len); // a response larger than the buffer
+            }
+        }
+        ssize_t return_value = read(fd, &buffer[size], buffer.size() - size);
+        if (return_value <= 0) {
+            return -1;
+        }
+        size += (size_t)return_value;
+    }
+    return 0;
+}
+
+static void bench_pipeline(size_t conns, size_t depth, double seconds, size_t keys, size_t value_size) {
+    std::vector<int> fds;
+    std::vector<std::string> batches;
+    std::string value(value_size ? value_size : 5, 'v');
+    if (keys == 0 && value_size > 0) {
+        int fd = connect_to_server();
+        std::string req;
+        encode_request({"set", "netbench", value}, req);
+        if (write_all(fd, req.data(), req.size()) || read_response(fd)) {
+            die("set");
+        }
+        close(fd);
+    }
+    for (size_t i = 0; i < conns; i++) {
+        fds.push_back(connect_to_server());
+        std::string batch;
+        for (size_t j = 0; j < depth; j++) {
+            if (keys == 0) {
+                encode_request({"get", "netbench"}, batch);
+                continue;
+            }
+            std::string key = "key:" + std::to_string((i * depth + j / 2) % keys);
+            if (j % 2 == 0) {
+                encode_request({"set", key, value}, batch);
+            }
+            else {
+                encode_request({"get", key}, batch);
+            }
+        }
+        batches.push_back(batch);
+    }
+    std::vector<char> buffer(1 << 20);
+    uint64_t start = now_ns();
+    uint64_t deadline = start + (uint64_t)(seconds * 1e9);
+    size_t done = 0;
+    while (now_ns() < deadline) {
+        for (size_t i = 0; i < conns; i++) {
+            if (write_all(fds[i], batches[i].data(), batches[i].size())) {
+                die("write");
+            }
+        }
+        for (int fd : fds) {
+            if (read_responses(fd, depth, buffer)) {
+                die("read");
+            }
+        }
+        done += conns * depth;
+    }
+    double elapsed = (double)(now_ns() - start) / 1e9;
+    printf("conns=%zu depth=%zu requests=%zu req_per_sec=%.0f\n", conns, depth, done, done / elapsed);
+    for (int fd : fds) {
+        close(fd);
+    }
+}
+
+/// @brief start a connect without waiting for the handshake, the socket is blocking again once
+/// this returns, thus the first write waits for the connection to be established
+static int connect_async() {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs(PORT);
+    addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) && errno != EINPROGRESS) {
+        die("connect()");
+    }
+    int val = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    return fd;
+}
+
+/// @brief close with a RST instead of a FIN, so that a storm does not leave the ports in TIME_WAIT
+static void reset_connection(int fd) {
+    struct linger lin = {};
+    lin.l_onoff = 1;
+    lin.l_linger = 0;
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    close(fd);
+}
+
+static void bench_storm(size_t conns, size_t rounds) {
+    std::string req;
+    encode_request({"get", "netbench"}, req);
+    printf("%8s %12s %16s\n", "round", "ms", "conns_per_sec");
+    for (size_t round = 0; round < rounds; round++) {
+        std::vector<int> fds;
+        uint64_t start = now_ns();
+        // all the handshakes at once, as when every client of a restarted server comes back
+        for (size_t i = 0; i < conns; i++) {
+            fds.push_back(connect_async());
+        }
+        for (int fd : fds) {
+            if (write_all(fd, req.data(), req.size())) {
+                die("write");
+            }
+        }
+        // a connection counts once the server has accepted it and answered
+        for (int fd : fds) {
+            if (read_response(fd)) {
+                die("read");
+            }
+        }
+        double ms = (double)(now_ns() - start) / 1e6;
+        printf("%8zu %12.1f %16.0f\n", round, ms, conns / (ms / 1e3));
+        fflush(stdout);
+        for (int fd : fds) {
+            reset_connection(fd);
+        }
+        usleep(100 * 1000); // let the server see the resets before the next round
+    }
+}
+
+static void bench_fill(size_t keys, size_t value_size, size_t depth) {
+    int fd = connect_to_server();
+    std::vector<char> buffer(1 << 20);
+    std::string value(value_size, 'v');
+    uint64_t start = now_ns();
+    uint64_t slowest = 0;
+    for (size_t i = 0; i < keys; i += depth) {
+        std::string batch;
+        size_t n = std::min(depth, keys - i);
+        for (size_t j = 0; j < n; j++) {
+            encode_request({"set", "fill:" + std::to_string(i + j), value}, batch);
+        }
+        uint64_t t = now_ns();
+        if (write_all(fd, batch.data(), batch.size()) || read_responses(fd, n, buffer)) {
+            die("set");
+        }
+        slowest = std::max(slowest, now_ns() - t);
+    }
+    double elapsed = (double)(now_ns() - start) / 1e9;
+    printf("keys=%zu value_size=%zu depth=%zu sets_per_sec=%.0f slowest_batch_us=%.1f\n", keys, value_size,
+        depth, keys / elapsed, slowest / 1e3);
+    close(fd);
+}
+
+static void bench_expire(size_t keys, uint64_t at_ms, double seconds) {
+    const size_t BATCH = 1000; // SETs sent before their responses are read
+    const uint64_t WINDOW_NS = 500 * 1000 * 1000;
+    int fd = connect_to_server();
+    std::vector<char> buffer(1 << 20);
+    uint64_t start = now_ns();
+    uint64_t at = start + at_ms * 1000000;
+    for (size_t i = 0; i < keys; i += BATCH) {
+        uint64_t now = now_ns();
+        if (now + 1000000 >= at) {
+            die("at_ms is too short to set all the keys");
+        }
+        std::string px = std::to_string((at - now) / 1000000);
+        std::string batch;
+        size_t n = std::min(BATCH, keys - i);
+        for (size_t j = 0; j < n; j++) {
+            encode_request({"set", "exp:" + std::to_string(i + j), "v", "px", px}, batch);
+        }
+        if (write_all(fd, batch.data(), batch.size()) || read_responses(fd, n, buffer)) {
+            die("set");
+        }
+    }
+    printf("%zu keys set in %.1fs, they expire at %.1fs\n", keys,
+        (double)(now_ns() - start) / 1e9, (double)at_ms / 1e3);
+    printf("%8s %8s %10s %10s %10s %10s\n", "t_s", "gets", "p50_us", "p99_us", "p999_us", "max_us");
+    std::string req;
+    encode_request({"get", "netbench"}, req);
+    uint64_t end = now_ns() + (uint64_t)(seconds * 1e9);
+    std::vector<uint64_t> lat;
+    uint64_t window = now_ns();
+    while (true) {
+        uint64_t t = now_ns();
+        if (t - window >= WINDOW_NS || t >= end) {
+            std::sort(lat.begin(), lat.end());
+            if (!lat.empty()) {
+                printf("%8.1f %8zu %10.1f %10.1f %10.1f %10.1f\n", (double)(window - start) / 1e9, lat.size(),
+                    lat[lat.size() / 2] / 1e3, lat[lat.size() * 99 / 100] / 1e3,
+                    lat[lat.size() * 999 / 1000] / 1e3, lat.back() / 1e3);
+                fflush(stdout);
+            }
+            lat.clear();
+            window = t;
+            if (t >= end) {
+                break;
+            }
+        }
+        if (write_all(fd, req.data(), req.size()) || read_response(fd)) {
+            die("get");
+        }
+        lat.push_back(now_ns() - t);
+    }
+    close(fd);
+}
+
+static void bench_idle(const char *sweep, size_t requests) {
+    int active = connect_to_server();
+    std::vector<int> idle;
+    printf("%12s %16s\n", "idle_conns", "ns_per_request");
+    for (const char *p = sweep; *p; ) {
+        size_t target = strtoul(p, (char **)&p, 10);
+        if (*p == ',') {
+            p++;
+        }
+        while (idle.size() < target) {
+            idle.push_back(connect_to_server());
+        }
+        (void)round_trips(active, requests / 10 + 1); // warm up, also lets the server accept the backlog
+        printf("%12zu %16.0f\n", idle.size(), round_trips(active, requests));
+        fflush(stdout);
+    }
+    for (int fd : idle) {
+        close(fd);
+    }
+    close(active);
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && strcmp(argv[1], "idle") == 0) {
+        size_t requests = argc >= 4 ? strtoul(argv[3], NULL, 10) : 20000;
+        bench_idle(argv[2], requests);
+        return 0;
+    }
+    if (argc >= 4 && strcmp(argv[1], "pipeline") == 0) {
+        double seconds = argc >= 5 ? atof(argv[4]) : 5;
+        size_t keys = argc >= 6 ? strtoul(argv[5], NULL, 10) : 0;
+        size_t value_size = argc >= 7 ? strtoul(argv[6], NULL, 10) : 0;
+        g_resp = argc >= 8 && strcmp(argv[7], "resp") == 0;
+        bench_pipeline(strtoul(argv[2], NULL, 10), strtoul(argv[3], NULL, 10), seconds, keys, value_size);
+        return 0;
+    }
+    if (argc >= 3 && strcmp(argv[1], "storm") == 0) {
+        size_t rounds = argc >= 4 ? strtoul(argv[3], NULL, 10) : 5;
+        bench_storm(strtoul(argv[2], NULL, 10), rounds);
+        return 0;
+    }
+    if (argc >= 3 && strcmp(argv[1], "fill") == 0) {
+        size_t value_size = argc >= 4 ? strtoul(argv[3], NULL, 10) : 100;
+        size_t depth = argc >= 5 ? strtoul(argv[4], NULL, 10) : 100;
+        bench_fill(strtoul(argv[2], NULL, 10), value_size, depth);
+        return 0;
+    }
+    if (argc >= 3 && strcmp(argv[1], "expire") == 0) {
+        uint64_t at_ms = argc >= 4 ? strtoull(argv[3], NULL, 10) : 30000;
+        double seconds = argc >= 5 ? atof(argv[4]) : at_ms / 1e3 + 5;
+        bench_expire(strtoul(argv[2], NULL, 10), at_ms, seconds);
+        return 0;
+    }
+    fprintf(stderr, "usage: %s idle <n1,n2,...> [requests]\n", argv[0]);
+    fprintf(stderr, "       %s pipeline <conns> <depth> [seconds] [keys] [value_size] [custom|resp]\n", argv[0]);
+    fprintf(stderr, "       %s storm <conns> [rounds]\n", argv[0]);
+    fprintf(stderr, "       %s fill <keys> [value_size] [depth]\n", argv[0]);
+    fprintf(stderr, "       %s expire <keys> [at_ms] [seconds]\n", argv[0]);
+    return 1;
+}
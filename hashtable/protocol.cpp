@@ -0,0 +1,410 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "buffer.h"
+#include "protocol.h"
+
+static const size_t RESP_LINE_MAX = 32; // longest *<n> or $<len> line we wait for
+static const int64_t RESP_ARGS_MAX = 1024 * 1024; // arguments of one request
+
+/// @brief make room for n arguments, only a request with more than ARGS_SMALL of them allocates
+/// @return false if out of memory
+static bool args_reserve(Args *args, size_t n) {
+    if (n <= args->cap) {
+        return true;
+    }
+    Slice *v = (Slice *)malloc(n * sizeof(Slice));
+    if (!v) {
+        return false;
+    }
+    memcpy(v, args->v, args->n * sizeof(Slice));
+    args_free(args);
+    args->v = v;
+    args->cap = n;
+    return true;
+}
+
+/// @brief used to parse the request, we are using a protocol to send the request
+/// (nstr, len, str1, len, str2 ...), the strings are not copied
+/// @param raw_request : obtained from the client.
+/// @param end_pos : The total length of the request.
+/// @param args : the strings of the request, pointing into raw_request
+/// @return whether parsable ? success(0) or failure (-1)
+int32_t parse_request(const uint8_t *raw_request, size_t end_pos, Args *args) {
+    if (end_pos < 4) {
+        return -1;
+    } 
+    uint32_t len_of_request = 0;
+    memcpy(&len_of_request, &raw_request[0], 4); // read first 4 bytes, i.e total number of string in request 
+    // every string takes at least 4 bytes, a larger count is a lie, do not allocate for it
+    if (len_of_request > (end_pos - 4) / 4 || !args_reserve(args, len_of_request)) {
+        return -1;
+    }
+
+    size_t cur_pos = 4; // iterator at which position we have readed from the raw request 
+
+    while (len_of_request--) {
+        if (cur_pos + 4 > end_pos) {
+            return -1;
+        }
+        uint32_t size_of_command = 0;
+        memcpy(&size_of_command, &raw_request[cur_pos], 4);
+        if (cur_pos + 4 + size_of_command > end_pos) {
+            return -1; // we are exceeding the final length, and string is still not covered in that length, some issue 
+        }
+        Slice *arg = &args->v[args->n++];
+        arg->ptr = &raw_request[cur_pos + 4];
+        arg->len = size_of_command;
+        cur_pos += 4 + size_of_command;
+    }
+    if (cur_pos != end_pos) {
+        return -1; 
+    }
+    return 0; // success in parse 
+}
+
+/// @brief case insensitive comparison of an argument with a command name
+bool slice_is(Slice s, const char *word) {
+    return strlen(word) == s.len && strncasecmp((const char *)s.ptr, word, s.len) == 0;
+}
+
+void args_free(Args *args) {
+    if (args->v != args->small) {
+        free(args->v);
+    }
+    args->v = args->small;
+    args->cap = ARGS_SMALL;
+}
+
+/// @brief tell the protocol of a connection from its first bytes. A RESP request starts with
+/// "*<digit>" followed by a digit, \r or \n. Read as the length header of a custom frame those
+/// 4 bytes announce more than 160MB, thus up to DETECT_CUSTOM_MAX the two never mix up
+/// @return PROTO_NONE if more bytes are needed to tell
+uint32_t detect_protocol(const uint8_t *data, size_t len) {
+    if (len == 0) {
+        return PROTO_NONE;
+    }
+    if (data[0] != '*') {
+        return PROTO_CUSTOM;
+    }
+    if (len < 4) {
+        return PROTO_NONE;
+    }
+    bool digit = data[1] >= '0' && data[1] <= '9';
+    return (digit && data[3] >= '\n') ? PROTO_RESP2 : PROTO_CUSTOM;
+}
+
+/// @brief the first \r in [p, end), 16 bytes per compare with SSE2
+/// @return end if there is none
+static const uint8_t *find_cr(const uint8_t *p, const uint8_t *end) {
+#ifdef __SSE2__
+    const __m128i cr = _mm_set1_epi8('\r');
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, cr));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p == '\r') {
+            break;
+        }
+    }
+    return p;
+}
+
+/// @brief parse a "<prefix><digits>\r\n" line starting at *pos
+/// @param pos : moved past the line if it is complete
+/// @return PARSE_OK, PARSE_MORE or PARSE_ERR
+static int resp_line_int(const uint8_t *data, size_t len, size_t *pos, uint8_t prefix, int64_t *value) {
+    if (*pos >= len) {
+        return PARSE_MORE;
+    }
+    if (data[*pos] != prefix) {
+        return PARSE_ERR;
+    }
+    const uint8_t *begin = &data[*pos + 1];
+    const uint8_t *end = &data[len];
+    if (end - begin > (ptrdiff_t)RESP_LINE_MAX) {
+        end = begin + RESP_LINE_MAX;
+    }
+    const uint8_t *cr = find_cr(begin, end);
+    if (cr == end) {
+        return (end == &data[len]) ? PARSE_MORE : PARSE_ERR; // or a line longer than any number
+    }
+    if (cr + 1 == &data[len]) {
+        return PARSE_MORE; // the \n is still on the way
+    }
+    if (cr[1] != '\n' || cr == begin || cr - begin > 18) {
+        return PARSE_ERR;
+    }
+    int64_t v = 0;
+    for (const uint8_t *d = begin; d < cr; d++) {
+        if (*d < '0' || *d > '9') {
+            return PARSE_ERR; // negative lengths are not allowed in requests
+        }
+        v = v * 10 + (*d - '0');
+    }
+    *value = v;
+    *pos = (size_t)(cr + 2 - data);
+    return PARSE_OK;
+}
+
+/// @brief go on parsing a RESP request from where p stopped, the arguments are put into args
+/// if it is not NULL. The bytes of an argument are never looked at, only its trailing \r\n
+static int resp_walk(RespParser *p, const uint8_t *data, size_t len, size_t max_bulk, Args *args) {
+    size_t pos = p->pos;
+    if (p->nargs < 0) {
+        int64_t nargs = 0;
+        int r = resp_line_int(data, len, &pos, '*', &nargs);
+        if (r != PARSE_OK) {
+            return r;
+        }
+        if (nargs < 1 || nargs > RESP_ARGS_MAX) {
+            return PARSE_ERR;
+        }
+        p->nargs = nargs;
+        p->pos = pos;
+    }
+    if (args && !args_reserve(args, (size_t)p->nargs)) {
+        return PARSE_ERR;
+    }
+    while (p->argi < p->nargs) {
+        int64_t n = 0;
+        int r = resp_line_int(data, len, &pos, '$', &n);
+        if (r != PARSE_OK) {
+            return r;
+        }
+        if ((uint64_t)n > max_bulk) {
+            return PARSE_ERR;
+        }
+        if (len - pos < (size_t)n + 2) {
+            p->need = (size_t)n + 2 - (len - pos);
+            return PARSE_MORE; // the $<len> line is parsed again next time, the bytes are not
+        }
+        if (data[pos + n] != '\r' || data[pos + n + 1] != '\n') {
+            return PARSE_ERR;
+        }
+        if (args) {
+            Slice *arg = &args->v[args->n++];
+            arg->ptr = &data[pos];
+            arg->len = (size_t)n;
+        }
+        pos += (size_t)n + 2;
+        p->pos = pos;
+        p->argi++;
+    }
+    return PARSE_OK;
+}
+
+/**
+ * @brief parse a RESP request at the start of data. A request which arrives in one piece is
+ * parsed in a single pass. One which arrives in pieces is only followed from where the last
+ * call stopped, once complete its lines (not the bytes of the arguments) are walked again to
+ * collect the arguments, as views into data
+ * @param p : progress of the request, reset once it is complete
+ * @param data : the unread bytes of the read buffer
+ * @param len : length of data
+ * @param max_bulk : longest argument accepted
+ * @param args : the arguments, when PARSE_OK
+ * @param frame_len : bytes of the request, when PARSE_OK
+ * @return PARSE_OK, PARSE_MORE or PARSE_ERR
+ */
+int resp_parse(RespParser *p, const uint8_t *data, size_t len, size_t max_bulk, Args *args, size_t *frame_len) {
+    p->need = 0;
+    bool fresh = (p->pos == 0);
+    int r = resp_walk(p, data, len, max_bulk, fresh ? args : NULL);
+    if (r != PARSE_OK) {
+        args->n = 0;
+        return r;
+    }
+    *frame_len = p->pos;
+    if (!fresh) {
+        RespParser again;
+        r = resp_walk(&again, data, *frame_len, max_bulk, args);
+    }
+    *p = RespParser{};
+    return r;
+}
+
+static void reply_bytes(Reply *r, const void *data, size_t len) {
+    if (!outq_append(r->out, data, len)) {
+        fprintf(stderr, "out of memory\n");
+        abort();
+    }
+}
+
+/// @brief a RESP line: type byte, text, \r\n
+static void reply_line(Reply *r, char type, const char *text, size_t len) {
+    reply_bytes(r, &type, 1);
+    reply_bytes(r, text, len);
+    reply_bytes(r, "\r\n", 2);
+}
+
+static void reply_line_int(Reply *r, char type, int64_t value) {
+    char text[32];
+    int n = snprintf(text, sizeof(text), "%lld", (long long)value);
+    reply_line(r, type, text, (size_t)n);
+}
+
+/// @brief custom protocol, the length of the next element of an array
+static void reply_len(Reply *r, uint32_t len) {
+    reply_bytes(r, &len, 4);
+}
+
+/// @brief start a reply at the end of out, in the custom protocol a reply is a frame (length,
+/// response code, data) whose header is only known once the reply is complete
+void reply_begin(Reply *r, OutQueue *out, uint32_t proto) {
+    *r = Reply{};
+    r->out = out;
+    r->proto = proto;
+    r->queued = out->bytes;
+    if (proto == PROTO_CUSTOM) {
+        r->header = outq_alloc(out, 8);
+        if (!r->header) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+    }
+}
+
+/// @brief the reply is complete, fill in the frame header
+void reply_end(Reply *r) {
+    if (r->header) {
+        uint32_t len = (uint32_t)(r->out->bytes - r->queued - 4); // response code and data
+        memcpy(&r->header[0], &len, 4);
+        memcpy(&r->header[4], &r->code, 4);
+    }
+}
+
+/// @brief the command succeeded and has nothing to say
+void reply_ok(Reply *r) {
+    if (r->proto != PROTO_CUSTOM) {
+        reply_line(r, '+', "OK", 2);
+    }
+}
+
+/// @brief a short status text (e.g. PONG), a simple string in RESP
+void reply_status(Reply *r, const char *status) {
+    if (r->proto != PROTO_CUSTOM) {
+        reply_line(r, '+', status, strlen(status));
+        return;
+    }
+    reply_str(r, status, strlen(status));
+}
+
+/// @brief the message starts with an error code of its own, an upper case word (WRONGTYPE, OOM)
+static bool err_has_code(const char *msg) {
+    size_t i = 0;
+    while (msg[i] >= 'A' && msg[i] <= 'Z') {
+        i++;
+    }
+    return i > 0 && msg[i] == ' ';
+}
+
+/// @brief an error, in RESP its code goes first: ERR unless the message has one, clients tell
+/// the errors apart by it
+void reply_err(Reply *r, const char *msg) {
+    if (r->proto != PROTO_CUSTOM) {
+        reply_bytes(r, err_has_code(msg) ? "-" : "-ERR ", err_has_code(msg) ? 1 : 5);
+        reply_bytes(r, msg, strlen(msg));
+        reply_bytes(r, "\r\n", 2);
+        return;
+    }
+    r->code = RES_ERR;
+    reply_bytes(r, msg, strlen(msg));
+}
+
+/// @brief no such key / no value
+void reply_nil(Reply *r) {
+    if (r->proto == PROTO_RESP3) {
+        reply_bytes(r, "_\r\n", 3);
+    }
+    else if (r->proto == PROTO_RESP2) {
+        reply_bytes(r, "$-1\r\n", 5);
+    }
+    else if (r->nested) {
+        reply_len(r, UINT32_MAX);
+    }
+    else {
+        r->code = RES_NX;
+    }
+}
+
+void reply_str(Reply *r, const void *data, size_t len) {
+    if (r->proto != PROTO_CUSTOM) {
+        reply_line_int(r, '$', (int64_t)len);
+        reply_bytes(r, data, len);
+        reply_bytes(r, "\r\n", 2);
+        return;
+    }
+    if (r->nested) {
+        reply_len(r, (uint32_t)len);
+    }
+    reply_bytes(r, data, len);
+}
+
+/// @brief a stored value, a large one is referenced by the output queue instead of copied
+void reply_ref(Reply *r, RcBuf *buf) {
+    if (r->proto != PROTO_CUSTOM) {
+        reply_line_int(r, '$', (int64_t)buf->len);
+    }
+    else if (r->nested) {
+        reply_len(r, (uint32_t)buf->len);
+    }
+    if (!outq_append_ref(r->out, buf)) {
+        fprintf(stderr, "out of memory\n");
+        abort();
+    }
+    if (r->proto != PROTO_CUSTOM) {
+        reply_bytes(r, "\r\n", 2);
+    }
+}
+
+/// @brief an integer, as decimal text in the custom protocol
+void reply_int(Reply *r, int64_t value) {
+    if (r->proto != PROTO_CUSTOM) {
+        reply_line_int(r, ':', value);
+        return;
+    }
+    char text[32];
+    int n = snprintf(text, sizeof(text), "%lld", (long long)value);
+    reply_str(r, text, (size_t)n);
+}
+
+/// @brief a double, a RESP3 double and text everywhere else
+void reply_dbl(Reply *r, double value) {
+    char text[32];
+    int n = snprintf(text, sizeof(text), "%.17g", value);
+    if (r->proto == PROTO_RESP3) {
+        reply_line(r, ',', text, (size_t)n);
+        return;
+    }
+    reply_str(r, text, (size_t)n);
+}
+
+/// @brief an array of n elements, they follow as replies of their own
+void reply_arr(Reply *r, size_t n) {
+    if (r->proto != PROTO_CUSTOM) {
+        reply_line_int(r, '*', (int64_t)n);
+        return;
+    }
+    reply_len(r, (uint32_t)n);
+    r->nested = true;
+}
+
+/// @brief a map of n key value pairs, a flat array of 2n elements before RESP3
+void reply_map(Reply *r, size_t n) {
+    if (r->proto == PROTO_RESP3) {
+        reply_line_int(r, '%', (int64_t)n);
+        return;
+    }
+    reply_arr(r, 2 * n);
+}
@@ -0,0 +1,102 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// request parsing without allocations: the arguments of a request are views into the bytes
+// of the request (i.e. into the read buffer of the connection), they stay valid until the
+// request is consumed, a handler copies bytes only when it stores them
+
+struct Slice {
+    const uint8_t *ptr = NULL;
+    size_t len = 0;
+};
+
+static const size_t ARGS_SMALL = 8; // arguments held inline, enough for every fixed arity command
+
+// the arguments of one request, a small vector: up to ARGS_SMALL of them live in the struct
+// itself, only a longer request (e.g. MSET) puts them on the heap. It points into itself,
+// thus it is never copied
+struct Args {
+    Slice *v = small;
+    size_t n = 0;
+    size_t cap = ARGS_SMALL;
+    Slice small[ARGS_SMALL];
+
+    Args() = default;
+    Args(const Args &) = delete;
+    Args &operator=(const Args &) = delete;
+};
+
+// basic api to the parser i.e parse, compare and free
+
+int32_t parse_request(const uint8_t *raw_request, size_t end_pos, Args *args);
+bool slice_is(Slice s, const char *word);
+void args_free(Args *args);
+
+// the wire protocols of the server, a connection speaks the one its first bytes are in
+enum {
+    PROTO_NONE = 0, // nothing received yet
+    PROTO_CUSTOM = 1, // length prefixed frames, see parse_request()
+    PROTO_RESP2 = 2, // redis serialization protocol, what redis-cli and the client libraries speak
+    PROTO_RESP3 = 3, // RESP2 plus typed replies (null, double, map), switched to with HELLO 3
+};
+
+// response codes of the custom protocol
+enum {
+    RES_OK = 0,
+    RES_ERR = 1,
+    RES_NX = 2,
+};
+
+// the largest custom frame detect_protocol() never takes for RESP, a longer one may start with
+// the bytes of a RESP request. Custom frames are held to it while the protocol is detected
+static const uint32_t DETECT_CUSTOM_MAX = 0x0A000000 - 1; // 160MB
+
+uint32_t detect_protocol(const uint8_t *data, size_t len);
+
+// RESP requests are arrays of bulk strings (*<n>\r\n then $<len>\r\n<bytes>\r\n per argument).
+// The parser is incremental: when a request is not complete it remembers how far it got, the
+// next call goes on from there instead of parsing the whole frame again. Offsets are relative
+// to the start of the frame since the read buffer may move in between
+enum {
+    PARSE_OK = 0,
+    PARSE_MORE = 1, // incomplete, call again with more bytes
+    PARSE_ERR = 2,
+};
+
+struct RespParser {
+    size_t pos = 0; // end of the last complete line or argument
+    int64_t nargs = -1; // from the *<n> line, -1 until it is in
+    int64_t argi = 0; // arguments complete
+    size_t need = 0; // bytes still missing of the argument in progress, 0 if unknown
+};
+
+int resp_parse(RespParser *p, const uint8_t *data, size_t len, size_t max_bulk, Args *args, size_t *frame_len);
+
+// where a command writes its reply. The handlers only say what they reply (a string, nil, an
+// array ...), these functions encode it in the protocol of the connection. In the custom 
+// protocol nil and errors become the response code of the frame, and the elements of an array
+// are length prefixed (nil is a length of UINT32_MAX)
+struct OutQueue;
+struct RcBuf;
+
+struct Reply {
+    OutQueue *out = NULL;
+    uint32_t proto = PROTO_CUSTOM;
+    uint32_t code = RES_OK; // custom protocol: response code of the frame
+    bool nested = false; // custom protocol: inside an array
+    uint8_t *header = NULL; // custom protocol: header of the frame, filled in by reply_end()
+    size_t queued = 0; // bytes of out before the reply
+};
+
+void reply_begin(Reply *r, OutQueue *out, uint32_t proto);
+void reply_end(Reply *r);
+void reply_ok(Reply *r);
+void reply_status(Reply *r, const char *status);
+void reply_err(Reply *r, const char *msg);
+void reply_nil(Reply *r);
+void reply_str(Reply *r, const void *data, size_t len);
+void reply_ref(Reply *r, RcBuf *buf);
+void reply_int(Reply *r, int64_t value);
+void reply_dbl(Reply *r, double value);
+void reply_arr(Reply *r, size_t n);
+void reply_map(Reply *r, size_t n);
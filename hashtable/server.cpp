@@ -5,16 +5,42 @@
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include "hashtable.h"
+#include "hashmap.h"
+#include "uring.h"
+#include "spsc.h"
+#include "buffer.h"
+#include "list.h"
+#include "heap.h"
+#include "protocol.h"
+#include "command.h"
+#include "hash.h"
+#include "slab.h"
+#include "avl.h"
+#include "btree.h"
+#include "zset.h"
+#include "entry.h"
 
 #define get_outer_wrapper_of_hnode(ptr, type, member) ({                  \
     const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
@@ -23,8 +49,17 @@
 // functions are defined static to limit their scope to this 
 // file only to avoid name conflicts (or encaptualtion too)
 
-static const size_t MSG_MAX_LEN = 4096;
 static const uint8_t HEADER_LEN = 4;
+static const size_t READ_CHUNK = 16 * 1024; // free room we want in the read buffer before a read()
+static const size_t MAX_EVENTS = 1024; // max ready fds returned by a single epoll_wait()
+static const size_t ACCEPT_BUDGET = 256; // connections accepted per loop iteration, the rest waits for the next one
+static const size_t CONN_SLAB = 64; // Conn objects allocated at once by the pool
+static const size_t OUT_HIGH_WATER = 1024 * 1024; // stop reading requests once this much output is queued
+static const size_t OUT_LOW_WATER = 256 * 1024; // ... and start again once it drained below this
+static const size_t OUT_IOV_MAX = 64; // output blocks sent by one writev()
+static const unsigned URING_ENTRIES = 4096; // submission queue size of the io_uring backend
+static const unsigned URING_BUFFERS = 4096; // recv buffers shared by all connections
+static const size_t URING_BUFFER_SIZE = 4096; // a larger request arrives in several recv
 static std::map<std::string, std::string> map; // later we will update this using hashtable
 
 static void die(const char *msg) {
@@ -56,14 +91,9 @@ static void set_fd_to_non_blocking(int fd) {
 
 enum {
     STATE_REQ = 0,
-    STATE_RES = 1, 
+    STATE_RES = 1, // too much output is queued, only flush until the client has read it
     STATE_END = 2,  
-};
-
-enum {
-    RES_OK = 0,
-    RES_ERR = 1, 
-    RES_NX = 2,
+    STATE_WAIT = 3, // the request went to the shard owning its key, waiting for the reply
 };
 
 // we are making things async or non-blocking, we may need the container 
@@ -72,131 +102,670 @@ enum {
 struct Conn {
     int fd = -1;
     uint32_t state = 0; // setup from the enum 
-    // buffer for reading 
-    size_t read_buffer_size = 0;
-    uint8_t read_buffer[HEADER_LEN + MSG_MAX_LEN]; // fixed size array of integers 
-    // buffer for writing 
-    size_t write_buffer_size = 0;
-    size_t write_buffer_sent = 0;
-    uint8_t write_buffer[HEADER_LEN + MSG_MAX_LEN]; // fixed sized
+    uint32_t events = 0; // epoll interest currently registered for fd (EPOLLIN / EPOLLOUT)
+    bool touched = false; // queued for the flush at the end of this loop iteration
+    // a forwarded or scattered request is not back yet: the reply points to this Conn, it is
+    // kept (even once the connection failed, STATE_END) until the reply has arrived
+    bool forwarded = false;
+    uint32_t proto = PROTO_NONE; // wire protocol, told from the first bytes (PROTO_*)
+    RespParser resp; // progress of a RESP request which has not fully arrived
+    uint64_t idle_start = 0; // ms, last time the client did something
+    DList idle_node; // in g_timers.idle, the least recently active connection first
+    // buffer for reading, grows up to the largest request allowed
+    Buffer read_buffer;
+    // responses which are not sent yet, all of them go out with one writev()
+    OutQueue out;
 };
 
-// structure for the key and value 
-struct Entry {
-    struct Hnode node;
-    std::string key;
-    std::string val;
+// seed of the key hash, random per process and shared by all the shards, which must agree on
+// the shard owning a key
+static uint64_t g_hash_seed = 0;
+
+static uint64_t str_hash(const uint8_t *data, size_t len) {
+    return hash_bytes(data, len, g_hash_seed); // get a unique hash value for a key, so that we can have uniform distribution in hashmap
+}
+
+// the policies of the keyspace map: the keys are looked up as views into the request, thus
+// looking up a key allocates nothing
+struct KeyHash {
+    uint64_t operator()(Slice key) const {
+        return str_hash(key.ptr, key.len);
+    }
 };
 
+struct EntryEq {
+    bool operator()(const Entry *entry, Slice key) const {
+        return entry->key_len == key.len && memcmp(entry_bytes(entry), key.ptr, key.len) == 0;
+    }
+};
 
-// the datastructure for key spaces 
-static struct {
-    HashMap db;
+typedef HMap<Entry, KeyHash, EntryEq> Db;
+
+// a key which may be evicted, found by sampling. It is only a hint: the key may be gone by
+// the time it is the best one, then it is no longer in the map, which is checked by looking
+// its node up without touching the entry
+struct EvictCand {
+    uint64_t score = 0; // higher is evicted first: idle time (LRU), 255 - counter (LFU)
+    Entry *entry = NULL;
+    uint64_t hcode = 0;
+};
+
+// the datastructure for key spaces, every reactor thread owns its own shard of the keys
+static thread_local struct {
+    Db db;
+    // the deadlines of the keys which have one, the nearest first. An item refers to the
+    // expire_pos of its Entry, thus the Entry is found from the item and the other way round
+    Heap expires;
+    uint64_t expired_active = 0; // removed by process_expire()
+    uint64_t expired_lazy = 0; // found past their deadline by a command
+    uint64_t mem = 0; // bytes of the entries and of their big values, see entry_mem()
+    std::vector<EvictCand> evict_pool; // the best keys to evict seen so far, the best last
+    uint64_t evicted = 0;
+    uint64_t oom_rejected = 0; // writes refused, nothing could be evicted
+    uint64_t hits = 0; // keys which GET and MGET found
+    uint64_t misses = 0;
+    uint64_t rnd = 0; // xorshift state of the sampling, seeded on first use
 } g_data;
 
+// figures of the keyspace shard of every reactor thread, published by its loop once per
+// iteration, the stats command sums them
+struct DbStats {
+    std::atomic<uint64_t> keys{0};
+    std::atomic<uint64_t> slots{0}; // of both tables while resizing
+    std::atomic<uint64_t> rehash_left{0}; // keys still in the old table
+    std::atomic<uint64_t> grows{0};
+    std::atomic<uint64_t> shrinks{0};
+    std::atomic<uint64_t> moved{0};
+    std::atomic<uint64_t> rehash_ns{0};
+    std::atomic<uint64_t> expires{0}; // keys with a deadline
+    std::atomic<uint64_t> expired_active{0};
+    std::atomic<uint64_t> expired_lazy{0};
+    std::atomic<uint64_t> used_memory{0}; // see db_used()
+    std::atomic<uint64_t> evicted{0};
+    std::atomic<uint64_t> oom_rejected{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+};
+
+static std::mutex g_db_stats_mu;
+static std::vector<DbStats *> g_db_stats; // of all the threads, never freed
+static thread_local DbStats *t_db_stats = NULL;
+
+// moving the keys of a resize of the keyspace outside of the requests: a little on every
+// iteration of the event loop, so that a load of reads alone finishes it as well, and more
+// when the loop had nothing to do
+static const uint64_t REHASH_TICK_NS = 20 * 1000;
+static const uint64_t REHASH_IDLE_NS = 1000 * 1000;
+
+// removing the keys past their deadline, the same way: for a while on every iteration, thus
+// many keys which expire in the same second are removed over several iterations instead of
+// stalling the requests, and a command which finds one of them before removes it right away
+static const uint64_t EXPIRE_TICK_NS = 25 * 1000;
+static const uint64_t EXPIRE_IDLE_NS = 1000 * 1000;
+static const size_t EXPIRE_CLOCK_STEP = 32; // keys removed between two reads of the clock
+
+// what a write does once the shard holds its share of maxmemory (--maxmemory-policy), as in
+// redis: evict keys by an approximation of LRU or LFU, among all the keys or only the ones with
+// a deadline, or refuse the writes which add memory
+enum {
+    EVICT_NOEVICTION = 0,
+    EVICT_ALLKEYS_LRU = 1,
+    EVICT_ALLKEYS_LFU = 2,
+    EVICT_VOLATILE_LRU = 3,
+    EVICT_VOLATILE_LFU = 4,
+};
+
+static const char *const EVICT_POLICIES[] = {
+    "noeviction", "allkeys-lru", "allkeys-lfu", "volatile-lru", "volatile-lfu",
+};
+
+static const size_t EVICT_SAMPLES = 5; // keys sampled for every key evicted, like maxmemory-samples
+static const size_t EVICT_POOL = 16; // best candidates kept between evictions
+static const size_t EVICT_MAX_KEYS = 32; // evicted by one write at most, the next writes go on
+static const uint64_t LRU_CLOCK_MS = 100; // resolution of the LRU clock, 32 bits of it wrap after 13 years
+static const uint32_t LFU_INIT = 5; // counter of a new key, which thus is not the first to go
+static const uint32_t LFU_LOG_FACTOR = 10; // the counter saturates after ~1M accesses
+static const uint32_t LFU_DECAY_MIN = 1; // minutes idle which take one off the counter
+
+// settings picked at startup from the command line
+static struct {
+    bool io_uring = false; // io_uring backend instead of epoll
+    uint32_t threads = 1; // reactor threads, each owns one shard of the keyspace
+    uint32_t max_request = 512 * 1024 * 1024; // largest request frame accepted (like proto-max-bulk-len)
+    uint64_t idle_timeout = 0; // ms, close a connection idle for this long, 0 never (like redis)
+    std::vector<int> cpus; // pin reactor i to cpus[i % cpus.size()], empty means no pinning
+    bool thp = false; // the slabs of the entries on transparent huge pages
+    uint64_t maxmemory = 0; // bytes of keys, values and tables, split evenly among the shards, 0 means no limit
+    uint32_t evict_policy = EVICT_NOEVICTION;
+    uint32_t proto = PROTO_NONE; // of every connection, PROTO_NONE tells it from the first bytes
+} g_config;
+
+/// @brief the largest custom frame accepted: while the protocol is detected a larger one could
+/// pass for a RESP request (see detect_protocol()), --protocol custom lifts it to max_request
+static uint32_t custom_max_request() {
+    if (g_config.proto == PROTO_NONE) {
+        return std::min(g_config.max_request, DETECT_CUSTOM_MAX);
+    }
+    return g_config.max_request;
+}
+
+// a request forwarded to the shard owning its key, the owner executes it, puts the response
+// frame in res and sends the same message back to the origin
+struct Gather;
+
+struct ShardMsg {
+    Conn *conn = NULL; // connection waiting for the response, only touched by the origin
+    Gather *gather = NULL; // a part of a multi key request, instead of data and res
+    uint32_t from = 0; // origin shard
+    bool reply = false;
+    bool failed = false; // the owner could not execute it (bad request)
+    uint32_t proto = PROTO_CUSTOM; // of the origin connection, the owner replies in it
+    Buffer data; // the arguments of the request, encoded as in the custom protocol
+    OutQueue res; // the response frame, spliced into the output queue of conn
+};
+
+// a reactor thread: its epoll loop, its connections and its mailboxes, queue inbox[i] is
+// written only by shard i, and only this shard reads it (single producer single consumer)
+struct Shard {
+    uint32_t id = 0;
+    int epfd = -1;
+    int efd = -1; // eventfd, written by the other shards once they have put mail in inbox
+    std::vector<Conn *> fd_to_conn; // a map of all client connection, keyed by fd 
+    std::vector<SpscQueue *> inbox;
+    std::vector<std::deque<ShardMsg *>> backlog; // mail for shard i while its inbox is full
+    std::vector<bool> wake; // shards which got mail during this iteration
+    std::vector<Conn *> touched; // connections to flush at the end of this iteration
+    // over its share of maxmemory with nothing to evict, as of the end of its last loop
+    // iteration: the writes scattered to it are refused by the origin (see shard_scatter())
+    std::atomic<bool> no_room{false};
+};
+
+static std::vector<Shard *> g_shards;
+static thread_local Shard *g_shard = NULL; // the reactor running on this thread
+
+// time keeping of a reactor thread, the clock is read once per loop iteration so that
+// requests do not pay for it
+static thread_local struct {
+    uint64_t now = 0; // ms, monotonic
+    DList idle; // connections ordered by last activity, the head times out first
+} g_timers;
+
+static uint64_t get_monotonic_ms() {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/// @brief the client did something: move conn to the back of the idle list, O(1)
+static void conn_activity(Conn *conn) {
+    conn->idle_start = g_timers.now;
+    dlist_detach(&conn->idle_node);
+    dlist_insert_before(&g_timers.idle, &conn->idle_node);
+}
+
+/// @brief how long the event loop may sleep, i.e. until the nearest deadline
+/// @return ms, -1 if there is no deadline at all
+static int next_timer_ms() {
+    if (g_data.db.map.ht2.size > 0) {
+        return 0; // a resize is going on, it goes on as soon as the loop is idle
+    }
+    uint64_t deadline = UINT64_MAX;
+    if (g_data.expires.len > 0) {
+        deadline = heap_at(&g_data.expires, 0).val; // the nearest key to expire
+    }
+    if (g_config.idle_timeout != 0 && !dlist_empty(&g_timers.idle)) {
+        Conn *conn = get_outer_wrapper_of_hnode(g_timers.idle.next, Conn, idle_node);
+        deadline = std::min(deadline, conn->idle_start + g_config.idle_timeout);
+    }
+    if (deadline == UINT64_MAX) {
+        return -1;
+    }
+    if (deadline <= g_timers.now) {
+        return 0;
+    }
+    uint64_t wait = deadline - g_timers.now;
+    return wait > INT32_MAX ? INT32_MAX : (int)wait;
+}
+
+/// @brief run the timers which are due: hand every connection idle for longer than the 
+/// timeout to reap(), which must take it off the idle list. Only the expired ones are looked at
+/// @param reap : closes a connection, it differs between the epoll and the io_uring loop
+static void process_timers(void (*reap)(Conn *)) {
+    g_timers.now = get_monotonic_ms();
+    if (g_config.idle_timeout == 0) {
+        return;
+    }
+    while (!dlist_empty(&g_timers.idle)) {
+        Conn *conn = get_outer_wrapper_of_hnode(g_timers.idle.next, Conn, idle_node);
+        if (conn->idle_start + g_config.idle_timeout > g_timers.now) {
+            break; // the rest of the list is more recent
+        }
+        reap(conn);
+    }
+}
+
+static uint64_t table_slots(const HashTable *t) {
+    return t->mask ? t->mask + 1 : 0; // no table at all
+}
+
+/// @brief the memory of the shard which counts against maxmemory: the entries, their big values,
+/// the tables and the expiry heap
+static uint64_t db_used() {
+    return g_data.mem + hmap_bytes(&g_data.db) + g_data.expires.chunks.size() * HEAP_CHUNK * sizeof(HeapItem);
+}
+
+/// @brief the shard is over its share of maxmemory and has no key it may evict
+static bool db_no_room() {
+    if (g_config.maxmemory == 0 || db_used() <= g_config.maxmemory / g_config.threads) {
+        return false;
+    }
+    bool is_volatile = g_config.evict_policy == EVICT_VOLATILE_LRU || g_config.evict_policy == EVICT_VOLATILE_LFU;
+    return g_config.evict_policy == EVICT_NOEVICTION || (is_volatile && g_data.expires.len == 0);
+}
+
+/// @brief move keys of an ongoing resize of the keyspace, then publish the figures of the shard
+/// @param idle : the loop had no event this time, it may spend more time on it
+static void process_rehash(bool idle) {
+    HashMap *db = &g_data.db.map;
+    hmap_rehash(&g_data.db, idle ? REHASH_IDLE_NS : REHASH_TICK_NS);
+    if (!t_db_stats) {
+        t_db_stats = new DbStats();
+        std::lock_guard<std::mutex> lock(g_db_stats_mu);
+        g_db_stats.push_back(t_db_stats);
+    }
+    DbStats *ds = t_db_stats;
+    ds->keys.store(db->ht1.size + db->ht2.size, std::memory_order_relaxed);
+    ds->slots.store(table_slots(&db->ht1) + table_slots(&db->ht2), std::memory_order_relaxed);
+    ds->rehash_left.store(db->ht2.size, std::memory_order_relaxed);
+    ds->grows.store(db->grows, std::memory_order_relaxed);
+    ds->shrinks.store(db->shrinks, std::memory_order_relaxed);
+    ds->moved.store(db->moved, std::memory_order_relaxed);
+    ds->rehash_ns.store(db->rehash_ns, std::memory_order_relaxed);
+    ds->expires.store(g_data.expires.len, std::memory_order_relaxed);
+    ds->expired_active.store(g_data.expired_active, std::memory_order_relaxed);
+    ds->expired_lazy.store(g_data.expired_lazy, std::memory_order_relaxed);
+    ds->used_memory.store(db_used(), std::memory_order_relaxed);
+    ds->evicted.store(g_data.evicted, std::memory_order_relaxed);
+    ds->oom_rejected.store(g_data.oom_rejected, std::memory_order_relaxed);
+    ds->hits.store(g_data.hits, std::memory_order_relaxed);
+    ds->misses.store(g_data.misses, std::memory_order_relaxed);
+    if (g_shard) {
+        g_shard->no_room.store(db_no_room(), std::memory_order_relaxed);
+    }
+}
+
+
+/// @brief responses are small and written one after another, do not let Nagle hold them back
+/// @param fd : of the connection
+static void set_fd_no_delay(int fd) {
+    int val = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+}
+
+/// @brief the epoll interest a connection needs in its current state, reading requests only
+/// in STATE_REQ, and waiting for the socket to drain while the output queue is not empty
+/// @param conn : connection object
+/// @return EPOLLIN and / or EPOLLOUT, or 0
+static uint32_t conn_interest(Conn *conn) {
+    uint32_t events = conn->out.bytes ? (uint32_t)EPOLLOUT : 0; // the socket was full at the last flush
+    if (conn->state == STATE_REQ) {
+        events |= EPOLLIN;
+    }
+    return events;
+}
+
+/// @brief The fd is registered once with epoll (in accept_new_connection), after that we only
+/// touch the interest set when the connection starts or stops reading or writing,
+/// thus an idle connection costs nothing per event loop iteration
+/// @param epfd : epoll instance
+/// @param conn : connection whose state may have changed
+static void conn_update_interest(int epfd, Conn *conn) {
+    uint32_t events = conn_interest(conn);
+    if (events == conn->events) {
+        return; // nothing changed, no syscall
+    }
+    struct epoll_event ev = {};
+    ev.events = events; // EPOLLERR and EPOLLHUP are always reported, no need to ask
+    ev.data.fd = conn->fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev)) {
+        die("epoll_ctl() mod");
+    }
+    conn->events = events;
+}
+
+// free Conn objects of this reactor thread, they are carved out of slabs of CONN_SLAB and are
+// reused by the next connections instead of going back to malloc, a connection storm then
+// allocates once per slab and a reconnect costs no allocation at all
+static thread_local struct {
+    std::vector<Conn *> free;
+    size_t slabs = 0;
+} g_conn_pool;
+
+/// @brief take a Conn from the pool of this thread
+/// @return NULL if out of memory
+static Conn *conn_alloc() {
+    if (g_conn_pool.free.empty()) {
+        Conn *slab = (Conn *)malloc(CONN_SLAB * sizeof(Conn));
+        if (!slab) {
+            return NULL;
+        }
+        g_conn_pool.slabs++;
+        for (size_t i = CONN_SLAB; i-- > 0; ) {
+            g_conn_pool.free.push_back(&slab[i]);
+        }
+    }
+    Conn *conn = g_conn_pool.free.back();
+    g_conn_pool.free.pop_back();
+    return conn;
+}
+
+/// @brief give a Conn back to the pool of this thread, its buffers must be released already
+static void conn_release(Conn *conn) {
+    g_conn_pool.free.push_back(conn);
+}
+
+/// @brief setup a freshly allocated connection object, the buffers get memory on first use
+static void conn_init(Conn *conn, int fd) {
+    conn->fd = fd;
+    conn->state = STATE_REQ;
+    conn->events = 0;
+    conn->touched = false;
+    conn->forwarded = false;
+    conn->proto = g_config.proto;
+    conn->resp = RespParser{};
+    conn->read_buffer = Buffer{};
+    conn->out = OutQueue{};
+    conn->idle_start = g_timers.now;
+    dlist_init(&conn->idle_node);
+    dlist_insert_before(&g_timers.idle, &conn->idle_node);
+}
 
 /// @brief Whenever a new client join, then this function is called, this is first time connection
 /// @param fd_to_conn : Here we will store the connection object mapped by the fd opened for that connection 
+/// @param epfd : epoll instance to which the new connection fd is registered
 /// @param fd : fd of the server, used by accept syscall to accept the connection from client
-/// @return success or failure, whether client successfully connect or fails
-static int32_t accept_new_connection(std::vector<Conn* >& fd_to_conn, int fd) {
-    // accept a new connection 
-    struct sockaddr_in client_addr = {};
-    socklen_t socklen = sizeof(client_addr);
-    int conn_fd = accept(fd, (struct sockaddr*)& client_addr, &socklen);
+/// @return 0 if we may accept again, -1 if the backlog is empty or accepting fails for now
+static int32_t accept_new_connection(std::vector<Conn* >& fd_to_conn, int epfd, int fd) {
+    // accept a new connection, already non-blocking
+    int conn_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK);
     if (conn_fd < 0) {
-        msg("accept() error");
+        if (errno == ECONNABORTED || errno == EINTR) {
+            return 0; // this one is gone, there may be more
+        }
+        if (errno != EAGAIN) {
+            msg("accept() error"); // e.g. out of fds, the listener is reported again later
+        }
         return -1;
     }
-    // set this new conn_fd to non-blocking
-    set_fd_to_non_blocking(conn_fd);
+    set_fd_no_delay(conn_fd);
     // create a conn object 
-    struct Conn *conn = (struct Conn*) malloc (sizeof(struct Conn));
+    struct Conn *conn = conn_alloc();
     if (!conn) {
         close(conn_fd);
         return -1;
     }
 
-    conn->fd = conn_fd;
-    conn->state = STATE_REQ;
-    conn->read_buffer_size = 0;
-    conn->write_buffer_sent = 0;
-    conn->write_buffer_size = 0;
+    conn_init(conn, conn_fd);
+    conn->events = conn_interest(conn);
+
+    // register once, later on only the interest is modified
+    struct epoll_event ev = {};
+    ev.events = conn->events;
+    ev.data.fd = conn_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, conn_fd, &ev)) {
+        msg("epoll_ctl() add error");
+        close(conn_fd);
+        dlist_detach(&conn->idle_node);
+        conn_release(conn); // buffers are still empty
+        return -1;
+    }
 
     if (fd_to_conn.size() <= (size_t)conn->fd) {
         fd_to_conn.resize(conn->fd + 1);
     }
     fd_to_conn[conn->fd] = conn;
-    printf ("Accepted a new connection!\n");
     return 0;
 }
 
+/// @brief drain the accept backlog, up to ACCEPT_BUDGET connections so that a connection storm
+/// does not starve the clients which are already connected. The listener is level triggered,
+/// thus whatever is left is reported again by the next epoll_wait()
+static void accept_connections(std::vector<Conn* >& fd_to_conn, int epfd, int fd) {
+    for (size_t i = 0; i < ACCEPT_BUDGET; i++) {
+        if (accept_new_connection(fd_to_conn, epfd, fd)) {
+            break;
+        }
+    }
+}
 
-static void state_res(Conn *conn);
-static void state_req(Conn *conn);
 
-/// @brief used to parse the request, we are using a protocol to send the request
-/// @param raw_request : obtained from the client.
-/// @param end_pos : The total length of the request.
-/// @param parsed_request : Final parsed request which server can understand.
-/// @return whether parsable ? success(0) or failure (-1)
-static int32_t parse_request(
-    const uint8_t *raw_request, 
-    size_t end_pos, 
-    std::vector<std::string>& parsed_request
-) {
-    if (end_pos < 4) {
-        return -1;
-    } 
-    uint32_t len_of_request = 0;
-    memcpy(&len_of_request, &raw_request[0], 4); // read first 4 bytes, i.e total number of string in request 
 
-    size_t cur_pos = 4; // iterator at which position we have readed from the raw request 
+/// @brief the deadline of a key, ms as g_timers.now, 0 if it has none
+static uint64_t expire_at(const Entry *entry) {
+    return entry->expire_pos ? heap_at(&g_data.expires, entry->expire_pos - 1).val : 0;
+}
 
-    while (len_of_request--) {
-        if (cur_pos + 4 > end_pos) {
-            return -1;
-        }
-        uint32_t size_of_command = 0;
-        memcpy(&size_of_command, &raw_request[cur_pos], 4);
-        if (cur_pos + 4 + size_of_command > end_pos) {
-            return -1; // we are exceeding the final length, and string is still not covered in that length, some issue 
+/// @brief give the key a deadline, or move the one it has
+static void expire_set(Entry *entry, uint64_t at) {
+    if (entry->expire_pos) {
+        heap_at(&g_data.expires, entry->expire_pos - 1).val = at;
+        heap_update(&g_data.expires, entry->expire_pos - 1);
+        return;
+    }
+    HeapItem item;
+    item.val = at;
+    item.ref = &entry->expire_pos;
+    if (!heap_push(&g_data.expires, item)) {
+        die("out of memory");
+    }
+}
+
+/// @brief drop the deadline of a key
+static void expire_clear(Entry *entry) {
+    if (entry->expire_pos) {
+        heap_remove(&g_data.expires, entry->expire_pos - 1);
+    }
+}
+
+static bool expire_due(const Entry *entry) {
+    return entry->expire_pos && heap_at(&g_data.expires, entry->expire_pos - 1).val <= g_timers.now;
+}
+
+/// @brief free an entry which is out of the map, with its deadline
+static void key_del(Entry *entry) {
+    expire_clear(entry);
+    g_data.mem -= entry_mem(entry);
+    entry_del(entry);
+}
+
+static bool policy_lfu() {
+    return g_config.evict_policy == EVICT_ALLKEYS_LFU || g_config.evict_policy == EVICT_VOLATILE_LFU;
+}
+
+static uint64_t evict_rand() {
+    if (g_data.rnd == 0) {
+        g_data.rnd = hash_seed_random() | 1;
+    }
+    g_data.rnd ^= g_data.rnd << 13;
+    g_data.rnd ^= g_data.rnd >> 7;
+    g_data.rnd ^= g_data.rnd << 17;
+    return g_data.rnd;
+}
+
+// Entry::access holds, like the 24 bits of redis, for LRU the time of the last access in
+// LRU_CLOCK_MS, and for LFU the minute of the last access (16 bits) and a counter (8 bits) which
+// grows with the log of the accesses and drops while the key is idle
+
+static uint32_t lru_clock() {
+    return (uint32_t)(g_timers.now / LRU_CLOCK_MS);
+}
+
+static uint32_t lfu_minutes() {
+    return (uint32_t)(g_timers.now / 60000) & 0xFFFF;
+}
+
+/// @brief the LFU counter of a key, less the minutes it has been idle
+static uint32_t lfu_counter(const Entry *entry) {
+    uint32_t counter = entry->access & 0xFF;
+    uint32_t periods = ((lfu_minutes() - (entry->access >> 8)) & 0xFFFF) / LFU_DECAY_MIN;
+    return periods > counter ? 0 : counter - periods;
+}
+
+/// @brief the access data of a new key
+static void key_born(Entry *entry) {
+    entry->access = policy_lfu() ? lfu_minutes() << 8 | LFU_INIT : lru_clock();
+}
+
+/// @brief a command used the key
+static void key_touch(Entry *entry) {
+    if (!policy_lfu()) {
+        entry->access = lru_clock();
+        return;
+    }
+    uint32_t counter = lfu_counter(entry);
+    uint32_t base = counter > LFU_INIT ? counter - LFU_INIT : 0;
+    if (counter < 255 && evict_rand() % (base * LFU_LOG_FACTOR + 1) == 0) {
+        counter++; // with a chance of 1 / (base * LFU_LOG_FACTOR + 1)
+    }
+    entry->access = lfu_minutes() << 8 | counter;
+}
+
+/// @brief take an entry out of the map and free it, it is found by its node, no key compare
+static void key_remove(Entry *entry) {
+    hm_pop(&g_data.db.map, entry->node.hcode, [entry](Hnode *node) { return node == &entry->node; });
+    key_del(entry);
+}
+
+/// @brief the entry of a key, a key past its deadline is removed and not found
+/// @param hcode : KeyHash of the key
+static Entry *key_lookup(Slice key, uint64_t hcode) {
+    Entry *entry = hmap_lookup(&g_data.db, key, hcode);
+    if (entry && expire_due(entry)) {
+        key_remove(entry);
+        g_data.expired_lazy++;
+        return NULL;
+    }
+    if (entry) {
+        key_touch(entry);
+    }
+    return entry;
+}
+
+static Entry *key_lookup(Slice key) {
+    return key_lookup(key, KeyHash()(key));
+}
+
+static uint64_t evict_score(const Entry *entry) {
+    if (policy_lfu()) {
+        return 255 - lfu_counter(entry);
+    }
+    return lru_clock() - entry->access;
+}
+
+/// @brief put a sampled key into the pool if it is better than the worst one there
+static void evict_pool_add(Entry *entry) {
+    std::vector<EvictCand> &pool = g_data.evict_pool;
+    EvictCand cand;
+    cand.score = evict_score(entry);
+    cand.entry = entry;
+    cand.hcode = entry->node.hcode;
+    if (pool.size() == EVICT_POOL && cand.score <= pool[0].score) {
+        return;
+    }
+    for (EvictCand &other : pool) {
+        if (other.entry == entry) {
+            return; // sampled again
         }
-        parsed_request.push_back(std::string((char *)&raw_request[cur_pos + 4], size_of_command));
-        cur_pos += 4 + size_of_command;
     }
-    if (cur_pos != end_pos) {
-        return -1; 
+    pool.insert(std::upper_bound(pool.begin(), pool.end(), cand,
+        [](const EvictCand &a, const EvictCand &b) { return a.score < b.score; }), cand);
+    if (pool.size() > EVICT_POOL) {
+        pool.erase(pool.begin());
     }
-    return 0; // success in parse 
 }
 
-static bool is_same(const std::string &word, const char *cmd) {
-    return strcasecmp(word.c_str(), cmd) == 0;
+/**
+ * @brief evict one key, the way redis approximates LRU and LFU: a few keys picked at random are
+ * put into the pool of the best candidates seen so far, then the best of the pool goes. A key
+ * of the pool which is gone since is skipped, as is one which lost its deadline (volatile-*)
+ * @return false if there is nothing to evict
+ */
+static bool evict_one() {
+    bool is_volatile = g_config.evict_policy == EVICT_VOLATILE_LRU || g_config.evict_policy == EVICT_VOLATILE_LFU;
+    Entry *sample[EVICT_SAMPLES];
+    size_t n = 0;
+    if (!is_volatile) {
+        n = hmap_sample(&g_data.db, evict_rand(), sample, EVICT_SAMPLES);
+    }
+    else if (g_data.expires.len > 0) {
+        for (; n < EVICT_SAMPLES; n++) {
+            HeapItem &item = heap_at(&g_data.expires, evict_rand() % g_data.expires.len);
+            sample[n] = get_outer_wrapper_of_hnode(item.ref, Entry, expire_pos);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        evict_pool_add(sample[i]);
+    }
+    std::vector<EvictCand> &pool = g_data.evict_pool;
+    while (!pool.empty()) {
+        EvictCand cand = pool.back();
+        pool.pop_back();
+        Entry *entry = cand.entry;
+        if (!hm_lookup(&g_data.db.map, cand.hcode, [entry](Hnode *node) { return node == &entry->node; })) {
+            continue;
+        }
+        if (is_volatile && !entry->expire_pos) {
+            continue; // PERSIST dropped its deadline since it was sampled
+        }
+        key_remove(entry);
+        g_data.evicted++;
+        return true;
+    }
+    return false;
 }
 
-/// @brief to check if both lhs and rhs are same or different
-/// @param lhs type of Hnode
-/// @param rhs type of Hnode
-/// @return boolean value, true if same, else false 
-static bool comparator_function(Hnode *lhs, Hnode *rhs) {
-    struct Entry *le = get_outer_wrapper_of_hnode(lhs, struct Entry, node);
-    struct Entry *re = get_outer_wrapper_of_hnode(rhs, struct Entry, node);
-    return lhs->hcode == rhs->hcode && le->key == re->key;
+/**
+ * @brief make room before a write which may add memory: evict keys until the shard is under its
+ * share of maxmemory, at most EVICT_MAX_KEYS of them, thus the cost of a write is bounded and a
+ * large value is made room for by the next writes
+ * @return false if the shard is over and nothing could be evicted, the write is refused then
+ */
+static bool evict_for_write() {
+    if (g_config.maxmemory == 0) {
+        return true;
+    }
+    uint64_t limit = g_config.maxmemory / g_config.threads;
+    size_t n = 0;
+    while (db_used() > limit && g_config.evict_policy != EVICT_NOEVICTION && n < EVICT_MAX_KEYS && evict_one()) {
+        n++;
+    }
+    return n > 0 || db_used() <= limit;
 }
 
-/// @brief 
-/// @param data 
-/// @param len 
-/// @return 
-static uint64_t str_hash(const uint8_t *data, size_t len) {
-    uint32_t h = 0x811C9DC5; // a random prime ? 
-    for (size_t i = 0; i < len; i++) {
-        h = (h + data[i]) * 0x01000193;
+/// @brief remove the keys past their deadline, the nearest first, for up to budget_ns
+/// @param idle : the loop had no event this time, it may spend more time on it
+static void process_expire(bool idle) {
+    Heap *heap = &g_data.expires;
+    if (heap->len == 0 || heap_at(heap, 0).val > g_timers.now) {
+        return;
+    }
+    uint64_t budget_ns = idle ? EXPIRE_IDLE_NS : EXPIRE_TICK_NS;
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t start = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    for (size_t n = 1; heap->len > 0 && heap_at(heap, 0).val <= g_timers.now; n++) {
+        key_remove(get_outer_wrapper_of_hnode(heap_at(heap, 0).ref, Entry, expire_pos));
+        g_data.expired_active++;
+        if (n % EXPIRE_CLOCK_STEP == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            if ((uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec - start >= budget_ns) {
+                break; // the rest goes in the next iterations, the loop does not sleep meanwhile
+            }
+        }
     }
-    return h; // get a unique hash value for a key, so that we can have uniform distribution in hashmap
 }
 
+static const char *const ERR_WRONGTYPE = "WRONGTYPE Operation against a key holding the wrong kind of value";
 
 /**
  * @brief get api for the REDIS server, client send the get request with the key
@@ -206,208 +775,1172 @@ static uint64_t str_hash(const uint8_t *data, size_t len) {
  * hashmap and once we have that we are asking for the address of the it's outer container
  * Thus we get the access to the wrapper outside of Hnode i.e Entry and now we can have 
  * the val field
- * @param parsed_request : Parsed request which parse_request() returned
- * @param res : response to the client to the get request
- * @param res_len : length of response 
- * @return uint32_t : ENUM type for response (success / failure)
+ * @param args : Parsed request which parse_request() returned
+ * @param res : response to the client to the get request, the value or nil
  */
-static uint32_t get(std::vector<std::string>& parsed_request, 
-    uint8_t *res, 
-    uint32_t *res_len
-) {
+static void get(Args *args, Reply *res) {
 
-    Entry cur;
-    cur.key.swap(parsed_request[1]); // the key which we have passed, get[0] key[1]
-    cur.node.hcode = str_hash((uint8_t *)cur.key.data(), cur.key.size());
-    printf ("reached\n");
-    Hnode *node = hashmap_lookup(&g_data.db, &cur.node, &comparator_function);
-    if (!node) {
-        return RES_NX;
+    Entry *entry = key_lookup(args->v[1]); // the key which we have passed, get[0] key[1]
+    if (!entry) {
+        g_data.misses++;
+        reply_nil(res);
+        return;
+    }
+    g_data.hits++;
+    if (entry->type != ENTRY_STR) {
+        reply_err(res, ERR_WRONGTYPE);
+        return;
     }
 
-    const std::string &val = get_outer_wrapper_of_hnode(node, Entry, node)->val;
-    assert(val.size() <= MSG_MAX_LEN);
-    memcpy(res, val.data(), val.size());
-    *res_len = (uint32_t)val.size();
-    return RES_OK;
+    if (entry->big) {
+        // a large value is not copied, the response references it until it is sent
+        reply_ref(res, entry->big);
+        return;
+    }
+    Slice val = entry_val(entry);
+    reply_str(res, val.ptr, val.len);
+}
+
+/// @brief store val under the key, entry is its entry if it exists already. Like in redis the
+/// deadline of the key is dropped, unless keep_ttl
+/// @param hcode : KeyHash of the key
+/// @return the entry of the key now
+static Entry *set_key(Slice key, uint64_t hcode, Entry *entry, Slice val, bool keep_ttl = false) {
+    // if this already exists, then update in place if the value fits
+    size_t mem = entry ? entry_mem(entry) : 0;
+    if (entry && entry_set_val(entry, val)) {
+        if (!keep_ttl) {
+            expire_clear(entry);
+        }
+        g_data.mem += entry_mem(entry) - mem;
+        return entry;
+    }
+    // else a new entry takes its place, the only copies: the key and the value
+    Entry *fresh_entry = entry_new(key, hcode, val);
+    if (!fresh_entry) {
+        die("out of memory");
+    }
+    key_born(fresh_entry);
+    g_data.mem += entry_mem(fresh_entry);
+    if (entry) {
+        fresh_entry->access = entry->access;
+        if (keep_ttl && entry->expire_pos) {
+            expire_set(fresh_entry, expire_at(entry));
+        }
+        hmap_pop(&g_data.db, key, hcode);
+        key_del(entry);
+    }
+    hmap_insert(&g_data.db, fresh_entry);
+    return fresh_entry;
+}
+
+/// @brief a decimal integer argument, e.g. the seconds of EXPIRE
+/// @return false if it is not one or does not fit
+static bool arg_int(Slice arg, int64_t *out) {
+    size_t i = 0;
+    bool neg = arg.len > 0 && arg.ptr[0] == '-';
+    if (neg) {
+        i = 1;
+    }
+    if (i == arg.len || arg.len - i > 18) {
+        return false; // 18 digits always fit, no overflow check needed
+    }
+    int64_t v = 0;
+    for (; i < arg.len; i++) {
+        if (arg.ptr[i] < '0' || arg.ptr[i] > '9') {
+            return false;
+        }
+        v = v * 10 + (arg.ptr[i] - '0');
+    }
+    *out = neg ? -v : v;
+    return true;
+}
+
+/// @brief the deadline of a key which expires in the given seconds or ms from now
+/// @param unit : 1000 for seconds, 1 for ms
+/// @return false if it does not fit a deadline
+static bool expire_deadline(int64_t n, uint64_t unit, int64_t *at) {
+    if (n > (int64_t)((INT64_MAX - g_timers.now) / unit) || n < -(int64_t)((INT64_MAX - g_timers.now) / unit)) {
+        return false;
+    }
+    *at = (int64_t)g_timers.now + n * (int64_t)unit;
+    return true;
 }
 
 /**
  * @brief set the value of the given key
  * 
- * @param parsed_request 
- * @param res : response (null)
- * @param res_len : response length
- * @return uint32_t : response status 
+ * @param args 
+ * @param res : response (OK)
  */
-static uint32_t set(std::vector<std::string> &parsed_request, 
-    uint8_t *res, 
-    uint32_t *res_len 
-) {
-    (void)res;
-    (void)res_len;
-
-    Entry cur; // simply created a structure instance
-    cur.key.swap(parsed_request[1]); // set[0], key[1], value[2]
-    cur.node.hcode = str_hash((uint8_t *)cur.key.data(), cur.key.size());
-
-    Hnode *node = hashmap_lookup(&g_data.db, &cur.node, &comparator_function);
-    if (node) {
-        // if this already exists, then update
-        get_outer_wrapper_of_hnode(node, Entry, node)->val.swap(parsed_request[2]);
+static void set(Args *args, Reply *res) {
+
+    Slice key = args->v[1]; // set[0], key[1], value[2], then EX seconds, PX ms or KEEPTTL
+    int64_t at = 0;
+    bool keep_ttl = false;
+    for (size_t i = 3; i < args->n; i++) {
+        Slice opt = args->v[i];
+        bool ex = slice_is(opt, "ex");
+        if ((ex || slice_is(opt, "px")) && i + 1 < args->n && at == 0 && !keep_ttl) {
+            int64_t n = 0;
+            if (!arg_int(args->v[++i], &n) || n <= 0 || !expire_deadline(n, ex ? 1000 : 1, &at)) {
+                reply_err(res, "invalid expire time in 'set' command");
+                return;
+            }
+        }
+        else if (slice_is(opt, "keepttl") && at == 0) {
+            keep_ttl = true;
+        }
+        else {
+            reply_err(res, "syntax error");
+            return;
+        }
+    }
+    uint64_t hcode = KeyHash()(key);
+    Entry *entry = set_key(key, hcode, key_lookup(key, hcode), args->v[2], keep_ttl);
+    if (at) {
+        expire_set(entry, (uint64_t)at);
+    }
+    reply_ok(res);
+}
+
+/// @brief EXPIRE and PEXPIRE: a deadline in the past removes the key right away
+/// @param unit : ms of the time argument
+static void expire_cmd(Args *args, Reply *res, uint64_t unit) {
+    int64_t n = 0;
+    int64_t at = 0;
+    if (!arg_int(args->v[2], &n) || !expire_deadline(n, unit, &at)) {
+        reply_err(res, "value is not an integer or out of range");
+        return;
+    }
+    Entry *entry = key_lookup(args->v[1]);
+    if (!entry) {
+        reply_int(res, 0);
+        return;
+    }
+    if (at <= (int64_t)g_timers.now) {
+        key_remove(entry);
     }
     else {
-        // if this is the first entry, then insert
-        // Also does this mean the entry is just floating in the memory ? 
-        Entry *fresh_entry = new Entry(); // allocated memory on heap
-        fresh_entry->node.hcode = cur.node.hcode; // setup the node
-        fresh_entry->key.swap(cur.key); // key
-        fresh_entry->val.swap(parsed_request[2]); // value 
-        hashmap_insert(&g_data.db, &fresh_entry->node);
+        expire_set(entry, (uint64_t)at);
+    }
+    reply_int(res, 1);
+}
+
+/// @brief EXPIRE key seconds
+/// @param res : 1 if the key has the deadline, 0 if there is no such key
+static void expire(Args *args, Reply *res) {
+    expire_cmd(args, res, 1000);
+}
+
+/// @brief PEXPIRE key ms
+static void pexpire(Args *args, Reply *res) {
+    expire_cmd(args, res, 1);
+}
+
+/// @brief TTL and PTTL: the time the key has left, -1 if it has no deadline, -2 if no such key
+/// @param unit : ms of the reply, the seconds are rounded
+static void ttl_cmd(Args *args, Reply *res, uint64_t unit) {
+    Entry *entry = key_lookup(args->v[1]);
+    if (!entry) {
+        reply_int(res, -2);
+        return;
+    }
+    if (!entry->expire_pos) {
+        reply_int(res, -1);
+        return;
+    }
+    uint64_t left = expire_at(entry) - g_timers.now; // in the future, else it was not found
+    reply_int(res, (int64_t)((left + unit / 2) / unit));
+}
+
+static void ttl(Args *args, Reply *res) {
+    ttl_cmd(args, res, 1000);
+}
+
+static void pttl(Args *args, Reply *res) {
+    ttl_cmd(args, res, 1);
+}
+
+/// @brief PERSIST key: drop the deadline of the key
+/// @param res : 1 if it had one, 0 if not or if there is no such key
+static void persist(Args *args, Reply *res) {
+    Entry *entry = key_lookup(args->v[1]);
+    bool had = entry && entry->expire_pos;
+    if (had) {
+        expire_clear(entry);
     }
-    return RES_OK;
+    reply_int(res, had ? 1 : 0);
 }
 
 /**
- * @brief delete is used to remove the key from the hashmap, we first remove using hashmap_pop()
+ * @brief delete is used to remove the key from the hashmap, we first remove using hmap_pop()
  * Note that hashmap is not for handling the garbage cleaning in heap for entry, that is done differently, 
  * neither entry is the owner
  * for the Hnode, instead that is properly handled and cleaned by hashmap
- * @param parsed_request : parsed request by parse_request() function
- * @param res : response code
- * @param res_len : response length
- * @return uint32_t : success of failure 
+ * @param args : parsed request by parse_request() function
+ * @param res : response, the number of keys removed (0 or 1)
+ */
+static void del(Args *args, Reply *res) {
+
+    Entry *entry = hmap_pop(&g_data.db, args->v[1]);
+
+    if (entry) {
+        if (expire_due(entry)) {
+            g_data.expired_lazy++; // it was gone already
+            key_del(entry);
+            entry = NULL;
+        }
+        else {
+            // clean the outer wrapper of Hnode, i.e Entry
+            key_del(entry);
+        }
+    }
+    if (res->proto == PROTO_CUSTOM) {
+        reply_ok(res); // the custom protocol always answered a DEL with an empty frame
+        return;
+    }
+    reply_int(res, entry ? 1 : 0);
+}
+
+/// @brief a score argument: a decimal or inf, +inf, -inf, as strtod() reads them, not NaN
+/// @return false if it is not one
+static bool arg_double(Slice arg, double *out) {
+    char text[64];
+    if (arg.len == 0 || arg.len >= sizeof(text)) {
+        return false;
+    }
+    memcpy(text, arg.ptr, arg.len);
+    text[arg.len] = 0;
+    char *end = NULL;
+    *out = strtod(text, &end);
+    return end == text + arg.len && !std::isnan(*out);
+}
+
+/**
+ * @brief the sorted set of a key for a read
+ * @param zset : the set, NULL if there is no such key
+ * @return false if the key holds another type, the error is replied then
+ */
+static bool zset_find(Slice key, Reply *res, ZSet **zset) {
+    Entry *entry = key_lookup(key);
+    *zset = NULL;
+    if (entry && entry->type != ENTRY_ZSET) {
+        reply_err(res, ERR_WRONGTYPE);
+        return false;
+    }
+    if (entry) {
+        *zset = entry->zset;
+    }
+    return true;
+}
+
+/**
+ * @brief ZADD key score member [score member ...]: add the members, or move them to the new
+ * score. All the scores are checked before the set is touched, thus a bad one changes nothing.
+ * A large batch has the tree built anew, see zset_add_many()
+ * @param res : the number of members added, the moved ones do not count
+ */
+static void zadd(Args *args, Reply *res) {
+    if ((args->n - 2) % 2 != 0) {
+        reply_err(res, "syntax error");
+        return;
+    }
+    std::vector<double> scores((args->n - 2) / 2);
+    for (size_t i = 0; i < scores.size(); i++) {
+        if (!arg_double(args->v[2 + 2 * i], &scores[i])) {
+            reply_err(res, "value is not a valid float");
+            return;
+        }
+    }
+    Slice key = args->v[1];
+    uint64_t hcode = KeyHash()(key);
+    Entry *entry = key_lookup(key, hcode);
+    if (entry && entry->type != ENTRY_ZSET) {
+        reply_err(res, ERR_WRONGTYPE);
+        return;
+    }
+    if (!entry) {
+        if (!(entry = entry_new_zset(key, hcode))) {
+            die("out of memory");
+        }
+        key_born(entry);
+        g_data.mem += entry_mem(entry);
+        hmap_insert(&g_data.db, entry);
+    }
+    std::vector<Slice> names(scores.size());
+    for (size_t i = 0; i < scores.size(); i++) {
+        names[i] = args->v[3 + 2 * i];
+    }
+    size_t mem = entry_mem(entry);
+    size_t added = 0;
+    if (!zset_add_many(entry->zset, names.data(), scores.data(), scores.size(), &added)) {
+        die("out of memory");
+    }
+    g_data.mem += entry_mem(entry) - mem;
+    reply_int(res, (int64_t)added);
+}
+
+/**
+ * @brief ZREM key member [member ...]: a set left empty is removed with its key, like redis
+ * @param res : the number of members removed
+ */
+static void zrem(Args *args, Reply *res) {
+    Entry *entry = key_lookup(args->v[1]);
+    if (entry && entry->type != ENTRY_ZSET) {
+        reply_err(res, ERR_WRONGTYPE);
+        return;
+    }
+    if (!entry) {
+        reply_int(res, 0);
+        return;
+    }
+    size_t mem = entry_mem(entry);
+    int64_t removed = 0;
+    for (size_t i = 2; i < args->n; i++) {
+        removed += zset_pop(entry->zset, args->v[i]);
+    }
+    g_data.mem += entry_mem(entry) - mem;
+    if (zset_len(entry->zset) == 0) {
+        key_remove(entry);
+    }
+    reply_int(res, removed);
+}
+
+/// @brief ZSCORE key member
+/// @param res : the score, nil if there is no such member
+static void zscore(Args *args, Reply *res) {
+    ZSet *zset = NULL;
+    if (!zset_find(args->v[1], res, &zset)) {
+        return;
+    }
+    ZNode *znode = zset ? zset_lookup(zset, args->v[2]) : NULL;
+    if (!znode) {
+        reply_nil(res);
+        return;
+    }
+    reply_dbl(res, znode->score);
+}
+
+/// @brief ZCARD key
+/// @param res : the number of members, 0 if there is no such key
+static void zcard(Args *args, Reply *res) {
+    ZSet *zset = NULL;
+    if (!zset_find(args->v[1], res, &zset)) {
+        return;
+    }
+    reply_int(res, zset ? (int64_t)zset_len(zset) : 0);
+}
+
+/// @brief ZRANK key member: the position of the member from the lowest score, O(log n)
+/// @param res : from 0, nil if there is no such member
+static void zrank(Args *args, Reply *res) {
+    ZSet *zset = NULL;
+    if (!zset_find(args->v[1], res, &zset)) {
+        return;
+    }
+    ZNode *znode = zset ? zset_lookup(zset, args->v[2]) : NULL;
+    if (!znode) {
+        reply_nil(res);
+        return;
+    }
+    reply_int(res, (int64_t)zset_rank(zset, znode));
+}
+
+/// @brief n members from rank start on, each followed by its score with WITHSCORES
+static void zset_reply(Reply *res, ZSet *zset, uint64_t start, size_t n, bool with_scores) {
+    reply_arr(res, n * (with_scores ? 2 : 1));
+    ZIter it = zset_iter(zset, start);
+    for (size_t i = 0; i < n; i++, zset_iter_next(zset, &it)) {
+        Slice name = znode_name(it.znode);
+        reply_str(res, name.ptr, name.len);
+        if (with_scores) {
+            reply_dbl(res, it.znode->score);
+        }
+    }
+}
+
+/**
+ * @brief ZRANGE key start stop [WITHSCORES]: the members from rank start to stop, both
+ * included, a negative one counts from the end (-1 is the last). The first one is found from
+ * the root in O(log n) by the sizes of the subtrees, no member before it is visited, the others
+ * follow it in order
+ * @param res : the members, each followed by its score with WITHSCORES
+ */
+static void zrange(Args *args, Reply *res) {
+    int64_t start = 0;
+    int64_t stop = 0;
+    if (!arg_int(args->v[2], &start) || !arg_int(args->v[3], &stop)) {
+        reply_err(res, "value is not an integer or out of range");
+        return;
+    }
+    bool with_scores = false;
+    if (args->n == 5 && slice_is(args->v[4], "withscores")) {
+        with_scores = true;
+    }
+    else if (args->n != 4) {
+        reply_err(res, "syntax error");
+        return;
+    }
+    ZSet *zset = NULL;
+    if (!zset_find(args->v[1], res, &zset)) {
+        return;
+    }
+    int64_t len = zset ? (int64_t)zset_len(zset) : 0;
+    start = start < 0 ? std::max<int64_t>(start + len, 0) : start;
+    stop = stop < 0 ? stop + len : std::min(stop, len - 1);
+    if (start > stop) {
+        reply_arr(res, 0);
+        return;
+    }
+    zset_reply(res, zset, (uint64_t)start, (size_t)(stop - start + 1), with_scores);
+}
+
+/// @brief a bound of a score range: a score, inclusive, or (score, exclusive
+/// @return false if it is not one
+static bool arg_score_bound(Slice arg, double *score, bool *exclusive) {
+    *exclusive = arg.len > 0 && arg.ptr[0] == '(';
+    if (*exclusive) {
+        arg.ptr++;
+        arg.len--;
+    }
+    return arg_double(arg, score);
+}
+
+/**
+ * @brief ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]: the members whose score
+ * is in the range, from the lowest. Both ends of the range are ranks found by walking down
+ * from the root, the offset is added to the first one and the number of members in the range is
+ * their difference, thus O(log n + count) however far the offset and however large the range
+ * @param res : the members, each followed by its score with WITHSCORES
+ */
+static void zrangebyscore(Args *args, Reply *res) {
+    double min = 0;
+    double max = 0;
+    bool min_excl = false;
+    bool max_excl = false;
+    if (!arg_score_bound(args->v[2], &min, &min_excl) || !arg_score_bound(args->v[3], &max, &max_excl)) {
+        reply_err(res, "min or max is not a float");
+        return;
+    }
+    bool with_scores = false;
+    int64_t offset = 0;
+    int64_t count = -1; // all of them
+    for (size_t i = 4; i < args->n; i++) {
+        if (slice_is(args->v[i], "withscores")) {
+            with_scores = true;
+        }
+        else if (slice_is(args->v[i], "limit") && i + 2 < args->n) {
+            if (!arg_int(args->v[i + 1], &offset) || !arg_int(args->v[i + 2], &count)) {
+                reply_err(res, "value is not an integer or out of range");
+                return;
+            }
+            i += 2;
+        }
+        else {
+            reply_err(res, "syntax error");
+            return;
+        }
+    }
+    ZSet *zset = NULL;
+    if (!zset_find(args->v[1], res, &zset)) {
+        return;
+    }
+    if (!zset || offset < 0) {
+        reply_arr(res, 0);
+        return;
+    }
+    // the ranks of the first member of the range and of the first one past it
+    int64_t start = (int64_t)zset_seek(zset, min, min_excl) + offset;
+    int64_t stop = (int64_t)zset_seek(zset, max, !max_excl);
+    if (start >= stop || count == 0) {
+        reply_arr(res, 0);
+        return;
+    }
+    int64_t n = stop - start;
+    if (count > 0 && count < n) {
+        n = count;
+    }
+    zset_reply(res, zset, (uint64_t)start, (size_t)n, with_scores);
+}
+
+// a multi key request (MGET, MSET, MDEL) and the result of every key. Each shard does the keys
+// it owns (see Command::multi_part), the slots of a key are written only by its owner, and the
+// reply is built from them once all the keys are done
+struct MultiKey {
+    const Command *cmd = NULL;
+    Args *args = NULL; // the request
+    size_t nkeys = 0;
+    std::vector<RcBuf *> vals; // MGET: the value of every key (a reference), NULL if missing
+    std::vector<uint8_t> hit; // MDEL: whether the key was removed
+};
+
+static void multi_init(MultiKey *mk, const Command *cmd, Args *args) {
+    mk->cmd = cmd;
+    mk->args = args;
+    mk->nkeys = (args->n - (size_t)cmd->first_key) / (size_t)cmd->key_step;
+    mk->vals.assign(mk->nkeys, NULL);
+    mk->hit.assign(mk->nkeys, 0);
+}
+
+static Slice multi_key(MultiKey *mk, size_t i) {
+    return mk->args->v[(size_t)mk->cmd->first_key + i * (size_t)mk->cmd->key_step];
+}
+
+/// @brief look the keys idx[0..n) of the request up at once, see hashmap_lookup_batch()
+/// @param keys : filled with the keys
+/// @param found : filled with the entry of every key, NULL if missing or past its deadline
+static void multi_lookup(MultiKey *mk, const uint32_t *idx, size_t n,
+        std::vector<Slice> &keys, std::vector<Entry *> &found) {
+    keys.resize(n);
+    found.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = multi_key(mk, idx[i]);
+    }
+    hmap_lookup_batch(&g_data.db, keys.data(), n, found.data());
+    // the expired ones are removed once all are looked at, a key may be in the request twice
+    std::vector<Entry *> due;
+    for (size_t i = 0; i < n; i++) {
+        if (found[i] && expire_due(found[i])) {
+            due.push_back(found[i]);
+            found[i] = NULL;
+        }
+    }
+    if (!due.empty()) {
+        std::sort(due.begin(), due.end());
+        due.erase(std::unique(due.begin(), due.end()), due.end());
+        for (Entry *entry : due) {
+            key_remove(entry);
+            g_data.expired_lazy++;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (found[i]) {
+            key_touch(found[i]);
+        }
+    }
+}
+
+/// @brief MGET part: take a reference to the value of every key (a copy of an inline one), it
+/// stays valid even if the key is set again before the reply goes out
+static void mget_part(MultiKey *mk, const uint32_t *idx, size_t n) {
+    std::vector<Slice> keys;
+    std::vector<Entry *> found;
+    multi_lookup(mk, idx, n, keys, found);
+    for (size_t i = 0; i < n; i++) {
+        if (!found[i]) {
+            g_data.misses++;
+            continue;
+        }
+        g_data.hits++;
+        if (found[i]->type != ENTRY_STR) {
+            continue; // nil, like redis
+        }
+        if (!(mk->vals[idx[i]] = entry_val_ref(found[i]))) {
+            die("out of memory");
+        }
+    }
+}
+
+/// @brief MGET reply: an array with the value of every key, nil for the missing ones
+static void mget_reply(MultiKey *mk, Reply *res) {
+    reply_arr(res, mk->nkeys);
+    for (RcBuf *&val : mk->vals) {
+        if (!val) {
+            reply_nil(res);
+            continue;
+        }
+        reply_ref(res, val);
+        rcbuf_unref(val);
+        val = NULL;
+    }
+}
+
+/// @brief MSET part: the existing keys are found in one batch, a new key is looked up again
+/// before it is inserted, it may be in the request twice. The request was checked for room
+/// before it was split (see handle_request() and shard_scatter()), a part is not refused: the
+/// other parts may be done already, it only makes what room it can
+static void mset_part(MultiKey *mk, const uint32_t *idx, size_t n) {
+    (void)evict_for_write();
+    std::vector<Slice> keys;
+    std::vector<Entry *> found;
+    multi_lookup(mk, idx, n, keys, found);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t hcode = KeyHash()(keys[i]);
+        Entry *entry = found[i] ? found[i] : key_lookup(keys[i], hcode);
+        size_t pos = (size_t)mk->cmd->first_key + idx[i] * (size_t)mk->cmd->key_step;
+        set_key(keys[i], hcode, entry, mk->args->v[pos + 1]);
+    }
+}
+
+static void mset_reply(MultiKey *mk, Reply *res) {
+    (void)mk;
+    reply_ok(res);
+}
+
+/// @brief MDEL part: the batch lookup brings the chains into the cache, the keys are then 
+/// removed one by one (a key may be in the request twice)
+static void mdel_part(MultiKey *mk, const uint32_t *idx, size_t n) {
+    std::vector<Slice> keys;
+    std::vector<Entry *> found;
+    multi_lookup(mk, idx, n, keys, found);
+    for (size_t i = 0; i < n; i++) {
+        Entry *entry = found[i] ? hmap_pop(&g_data.db, keys[i]) : NULL;
+        if (entry) {
+            key_del(entry);
+            mk->hit[idx[i]] = 1;
+        }
+    }
+}
+
+/// @brief MDEL reply: the number of keys removed
+static void mdel_reply(MultiKey *mk, Reply *res) {
+    int64_t removed = 0;
+    for (uint8_t hit : mk->hit) {
+        removed += hit;
+    }
+    reply_int(res, removed);
+}
+
+/// @brief PING [message], the connection check of the redis clients
+static void ping(Args *args, Reply *res) {
+    if (args->n > 2) {
+        reply_err(res, "wrong number of arguments");
+        return;
+    }
+    if (args->n == 2) {
+        reply_str(res, args->v[1].ptr, args->v[1].len);
+        return;
+    }
+    reply_status(res, "PONG");
+}
+
+/**
+ * @brief HELLO [protover], the handshake of the redis clients: pick RESP2 or RESP3 for the
+ * rest of the connection and describe the server. Only on a RESP connection
+ * @param args 
+ * @param res : the protocol switches right away, the reply is in the new one
  */
-static uint32_t del(std::vector<std::string> &parsed_request, 
-    uint8_t *res, 
-    uint32_t *res_len
-) {
-    (void)res;
-    (void)res_len;
+static void hello(Args *args, Reply *res) {
+    if (res->proto == PROTO_CUSTOM) {
+        reply_err(res, "Unknown cmd");
+        return;
+    }
+    if (args->n >= 2) {
+        if (slice_is(args->v[1], "2")) {
+            res->proto = PROTO_RESP2;
+        }
+        else if (slice_is(args->v[1], "3")) {
+            res->proto = PROTO_RESP3;
+        }
+        else {
+            reply_err(res, "unsupported protocol version");
+            return;
+        }
+    }
+    reply_map(res, 3);
+    reply_str(res, "server", 6);
+    reply_str(res, "toy-redis", 9);
+    reply_str(res, "proto", 5);
+    reply_int(res, res->proto == PROTO_RESP3 ? 3 : 2);
+    reply_str(res, "mode", 4);
+    reply_str(res, "standalone", 10);
+}
 
-    std::string key = parsed_request[1];
+static void stats(Args *args, Reply *res);
+
+// every command of the server, the arity and the key positions are as in redis
+static constexpr Command g_commands[] = {
+    {"get", 2, CMD_READONLY, 1, 1, 1, &get},
+    {"set", -3, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, &set},
+    {"del", 2, CMD_WRITE, 1, 1, 1, &del},
+    {"expire", 3, CMD_WRITE, 1, 1, 1, &expire},
+    {"pexpire", 3, CMD_WRITE, 1, 1, 1, &pexpire},
+    {"ttl", 2, CMD_READONLY, 1, 1, 1, &ttl},
+    {"pttl", 2, CMD_READONLY, 1, 1, 1, &pttl},
+    {"persist", 2, CMD_WRITE, 1, 1, 1, &persist},
+    {"zadd", -4, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, &zadd},
+    {"zrem", -3, CMD_WRITE, 1, 1, 1, &zrem},
+    {"zscore", 3, CMD_READONLY, 1, 1, 1, &zscore},
+    {"zcard", 2, CMD_READONLY, 1, 1, 1, &zcard},
+    {"zrank", 3, CMD_READONLY, 1, 1, 1, &zrank},
+    {"zrange", -4, CMD_READONLY, 1, 1, 1, &zrange},
+    {"zrangebyscore", -4, CMD_READONLY, 1, 1, 1, &zrangebyscore},
+    {"mget", -2, CMD_READONLY, 1, -1, 1, NULL, &mget_part, &mget_reply},
+    {"mset", -3, CMD_WRITE | CMD_DENYOOM, 1, -1, 2, NULL, &mset_part, &mset_reply},
+    {"mdel", -2, CMD_WRITE, 1, -1, 1, NULL, &mdel_part, &mdel_reply},
+    {"stats", 1, CMD_ADMIN, 0, 0, 0, &stats},
+    {"ping", -1, CMD_ADMIN, 0, 0, 0, &ping},
+    {"hello", -1, CMD_ADMIN, 0, 0, 0, &hello},
+};
+static constexpr size_t CMD_COUNT = sizeof(g_commands) / sizeof(g_commands[0]);
+static constexpr CmdIndex g_cmd_index = cmd_index_build(g_commands);
+static_assert(g_cmd_index.seed != 0, "no perfect hash for the command names");
+
+// calls of every command on one thread, only that thread writes them, thus counting needs no
+// atomic read-modify-write, the stats command sums them over all the threads
+struct CommandStats {
+    std::atomic<uint64_t> calls[CMD_COUNT] = {};
+    std::atomic<uint64_t> rejected[CMD_COUNT] = {}; // wrong number of arguments
+};
+
+static std::mutex g_cmd_stats_mu;
+static std::vector<CommandStats *> g_cmd_stats; // of all the threads, never freed
+static thread_local CommandStats *t_cmd_stats = NULL;
+
+static void cmd_count(std::atomic<uint64_t> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static CommandStats *cmd_stats_self() {
+    if (!t_cmd_stats) {
+        t_cmd_stats = new CommandStats();
+        std::lock_guard<std::mutex> lock(g_cmd_stats_mu);
+        g_cmd_stats.push_back(t_cmd_stats);
+    }
+    return t_cmd_stats;
+}
 
-    Entry cur;
-    cur.key.swap(key);
-    cur.node.hcode = str_hash((uint8_t *)cur.key.data(), cur.key.size());
-    Hnode *node = hashmap_pop(&g_data.db, &cur.node, &comparator_function);
+/// @brief the command a request names, one hash and one comparison
+/// @return NULL if there is no such command
+static const Command *command_lookup(Args *args) {
+    if (args->n == 0) {
+        return NULL;
+    }
+    Slice name = args->v[0];
+    int32_t i = cmd_index_find(g_cmd_index, g_commands, name.ptr, name.len);
+    if (i < 0) {
+        return NULL;
+    }
+    return &g_commands[i];
+}
 
-    if (node) {
-        // clean the outer wrapper of Hnode, i.e Entry 
-        delete get_outer_wrapper_of_hnode(node, Entry, node);
+/// @brief append one "name:value" line of the stats response
+static void stats_line(std::string &text, const char *name, int64_t value) {
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%s:%lld\n", name, (long long)value);
+    text.append(line, (size_t)n);
+}
+
+/**
+ * @brief server statistics as "name:value" lines (like INFO), the buffer pool figures and
+ * the command calls are summed over all the reactor threads
+ * @param args 
+ * @param res : the lines, as one string
+ */
+static void stats(Args *args, Reply *res) {
+    (void)args;
+
+    std::string text;
+    BufPoolStats pool = buf_pool_stats();
+    stats_line(text, "buf_pool_chunk_size", pool.chunk_size);
+    stats_line(text, "buf_pool_chunks_in_use", pool.in_use);
+    stats_line(text, "buf_pool_chunks_cached", pool.cached);
+    stats_line(text, "buf_pool_mallocs", pool.mallocs);
+    stats_line(text, "buf_pool_reuses", pool.reuses);
+    {
+        uint64_t sum[15] = {};
+        std::lock_guard<std::mutex> lock(g_db_stats_mu);
+        for (DbStats *ds : g_db_stats) {
+            sum[0] += ds->keys.load(std::memory_order_relaxed);
+            sum[1] += ds->slots.load(std::memory_order_relaxed);
+            sum[2] += ds->rehash_left.load(std::memory_order_relaxed);
+            sum[3] += ds->grows.load(std::memory_order_relaxed);
+            sum[4] += ds->shrinks.load(std::memory_order_relaxed);
+            sum[5] += ds->moved.load(std::memory_order_relaxed);
+            sum[6] += ds->rehash_ns.load(std::memory_order_relaxed);
+            sum[7] += ds->expires.load(std::memory_order_relaxed);
+            sum[8] += ds->expired_active.load(std::memory_order_relaxed);
+            sum[9] += ds->expired_lazy.load(std::memory_order_relaxed);
+            sum[10] += ds->used_memory.load(std::memory_order_relaxed);
+            sum[11] += ds->evicted.load(std::memory_order_relaxed);
+            sum[12] += ds->oom_rejected.load(std::memory_order_relaxed);
+            sum[13] += ds->hits.load(std::memory_order_relaxed);
+            sum[14] += ds->misses.load(std::memory_order_relaxed);
+        }
+        stats_line(text, "db_keys", (int64_t)sum[0]);
+        stats_line(text, "db_slots", (int64_t)sum[1]);
+        stats_line(text, "db_rehash_keys_left", (int64_t)sum[2]);
+        stats_line(text, "db_rehash_grows", (int64_t)sum[3]);
+        stats_line(text, "db_rehash_shrinks", (int64_t)sum[4]);
+        stats_line(text, "db_rehash_moved", (int64_t)sum[5]);
+        stats_line(text, "db_rehash_us", (int64_t)(sum[6] / 1000));
+        stats_line(text, "db_expires", (int64_t)sum[7]);
+        stats_line(text, "db_expired_active", (int64_t)sum[8]);
+        stats_line(text, "db_expired_lazy", (int64_t)sum[9]);
+        stats_line(text, "used_memory", (int64_t)sum[10]);
+        stats_line(text, "maxmemory", (int64_t)g_config.maxmemory);
+        text += std::string("maxmemory_policy:") + EVICT_POLICIES[g_config.evict_policy] + "\n";
+        stats_line(text, "evicted_keys", (int64_t)sum[11]);
+        stats_line(text, "oom_rejected_writes", (int64_t)sum[12]);
+        stats_line(text, "keyspace_hits", (int64_t)sum[13]);
+        stats_line(text, "keyspace_misses", (int64_t)sum[14]);
+        // permille, the hits of GET and MGET over all their keys
+        stats_line(text, "keyspace_hit_rate_pm", sum[13] + sum[14] ? (int64_t)(sum[13] * 1000 / (sum[13] + sum[14])) : 0);
+    }
+    SlabStats slab = slab_stats();
+    stats_line(text, "slab_thp", slab.thp);
+    stats_line(text, "slab_slabs", slab.slabs);
+    stats_line(text, "slab_bytes", slab.slab_bytes);
+    stats_line(text, "slab_region_bytes", slab.region_bytes);
+    stats_line(text, "slab_live_objects", slab.live);
+    stats_line(text, "slab_live_bytes", slab.live_bytes);
+    stats_line(text, "slab_cached_objects", slab.cached);
+    stats_line(text, "slab_large_objects", slab.large);
+    // the part of the slabs not holding a live object: freed ones and the uncut tails
+    stats_line(text, "slab_fragmentation_pct",
+        slab.slab_bytes ? (slab.slab_bytes - slab.live_bytes) * 100 / slab.slab_bytes : 0);
+    std::lock_guard<std::mutex> lock(g_cmd_stats_mu);
+    for (size_t i = 0; i < CMD_COUNT; i++) {
+        uint64_t calls = 0;
+        uint64_t rejected = 0;
+        for (CommandStats *cs : g_cmd_stats) {
+            calls += cs->calls[i].load(std::memory_order_relaxed);
+            rejected += cs->rejected[i].load(std::memory_order_relaxed);
+        }
+        std::string name = std::string("cmd_") + g_commands[i].name;
+        stats_line(text, (name + "_calls").c_str(), (int64_t)calls);
+        stats_line(text, (name + "_rejected").c_str(), (int64_t)rejected);
     }
-    return RES_OK;
+    reply_str(res, text.data(), text.size());
 }
 
 /**
- * @brief This will re-direct the request based on parsed_request either it is
- * get, set or del
+ * @brief This will re-direct the request to the handler of its command, after checking the
+ * number of arguments, the protocol the request came in does not matter here
  * 
- * @param raw_request : takes the raw request, so that it can be parsed
- * @param req_len : length of request
- * @param res_code : response code to client 
- * @param res : response 
- * @param res_len : response length
- * @return int32_t : status (succes /failure)
+ * @param cmd : command_lookup() of the request, NULL if unknown
+ * @param args : the parsed request
+ * @param res : the reply goes there
  */
-static int32_t handle_request(const uint8_t *raw_request, uint32_t req_len, 
-        uint32_t* res_code, uint8_t *res, uint32_t *res_len) {
-    
-    std::vector<std::string> parsed_request;
-    
-    if (parse_request(raw_request, req_len, parsed_request) != 0) {
-        msg ("bad request at during executing handle_request()");
-        return -1;
-    } 
+static void handle_request(const Command *cmd, Args *args, Reply *res) {
+    if (!cmd) {
+        reply_err(res, "Unknown cmd");
+        return;
+    }
+    CommandStats *cs = cmd_stats_self();
+    size_t i = (size_t)(cmd - g_commands);
+    bool arity_ok = cmd->arity >= 0 ? args->n == (size_t)cmd->arity : args->n >= (size_t)-cmd->arity;
+    if (cmd->multi_part && (args->n - (size_t)cmd->first_key) % (size_t)cmd->key_step != 0) {
+        arity_ok = false; // MSET without the value of its last key
+    }
+    if (!arity_ok) {
+        cmd_count(cs->rejected[i]);
+        reply_err(res, "wrong number of arguments");
+        return;
+    }
+    cmd_count(cs->calls[i]);
+    if ((cmd->flags & CMD_DENYOOM) && !evict_for_write()) {
+        g_data.oom_rejected++;
+        reply_err(res, "OOM command not allowed when used memory > 'maxmemory'");
+        return;
+    }
+    if (!cmd->multi_part) {
+        cmd->handler(args, res);
+        return;
+    }
+    // all the keys are on this shard
+    MultiKey mk;
+    multi_init(&mk, cmd, args);
+    std::vector<uint32_t> idx(mk.nkeys);
+    for (size_t k = 0; k < mk.nkeys; k++) {
+        idx[k] = (uint32_t)k;
+    }
+    cmd->multi_part(&mk, idx.data(), idx.size());
+    cmd->multi_reply(&mk, res);
+}
+
+/// @brief execute a request and append its reply to out
+/// @param proto : protocol of the connection, HELLO may change it
+static void run_request(const Command *cmd, Args *args, uint32_t *proto, OutQueue *out) {
+    Reply res;
+    reply_begin(&res, out, *proto);
+    handle_request(cmd, args, &res);
+    reply_end(&res);
+    *proto = res.proto;
+}
+
+/// @brief the shard owning a key, the hash is mixed again so that the keys of one shard
+/// still spread over all the buckets of its hashmap
+/// @param hcode : str_hash() of the key
+/// @return shard id
+static uint32_t shard_of(uint64_t hcode) {
+    return (uint32_t)(((hcode * 0x9E3779B97F4A7C15ULL) >> 32) % g_config.threads);
+}
+
+static const uint32_t SHARD_MANY = UINT32_MAX; // the keys of the request are in several shards
+
+/// @brief find the shard owning the keys of a request
+/// @param cmd : command of the request, NULL if unknown
+/// @param args : the parsed request
+/// @return shard id, the current shard if the command takes no key, or SHARD_MANY
+static uint32_t request_owner(const Command *cmd, Args *args) {
+    if (!cmd || cmd->first_key == 0 || args->n <= (size_t)cmd->first_key) {
+        return g_shard->id; // bad requests are rejected by the local shard
+    }
+    size_t first = (size_t)cmd->first_key;
+    Slice key = args->v[first];
+    uint32_t owner = shard_of(str_hash(key.ptr, key.len));
+    if (!cmd->multi_part || (args->n - first) % (size_t)cmd->key_step != 0) {
+        return owner;
+    }
+    for (size_t i = first + (size_t)cmd->key_step; i < args->n; i += (size_t)cmd->key_step) {
+        if (shard_of(str_hash(args->v[i].ptr, args->v[i].len)) != owner) {
+            return SHARD_MANY;
+        }
+    }
+    return owner;
+}
+
+/// @brief put a message into the inbox of shard to, the shard is woken up at the end of this
+/// loop iteration (see shard_flush_mail)
+static void shard_send(uint32_t to, ShardMsg *m) {
+    std::deque<ShardMsg *> &backlog = g_shard->backlog[to];
+    if (!backlog.empty() || !spsc_push(g_shards[to]->inbox[g_shard->id], m)) {
+        backlog.push_back(m); // keep the order, retried by shard_flush_mail
+    }
+    g_shard->wake[to] = true;
+}
+
+/// @brief the arguments of a request in the custom protocol (nstr, len, str1, len, str2 ...),
+/// whichever protocol they came in
+static bool encode_args(Buffer *buf, Args *args) {
+    uint32_t nstr = (uint32_t)args->n;
+    if (!buf_append(buf, (const uint8_t *)&nstr, 4)) {
+        return false;
+    }
+    for (size_t i = 0; i < args->n; i++) {
+        uint32_t len = (uint32_t)args->v[i].len;
+        if (!buf_append(buf, (const uint8_t *)&len, 4) || !buf_append(buf, args->v[i].ptr, len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief hand the request of conn over to the shard owning the key
+static void shard_forward(Conn *conn, uint32_t owner, Args *args) {
+    ShardMsg *m = (ShardMsg *)malloc(sizeof(ShardMsg));
+    if (!m) {
+        die("out of memory");
+    }
+    m->conn = conn;
+    m->gather = NULL;
+    m->from = g_shard->id;
+    m->reply = false;
+    m->failed = false;
+    m->proto = conn->proto;
+    m->data = Buffer{};
+    m->res = OutQueue{};
+    if (!encode_args(&m->data, args)) {
+        die("out of memory");
+    }
+    shard_send(owner, m);
+}
+
+// a multi key request whose keys are in several shards (scatter / gather): the origin keeps a
+// copy of the request, every other owner gets a message pointing to it and does its keys, the
+// origin does its own keys and replies once all the parts are back
+struct Gather {
+    MultiKey mk;
+    Buffer data; // the request, read by all the owners
+    Args args; // views into data
+    std::vector<uint32_t> key_owner; // shard of every key
+    uint32_t pending = 0; // parts not back yet, only the origin touches it
+};
 
-    if (parsed_request.size() == 2 && is_same(parsed_request.front(), "get")) {
-        *res_code = get(parsed_request, res, res_len);
+/// @brief the keys of g which shard owns
+static std::vector<uint32_t> gather_keys(Gather *g, uint32_t shard) {
+    std::vector<uint32_t> idx;
+    for (uint32_t i = 0; i < (uint32_t)g->key_owner.size(); i++) {
+        if (g->key_owner[i] == shard) {
+            idx.push_back(i);
+        }
+    }
+    return idx;
+}
+
+/**
+ * @brief split the multi key request of conn among the shards owning its keys. A write which
+ * may add memory is refused first if this shard has no room, or if one of the owners had none
+ * at the end of its last loop iteration, as a part can not be refused once others are done
+ * @return false if it was refused, the error is in the output queue of conn
+ */
+static bool shard_scatter(Conn *conn, const Command *cmd, Args *args) {
+    std::vector<bool> part(g_config.threads, false);
+    for (size_t i = (size_t)cmd->first_key; i < args->n; i += (size_t)cmd->key_step) {
+        part[shard_of(str_hash(args->v[i].ptr, args->v[i].len))] = true;
+    }
+    bool no_room = false;
+    if (cmd->flags & CMD_DENYOOM) {
+        no_room = !evict_for_write();
+        for (uint32_t to = 0; to < g_config.threads && !no_room; to++) {
+            no_room = part[to] && to != g_shard->id && g_shards[to]->no_room.load(std::memory_order_relaxed);
+        }
+    }
+    if (no_room) {
+        g_data.oom_rejected++;
+        Reply res;
+        reply_begin(&res, &conn->out, conn->proto);
+        reply_err(&res, "OOM command not allowed when used memory > 'maxmemory'");
+        reply_end(&res);
+        return false;
+    }
+    Gather *g = new Gather();
+    if (!encode_args(&g->data, args) || parse_request(buf_head(&g->data), buf_size(&g->data), &g->args)) {
+        die("out of memory");
+    }
+    multi_init(&g->mk, cmd, &g->args);
+    for (size_t i = 0; i < g->mk.nkeys; i++) {
+        Slice key = multi_key(&g->mk, i);
+        g->key_owner.push_back(shard_of(str_hash(key.ptr, key.len)));
+    }
+    for (uint32_t to = 0; to < g_config.threads; to++) {
+        if (!part[to] || to == g_shard->id) {
+            continue;
+        }
+        ShardMsg *m = (ShardMsg *)malloc(sizeof(ShardMsg));
+        if (!m) {
+            die("out of memory");
+        }
+        *m = ShardMsg{};
+        m->conn = conn;
+        m->gather = g;
+        m->from = g_shard->id;
+        g->pending++;
+        shard_send(to, m);
+    }
+    // the other shards only read the request, our part may run meanwhile
+    std::vector<uint32_t> idx = gather_keys(g, g_shard->id);
+    if (!idx.empty()) {
+        cmd->multi_part(&g->mk, idx.data(), idx.size());
+    }
+    return true;
+}
+
+/// @brief parse the request at the head of the read buffer, in the protocol of the connection
+/// @param frame_len : bytes of the request, when complete
+/// @return PARSE_OK, PARSE_MORE or PARSE_ERR
+static int parse_one_request(Conn *conn, Args *args, size_t *frame_len) {
+    Buffer *rb = &conn->read_buffer;
+    if (conn->proto == PROTO_NONE) {
+        conn->proto = detect_protocol(buf_head(rb), buf_size(rb));
+        if (conn->proto == PROTO_NONE) {
+            return PARSE_MORE;
+        }
     }
-    else if (parsed_request.size() == 2 && is_same(parsed_request.front(), "del")) {
-        *res_code = del(parsed_request, res, res_len);
+    if (conn->proto != PROTO_CUSTOM) {
+        int r = resp_parse(&conn->resp, buf_head(rb), buf_size(rb), g_config.max_request, args, frame_len);
+        if (r == PARSE_MORE && buf_size(rb) > (size_t)g_config.max_request + READ_CHUNK) {
+            msg("too long message");
+            return PARSE_ERR;
+        }
+        return r;
+    }
+    if (buf_size(rb) < 4) {
+        // not enough data for this cycle, please try later.
+        return PARSE_MORE;
+    }
+    uint32_t len = 0;
+    memcpy(&len, buf_head(rb), 4); // in read_buffer we have the request sent by the client. 
+    // too long message 
+    if (len > custom_max_request()) {
+        msg("too long message");
+        return PARSE_ERR;
     }
-    else if (parsed_request.size() == 3 && is_same(parsed_request.front(), "set")) {
-        *res_code = set(parsed_request, res, res_len);
+    if (HEADER_LEN + len > buf_size(rb)) {
+        // only a part of the request has arrived, please try later.
+        return PARSE_MORE;
     }
-    else {
-        *res_code = RES_ERR;
-        const char *msg = "Unknown cmd";
-        strcpy((char* )res, msg);
-        *res_len = strlen(msg);
-        return 0;
+    if (parse_request(buf_head(rb) + HEADER_LEN, len, args) != 0) {
+        msg("bad request");
+        return PARSE_ERR;
     }
-    return 0;
+    *frame_len = HEADER_LEN + len;
+    return PARSE_OK;
 }
 
 /**
- * @brief This is fired by try_fill_buffer, inorder to send the response to the client 
- * request 
+ * @brief Take one complete request out of the read buffer, execute it and append the response 
+ * to the output queue, the queue is flushed later on. If the key of the request belongs to 
+ * another shard then the request is forwarded to it instead
  * @param conn 
- * @return true : if success
- * @return false : if fails 
+ * @return true : if a response was appended to the output queue
+ * @return false : if the request is not complete yet, the connection is bad (STATE_END) or
+ * the request was forwarded (STATE_WAIT)
  */
-static bool try_one_request(Conn* conn) {
-    if (conn->read_buffer_size < 4) {
-        // not enough data for this cycle, please try later.
-        return false;
-    }
-    uint32_t len = 0;
-    memcpy(&len, &conn->read_buffer[0], 4); // in read_buffer we have the request sent by the client. 
-    // too long message 
-    if (len > MSG_MAX_LEN) {
-        msg("too long message");
-        conn->state = STATE_END;
+static bool handle_one_request(Conn* conn) {
+    Args args; // views into the read buffer, nothing is copied
+    size_t frame_len = 0;
+    int r = parse_one_request(conn, &args, &frame_len);
+    if (r != PARSE_OK) {
+        if (r == PARSE_ERR) {
+            conn->state = STATE_END;
+        }
+        args_free(&args);
         return false;
     }
 
-    //response for the request 
-    uint32_t res_code = 0;
-    uint32_t res_len = 0;
-    printf ("Calling handle_request\n");
-    uint32_t err = handle_request(
-        &conn->read_buffer[4], 
-        len, 
-        &res_code, // to store the response code. 
-        &conn->write_buffer[4 + 4], // write response after first four bytes
-        &res_len // length of response 
-    );
-
-    if (err) {
-        conn->state = STATE_END;
-        return false;
+    bool done = true;
+    uint32_t owner = 0;
+    const Command *cmd = command_lookup(&args);
+    if (g_config.threads > 1 && (owner = request_owner(cmd, &args)) != g_shard->id) {
+        if (owner == SHARD_MANY) {
+            cmd_count(cmd_stats_self()->calls[cmd - g_commands]);
+            done = !shard_scatter(conn, cmd, &args);
+        }
+        else {
+            shard_forward(conn, owner, &args);
+            done = false;
+        }
+        if (!done) {
+            conn->state = STATE_WAIT; // later requests wait for the reply, to keep the order
+            conn->forwarded = true;
+        }
     }
+    else {
+        run_request(cmd, &args, &conn->proto, &conn->out);
+    }
+    args_free(&args);
+    // drop the request, the bytes after it are not moved
+    buf_consume(&conn->read_buffer, frame_len);
+    return done;
+}
 
-    res_len += 4; // length of response code and response 
-    memcpy(&conn->write_buffer[0], &res_len, 4);
-    memcpy(&conn->write_buffer[4], &res_code, 4);
-    conn->write_buffer_size = 4 + res_len; // 4 is the header and rest is response code + actual response 
-
-    // remain 
-    size_t remain = conn->read_buffer_size - (HEADER_LEN + len);
-    if (remain) {
-        memmove(conn->read_buffer, &conn->read_buffer[HEADER_LEN + len], remain);
+/**
+ * @brief execute every complete request in the read buffer, the responses pile up in the output
+ * queue and go out together. Once the queue passes OUT_HIGH_WATER we stop, the connection only
+ * flushes (STATE_RES) until the client has read most of it
+ * @param conn 
+ */
+static void process_requests(Conn* conn) {
+    while (conn->state == STATE_REQ && handle_one_request(conn)) {
+        if (conn->out.bytes >= OUT_HIGH_WATER) {
+            conn->state = STATE_RES;
+        }
     }
-    conn->read_buffer_size = remain;
-    // change the state 
-    conn->state = STATE_RES;
-    state_res(conn); // see if you can flush, call the state_res
-    return (conn->state == STATE_REQ);
 }
 
-// flush the write buffer to the fd
+// flush the output queue to the fd
 /**
- * @brief flush the write buffer to the connection fd with a given client
+ * @brief flush the output queue to the connection fd with a given client, all the queued 
+ * blocks go out with a single writev()
  * 
- * @param conn : connection object (a stateful object, write-buffer, read-buffer, status all that goes here)
- * @return true : If success
- * @return false : if fails
+ * @param conn : connection object (a stateful object, output queue, read-buffer, status all that goes here)
+ * @return true : if some data is left and the socket may take more
+ * @return false : if the queue is empty, the socket is full or it failed
  */
 static bool try_flush_buffer(Conn* conn) {
+    OutQueue *out = &conn->out;
+    if (out->bytes == 0) {
+        return false;
+    }
+    struct iovec iov[OUT_IOV_MAX];
+    size_t niov = outq_iov(out, iov, OUT_IOV_MAX);
     ssize_t return_value = 0;
     do {
-        size_t remain = conn->write_buffer_size - conn->write_buffer_sent;
-        // write the remain data to the fd, at it's buffer from the index(or pointer) write_buffer_sent
-        return_value = write(conn->fd, &conn->write_buffer[conn->write_buffer_sent], remain);
+        // write the queued blocks to the fd
+        return_value = writev(conn->fd, iov, (int)niov);
     }
     while(return_value < 0 && errno == EINTR); // if asked to return again 
     // EINTR "Interrupted System Call" and indicates that a system call was interrupted 
@@ -421,38 +1954,62 @@ static bool try_flush_buffer(Conn* conn) {
         conn->state = STATE_END;
         return false;
     }
-    conn->write_buffer_sent += (size_t) return_value;
-    assert(conn->write_buffer_sent <= conn->write_buffer_size);
-    if (conn->write_buffer_sent == conn->write_buffer_size) {
-        // response is fully send thus no more in res state 
-        conn->state = STATE_REQ; // set the state to open to req state
-        conn->write_buffer_sent = 0;
-        conn->write_buffer_size = 0;
-        return false;
+    assert((size_t)return_value <= out->bytes);
+    outq_consume(out, (size_t)return_value);
+    if (conn->state == STATE_RES && out->bytes <= OUT_LOW_WATER) {
+        conn->state = STATE_REQ; // the client caught up, read requests again
     }
     // if still left with data then we will try again, don't sleep
-    return true;
+    return out->bytes > 0;
 }
 
 static void state_res(Conn* conn) {
     while (try_flush_buffer(conn)) {}
 }
 
+/// @brief how much free room the read buffer needs before the next read(), usually one chunk,
+/// but once the header of a large frame (or of a large RESP argument) is in we make room for
+/// all of it at once instead of doubling the buffer several times
+/// @param conn : connection whose read buffer is filled
+/// @return bytes
+static size_t read_room_wanted(Conn *conn) {
+    Buffer *rb = &conn->read_buffer;
+    size_t want = READ_CHUNK;
+    if (conn->proto == PROTO_RESP2 || conn->proto == PROTO_RESP3) {
+        return conn->resp.need > want ? conn->resp.need : want;
+    }
+    if (conn->proto == PROTO_CUSTOM && buf_size(rb) >= HEADER_LEN) {
+        uint32_t len = 0;
+        memcpy(&len, buf_head(rb), 4);
+        if (len <= custom_max_request() && HEADER_LEN + len > buf_size(rb) + want) {
+            want = HEADER_LEN + len - buf_size(rb);
+        }
+    }
+    return want;
+}
+
 /**
- * @brief fill the read buffer form the connection fd, from the conn
+ * @brief fill the read buffer form the connection fd, from the conn, and execute all the
+ * complete requests
  * @param conn 
- * @return true 
- * @return false 
+ * @return true : if we may read again
+ * @return false : if there is nothing to read, or we should not read now
  */
 static bool try_fill_buffer(Conn* conn) {
-    assert(conn->read_buffer_size < sizeof(conn->read_buffer));
+    Buffer *rb = &conn->read_buffer;
+    if (!buf_reserve(rb, read_room_wanted(conn))) {
+        msg("out of memory");
+        conn->state = STATE_END;
+        return false;
+    }
     ssize_t return_value = 0;
     do {
-        size_t capacity = sizeof(conn->read_buffer) - conn->read_buffer_size; // left capacity in local buffer, to read from the fd
-        return_value = read(conn->fd, &conn->read_buffer[conn->read_buffer_size], capacity);
+        size_t capacity = buf_room(rb); // left capacity in local buffer, to read from the fd
+        return_value = read(conn->fd, buf_tail(rb), capacity);
     }while (return_value < 0 && errno == EINTR);
 
     if (return_value < 0 && errno == EAGAIN) {
+        buf_trim(rb); // an idle connection gives the chunk back to the pool
         return false; // go to sleep, there is nothing to do
     }
     if (return_value < 0) {
@@ -461,7 +2018,7 @@ static bool try_fill_buffer(Conn* conn) {
         return false;
     }
     if (return_value == 0) {
-        if (conn->read_buffer_size > 0) {
+        if (buf_size(rb) > 0) {
             msg("unexpected eof"); // there is still to read but we can't as \0 found in between
         }
         else {
@@ -470,10 +2027,9 @@ static bool try_fill_buffer(Conn* conn) {
         conn->state = STATE_END;
         return false; // no need to stay awake (i.e while (true));
     }
-    conn->read_buffer_size += (size_t)return_value;
-    assert(conn->read_buffer_size <= sizeof(conn->read_buffer));
-    // EXERCISE: Why there is a loop ? (it was not in the other case ....)
-    while (try_one_request(conn)) {} // see if the request can be proceed with 
+    rb->end += (size_t)return_value;
+    // a read may carry many requests, execute all of them before reading again
+    process_requests(conn);
     return (conn->state == STATE_REQ);
 }
 
@@ -484,7 +2040,9 @@ static void state_req(Conn* conn) {
 // state-machine (see in which state conn object is now)
 
 /**
- * @brief statemachine, which is a DFA, keep moving from one state to another
+ * @brief statemachine, which is a DFA, keep moving from one state to another. Only the 
+ * reading happens here, the output queue is flushed at the end of the loop iteration
+ * (see conn_flush)
  * 
  * @param conn 
  */
@@ -492,19 +2050,646 @@ static void connection_io(Conn* conn) {
     if (conn->state == STATE_REQ) {
         state_req(conn);
     }
-    else if (conn->state == STATE_RES) {
-        state_res(conn);
-    }   
+    else if (conn->state == STATE_RES || conn->state == STATE_WAIT || conn->state == STATE_END) {
+        // nothing to read: the socket has room again (flushed later on), or the connection
+        // is about to be closed (once the reply is here if it waits for another shard)
+    }
     else {
         assert(0); // not expected. 
     }
 }
 
-int main() {
+/// @brief close the connection and release its memory
+static void conn_destroy(std::vector<Conn *> &fd_to_conn, Conn *conn) {
+    fd_to_conn[conn->fd] = NULL; // set mapping to null
+    (void)close(conn->fd); // close the resource, this also drops it from the epoll set
+    dlist_detach(&conn->idle_node);
+    buf_free(&conn->read_buffer);
+    outq_free(&conn->out);
+    conn_release(conn); // back to the pool, for the next connection
+}
+
+/// @brief remember that conn has output to flush at the end of this loop iteration
+static void conn_touch(Shard *shard, Conn *conn) {
+    if (!conn->touched) {
+        conn->touched = true;
+        shard->touched.push_back(conn);
+    }
+}
+
+/// @brief end of a loop iteration: one writev() for all the responses the connection got during
+/// the iteration, then carry on with the requests left in the read buffer if the client caught
+/// up, and set the epoll interest (or close it)
+static void conn_flush(Shard *shard, Conn *conn) {
+    conn->touched = false;
+    while (conn->state != STATE_END) {
+        bool was_full = (conn->state == STATE_RES);
+        state_res(conn);
+        if (!was_full || conn->state != STATE_REQ) {
+            break;
+        }
+        // epoll will not report the requests which are already in the read buffer
+        process_requests(conn);
+    }
+    if (conn->state == STATE_END && conn->forwarded) {
+        // another shard still holds a pointer to it, shard_deliver() closes it. Out of the
+        // epoll set meanwhile, a hangup or an error would be reported over and over
+        (void)epoll_ctl(shard->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+        return;
+    }
+    if (conn->state == STATE_END) {
+        conn_destroy(shard->fd_to_conn, conn);
+        return;
+    }
+    conn_update_interest(shard->epfd, conn);
+}
+
+/// @brief idle timeout in the epoll loop, a connection waiting for another shard is kept (the 
+/// reply still points to it) and is looked at again one timeout later
+static void epoll_reap(Conn *conn) {
+    if (conn->forwarded) {
+        conn_activity(conn);
+        return;
+    }
+    conn_destroy(g_shard->fd_to_conn, conn);
+}
+
+/// @brief owner side: execute a forwarded request on the local shard of the keyspace and
+/// send the response frame back to the origin
+static void shard_execute(ShardMsg *m) {
+    if (m->gather) {
+        Gather *g = m->gather;
+        std::vector<uint32_t> idx = gather_keys(g, g_shard->id);
+        g->mk.cmd->multi_part(&g->mk, idx.data(), idx.size());
+        m->reply = true;
+        shard_send(m->from, m);
+        return;
+    }
+    Args args;
+    m->failed = parse_request(buf_head(&m->data), buf_size(&m->data), &args) != 0;
+    if (!m->failed) {
+        run_request(command_lookup(&args), &args, &m->proto, &m->res);
+    }
+    args_free(&args);
+    buf_free(&m->data);
+    m->reply = true;
+    shard_send(m->from, m);
+}
+
+/// @brief origin side: the response is back, queue it and carry on with the requests which
+/// piled up in the read buffer meanwhile
+static void shard_deliver(ShardMsg *m) {
+    Conn *conn = m->conn;
+    assert(conn->forwarded);
+    if (m->gather) {
+        Gather *g = m->gather;
+        free(m);
+        if (--g->pending > 0) {
+            return;
+        }
+        conn->forwarded = false;
+        if (conn->state == STATE_END) {
+            // it failed meanwhile, closed by the flush at the end of this loop iteration
+            args_free(&g->args);
+            buf_free(&g->data);
+            delete g;
+            conn_touch(g_shard, conn);
+            return;
+        }
+        // every part is back, the reply is built here as if the request ran locally
+        Reply res;
+        reply_begin(&res, &conn->out, conn->proto);
+        g->mk.cmd->multi_reply(&g->mk, &res);
+        reply_end(&res);
+        args_free(&g->args);
+        buf_free(&g->data);
+        delete g;
+        conn->state = (conn->out.bytes >= OUT_HIGH_WATER) ? STATE_RES : STATE_REQ;
+        process_requests(conn);
+        conn_touch(g_shard, conn);
+        return;
+    }
+    conn->forwarded = false;
+    if (m->failed || conn->state == STATE_END) {
+        conn->state = STATE_END;
+    }
+    else {
+        // take over the blocks of the response frame as they are, behind the earlier responses
+        outq_splice(&conn->out, &m->res);
+        conn->state = (conn->out.bytes >= OUT_HIGH_WATER) ? STATE_RES : STATE_REQ;
+        process_requests(conn);
+    }
+    outq_free(&m->res);
+    free(m);
+    conn_touch(g_shard, conn);
+}
+
+/// @brief handle all the mail from the other shards, requests to execute and replies
+static void shard_read_mail() {
+    uint64_t count = 0;
+    // reset the eventfd before looking at the queues, a later push wakes us up again
+    (void)read(g_shard->efd, &count, sizeof(count));
+    for (SpscQueue *q : g_shard->inbox) {
+        if (!q) {
+            continue; // no queue from self to self
+        }
+        while (ShardMsg *m = (ShardMsg *)spsc_pop(q)) {
+            if (m->reply) {
+                shard_deliver(m);
+            }
+            else {
+                shard_execute(m);
+            }
+        }
+    }
+}
+
+/// @brief end of a loop iteration: retry the mail which did not fit in a full inbox and wake
+/// up every shard which got mail, once per iteration instead of once per message
+/// @return true if some mail is still waiting for room
+static bool shard_flush_mail() {
+    bool pending = false;
+    for (uint32_t to = 0; to < g_config.threads; to++) {
+        std::deque<ShardMsg *> &backlog = g_shard->backlog[to];
+        while (!backlog.empty() && spsc_push(g_shards[to]->inbox[g_shard->id], backlog.front())) {
+            backlog.pop_front();
+        }
+        pending = pending || !backlog.empty();
+        if (g_shard->wake[to]) {
+            uint64_t one = 1;
+            (void)write(g_shards[to]->efd, &one, sizeof(one));
+            g_shard->wake[to] = false;
+        }
+    }
+    return pending;
+}
+
+/**
+ * @brief the epoll event loop, the listener and every connection is registered once with epoll
+ * and epoll_wait() hands back only the fds which are ready, so the cost of an iteration
+ * depends on the number of active connections, not on the total number of connections.
+ * Every reactor thread runs its own loop on its own listening socket
+ * 
+ * @param shard : the reactor of this thread
+ * @param fd : non-blocking listening socket
+ */
+static void epoll_event_loop(Shard *shard, int fd) {
+    g_shard = shard;
+    std::vector<Conn*> &fd_to_conn = shard->fd_to_conn;
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        die("epoll_create1()");
+    }
+    shard->epfd = epfd;
+    struct epoll_event listener_ev = {};
+    listener_ev.events = EPOLLIN;
+    listener_ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &listener_ev)) {
+        die("epoll_ctl() listener");
+    }
+    struct epoll_event mail_ev = {};
+    mail_ev.events = EPOLLIN;
+    mail_ev.data.fd = shard->efd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, shard->efd, &mail_ev)) {
+        die("epoll_ctl() eventfd");
+    }
+
+    std::vector<struct epoll_event> ready(MAX_EVENTS);
+    bool mail_pending = false;
+    dlist_init(&g_timers.idle);
+    g_timers.now = get_monotonic_ms();
+
+    while (true) {
+        // level triggered: a fd which still has data (or room to write) is reported again next time
+        int n = epoll_wait(epfd, ready.data(), (int)ready.size(), mail_pending ? 0 : next_timer_ms());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            die("epoll_wait");
+        }
+        g_timers.now = get_monotonic_ms();
+
+        // now process only the active connections
+        for (int i = 0; i < n; ++i) {
+            if (ready[i].data.fd == fd) {
+                // accept the new connections if the listening fd is active 
+                accept_connections(fd_to_conn, epfd, fd);
+                continue;
+            }
+            if (ready[i].data.fd == shard->efd) {
+                shard_read_mail();
+                continue;
+            }
+            Conn *conn = fd_to_conn[ready[i].data.fd];
+            if (conn->state == STATE_WAIT && (ready[i].events & (EPOLLHUP | EPOLLERR))) {
+                // always reported, whatever the interest: the client is gone, drop it once
+                // the reply is back
+                conn->state = STATE_END;
+            }
+            conn_activity(conn);
+            connection_io(conn);
+            conn_touch(shard, conn);
+        }
+        // the responses of all the requests executed above go out now, one writev() per connection
+        for (Conn *conn : shard->touched) {
+            conn_flush(shard, conn);
+        }
+        shard->touched.clear();
+        mail_pending = shard_flush_mail();
+        process_timers(epoll_reap);
+        process_expire(n == 0);
+        process_rehash(n == 0);
+    }
+}
+
+// io_uring backend: instead of being told that a fd is ready and then doing read()/write()
+// ourselves, we queue the accept/recv/send operations and the kernel reports when they are
+// done. All the operations queued while handling one batch of completions are submitted with
+// the same io_uring_enter() that waits for the next batch, i.e. one syscall per loop iteration
+// no matter how many connections did some work. At most one operation is in flight for a 
+// connection: a send while its output queue is not empty, else a recv.
+
+// the kind of the operation lives in the low bits of user_data, the rest is the Conn pointer
+enum {
+    UOP_ACCEPT = 1,
+    UOP_RECV = 2,
+    UOP_SEND = 3,
+    UOP_MASK = 3,
+};
+
+static const uint16_t URING_BGID = 0;
+
+// the message header of a sendmsg, it describes the output queue of a connection
+struct UringMsg {
+    struct msghdr msg;
+    struct iovec iov[OUT_IOV_MAX];
+};
+
+// the ring and the recv buffers shared by all the connections of the uring loop
+static struct {
+    Uring ring;
+    UringBufGroup bufs;
+    std::vector<Conn *> starved; // recv found no free buffer, re-armed once one is recycled
+    bool recycled = false;
+    // headers of the sends queued during this batch, the kernel copies them on submit (the
+    // ring has IORING_FEAT_SUBMIT_STABLE), thus they are dropped right after it
+    std::deque<UringMsg> msgs;
+    unsigned cq_seen = 0; // the completions of this batch before it are handled
+} g_uring;
+
+/// @brief the submission queue is full and the kernel took none of it (see uring_get_sqe()),
+/// its completion queue is full: give back the completions handled so far and submit again
+static void uring_sq_full() {
+    uring_cq_advance(&g_uring.ring, g_uring.cq_seen);
+    int ret = uring_submit_and_wait(&g_uring.ring, 0, -1);
+    if (ret < 0 && ret != -EBUSY && ret != -EAGAIN) {
+        errno = -ret;
+        die("io_uring_enter()");
+    }
+}
+
+/// @brief a sqe to fill. One batch of completions may queue more than the submission queue
+/// holds, a full queue is submitted on the way
+static io_uring_sqe *uring_sqe() {
+    io_uring_sqe *sqe = NULL;
+    while (!(sqe = uring_get_sqe(&g_uring.ring))) {
+        uring_sq_full();
+    }
+    return sqe;
+}
+
+/// @brief give a received buffer back to the kernel
+static void uring_recycle(uint16_t bid) {
+    while (uring_buf_recycle(&g_uring.ring, &g_uring.bufs, bid)) {
+        uring_sq_full();
+    }
+    g_uring.recycled = true;
+}
+
+/// @brief multishot accept, a single sqe keeps producing a cqe per accepted connection
+static void uring_arm_accept(int fd) {
+    io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = UOP_ACCEPT;
+}
+
+/// @brief recv into a buffer the kernel picks from the provided buffer ring, thus an idle 
+/// connection does not pin any buffer while it waits
+static void uring_arm_recv(Conn *conn) {
+    io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | UOP_RECV;
+}
+
+/// @brief send the whole output queue with one sendmsg, the gather write of io_uring
+static void uring_arm_send(Conn *conn) {
+    g_uring.msgs.emplace_back();
+    UringMsg *um = &g_uring.msgs.back();
+    um->msg = msghdr{};
+    um->msg.msg_iov = um->iov;
+    um->msg.msg_iovlen = outq_iov(&conn->out, um->iov, OUT_IOV_MAX);
+    io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&um->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | UOP_SEND;
+}
+
+static void uring_close(Conn *conn) {
+    (void)close(conn->fd);
+    dlist_detach(&conn->idle_node);
+    buf_free(&conn->read_buffer);
+    outq_free(&conn->out);
+    conn_release(conn);
+}
+
+/**
+ * @brief drive the Conn state machine as far as it goes without I/O, then queue the
+ * operation it is waiting for: a send for the queued responses, or a recv for more request bytes
+ * 
+ * @param conn : connection which has no operation in flight
+ */
+static void uring_conn_advance(Conn *conn) {
+    process_requests(conn);
+    if (conn->state == STATE_END) {
+        uring_close(conn);
+        return;
+    }
+    if (conn->out.bytes > 0) {
+        uring_arm_send(conn); // all the responses of this recv in one go
+        return;
+    }
+    uring_arm_recv(conn); // the frame is incomplete
+}
+
+/// @brief idle timeout in the io_uring loop, the connection has an operation in flight which 
+/// still points to it, thus shut the socket down and let that operation fail (or see EOF),
+/// which then closes it the usual way
+static void uring_reap(Conn *conn) {
+    (void)shutdown(conn->fd, SHUT_RDWR);
+    dlist_detach(&conn->idle_node);
+}
+
+static void uring_on_accept(io_uring_cqe *cqe, int fd) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_accept(fd); // the multishot accept has stopped, start it again
+    }
+    if (cqe->res < 0) {
+        msg("accept() error");
+        return;
+    }
+    set_fd_no_delay(cqe->res);
+    struct Conn *conn = conn_alloc();
+    if (!conn) {
+        close(cqe->res);
+        return;
+    }
+    conn_init(conn, cqe->res);
+    uring_arm_recv(conn);
+}
+
+static void uring_on_recv(io_uring_cqe *cqe, Conn *conn) {
+    if (cqe->res == -ENOBUFS) {
+        g_uring.starved.push_back(conn); // this batch used up all the buffers
+        return;
+    }
+    if (cqe->res <= 0) {
+        if (cqe->res < 0) {
+            msg("recv() error");
+        }
+        else {
+            msg("EOF");
+        }
+        uring_close(conn);
+        return;
+    }
+    assert(cqe->flags & IORING_CQE_F_BUFFER);
+    conn_activity(conn);
+    uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    // the read buffer grows as needed, thus the received buffer goes back to the kernel at once
+    bool ok = buf_append(&conn->read_buffer, uring_buf_addr(&g_uring.bufs, bid), (size_t)cqe->res);
+    uring_recycle(bid);
+    if (!ok) {
+        msg("out of memory");
+        uring_close(conn);
+        return;
+    }
+    uring_conn_advance(conn);
+}
+
+static void uring_on_send(io_uring_cqe *cqe, Conn *conn) {
+    if (cqe->res < 0) {
+        msg("send() error");
+        uring_close(conn);
+        return;
+    }
+    conn_activity(conn);
+    outq_consume(&conn->out, (size_t)cqe->res);
+    if (conn->state == STATE_RES && conn->out.bytes <= OUT_LOW_WATER) {
+        conn->state = STATE_REQ; // the client caught up, read requests again
+    }
+    // push the rest of a short send along with the responses of the requests still buffered
+    uring_conn_advance(conn);
+}
+
+/**
+ * @brief the io_uring event loop
+ * 
+ * @param fd : listening socket
+ */
+static void uring_event_loop(int fd) {
+    int err = uring_init(&g_uring.ring, URING_ENTRIES);
+    if (err) {
+        errno = -err;
+        die("io_uring_setup()");
+    }
+    err = uring_setup_buffers(&g_uring.ring, &g_uring.bufs, URING_BGID, URING_BUFFERS, URING_BUFFER_SIZE);
+    if (err) {
+        errno = -err;
+        die("io_uring provided buffers");
+    }
+    uring_arm_accept(fd);
+    dlist_init(&g_timers.idle);
+    g_timers.now = get_monotonic_ms();
+
+    while (true) {
+        // submit everything queued by the previous batch and wait for the next one
+        int ret = uring_submit_and_wait(&g_uring.ring, 1, next_timer_ms());
+        if (ret < 0 && ret != -EBUSY && ret != -ETIME) {
+            errno = -ret;
+            die("io_uring_enter()");
+        }
+        g_uring.msgs.clear();
+        g_timers.now = get_monotonic_ms();
+
+        unsigned head = *g_uring.ring.cq_head;
+        unsigned first = head;
+        io_uring_cqe *cqe = NULL;
+        while ((cqe = uring_peek_cqe(&g_uring.ring, &head))) {
+            g_uring.cq_seen = head;
+            Conn *conn = (Conn *)(uintptr_t)(cqe->user_data & ~(uint64_t)UOP_MASK);
+            switch (cqe->user_data & UOP_MASK) {
+            case 0:
+                // a failed buffer hand-back, successful ones post no completion
+                errno = -cqe->res;
+                die("io_uring provide buffers");
+                break;
+            case UOP_ACCEPT:
+                uring_on_accept(cqe, fd);
+                break;
+            case UOP_RECV:
+                uring_on_recv(cqe, conn);
+                break;
+            case UOP_SEND:
+                uring_on_send(cqe, conn);
+                break;
+            }
+            head++;
+        }
+        uring_cq_advance(&g_uring.ring, head);
+
+        if (g_uring.recycled && !g_uring.starved.empty()) {
+            for (Conn *conn : g_uring.starved) {
+                uring_arm_recv(conn);
+            }
+            g_uring.starved.clear();
+        }
+        g_uring.recycled = false;
+        process_timers(uring_reap);
+        process_expire(head == first);
+        process_rehash(head == first);
+    }
+}
+
+/// @brief parse the command line into g_config
+static void parse_args(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--io" && i + 1 < argc) {
+            std::string io = argv[++i];
+            if (io == "uring") {
+                g_config.io_uring = true;
+            }
+            else if (io == "epoll") {
+                g_config.io_uring = false;
+            }
+            else {
+                fprintf(stderr, "unknown io backend: %s\n", io.c_str());
+                exit(1);
+            }
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            g_config.threads = (uint32_t)atoi(argv[++i]);
+            if (g_config.threads < 1) {
+                g_config.threads = 1;
+            }
+        }
+        else if (arg == "--max-request-size" && i + 1 < argc) {
+            unsigned long long n = strtoull(argv[++i], NULL, 10);
+            if (n < 64 || n > UINT32_MAX - HEADER_LEN) {
+                fprintf(stderr, "bad max request size: %s\n", argv[i]);
+                exit(1);
+            }
+            g_config.max_request = (uint32_t)n;
+        }
+        else if (arg == "--idle-timeout" && i + 1 < argc) {
+            g_config.idle_timeout = strtoull(argv[++i], NULL, 10); // ms
+        }
+        else if (arg == "--maxmemory" && i + 1 < argc) {
+            // bytes, or with a k, m or g suffix (powers of 1024) as in redis.conf
+            char *end = NULL;
+            uint64_t n = strtoull(argv[++i], &end, 10);
+            uint64_t unit = 1;
+            if (strcasecmp(end, "k") == 0 || strcasecmp(end, "kb") == 0) {
+                unit = 1024;
+            }
+            else if (strcasecmp(end, "m") == 0 || strcasecmp(end, "mb") == 0) {
+                unit = 1024 * 1024;
+            }
+            else if (strcasecmp(end, "g") == 0 || strcasecmp(end, "gb") == 0) {
+                unit = 1024 * 1024 * 1024;
+            }
+            else if (*end) {
+                fprintf(stderr, "bad maxmemory: %s\n", argv[i]);
+                exit(1);
+            }
+            g_config.maxmemory = n * unit;
+        }
+        else if (arg == "--maxmemory-policy" && i + 1 < argc) {
+            const char *name = argv[++i];
+            size_t p = 0;
+            while (p < sizeof(EVICT_POLICIES) / sizeof(EVICT_POLICIES[0]) && strcmp(EVICT_POLICIES[p], name) != 0) {
+                p++;
+            }
+            if (p == sizeof(EVICT_POLICIES) / sizeof(EVICT_POLICIES[0])) {
+                fprintf(stderr, "bad maxmemory policy: %s\n", name);
+                exit(1);
+            }
+            g_config.evict_policy = (uint32_t)p;
+        }
+        else if (arg == "--zset-btree-min" && i + 1 < argc) {
+            // members from which a sorted set is a B+tree, 0 keeps them all AVL trees
+            zset_set_btree_min((size_t)strtoull(argv[++i], NULL, 10));
+        }
+        else if (arg == "--protocol" && i + 1 < argc) {
+            std::string proto = argv[++i];
+            if (proto == "auto") {
+                g_config.proto = PROTO_NONE;
+            }
+            else if (proto == "custom") {
+                g_config.proto = PROTO_CUSTOM;
+            }
+            else if (proto == "resp") {
+                g_config.proto = PROTO_RESP2; // HELLO 3 still switches to RESP3
+            }
+            else {
+                fprintf(stderr, "unknown protocol: %s\n", proto.c_str());
+                exit(1);
+            }
+        }
+        else if (arg == "--thp") {
+            g_config.thp = true;
+        }
+        else if (arg == "--cpus" && i + 1 < argc) {
+            // comma separated list of cpu ids, e.g. 0,2,4,6
+            for (const char *p = argv[++i]; *p; ) {
+                g_config.cpus.push_back((int)strtol(p, (char **)&p, 10));
+                if (*p == ',') {
+                    p++;
+                }
+                else if (*p) {
+                    fprintf(stderr, "bad cpu list: %s\n", argv[i]);
+                    exit(1);
+                }
+            }
+        }
+        else {
+            fprintf(stderr, "usage: %s [--io epoll|uring] [--threads n] [--cpus c1,c2,...] [--max-request-size bytes] [--idle-timeout ms] [--protocol auto|custom|resp] [--thp] [--maxmemory bytes] [--maxmemory-policy noeviction|allkeys-lru|allkeys-lfu|volatile-lru|volatile-lfu] [--zset-btree-min members]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (g_config.io_uring && g_config.threads > 1) {
+        fprintf(stderr, "--threads needs the epoll backend\n");
+        exit(1);
+    }
+}
+
+/// @brief create the non-blocking listening socket on port 3001, with SO_REUSEPORT every 
+/// reactor thread gets its own socket and the kernel spreads the new connections among them
+/// @param reuse_port : set SO_REUSEPORT
+/// @return listening fd
+static int create_listener(bool reuse_port) {
     // AF_INET is for IPv4, and AF_INET6 is for ipv6
     // Sock stream is for TCP
-    printf("Server started \n");
-
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) {
         die("socket()");
@@ -515,6 +2700,9 @@ int main() {
     // SOL_SOCKET tells at which level this option i.e SO_REUSEADDR is defined 
     // in this case it defined at the level of socket, &val is a pointer to the value
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    if (reuse_port) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+    }
 
     // bind to the socket 
 
@@ -536,73 +2724,84 @@ int main() {
         die("listen()");
     }
 
-    printf("Server started listening on port...\n");
-
-    // a map of all client connection, keyed by fd 
-
-    std::vector<Conn*> fd_to_conn;
-    
     // set the listener fd to non-blocking
     set_fd_to_non_blocking(fd);
+    return fd;
+}
 
-    // the event loop 
-
-    std::vector<struct pollfd> poll_args; 
-    
-    while (true) {
-        // clear every things whatever you were polling.
-        poll_args.clear();
-        // put the listener fd at the first position (known position)
-        struct pollfd listener_poller_fd = {fd, POLLIN, 0}; // int fd, short events, short revents(event send by kernel and kernel will update this when we report event)
-        // POLLIN is an event and it means POLLIN indicates that you want to monitor the file descriptor 
-        // for read readiness, i.e., you are interested in reading data from this 
-        // file descriptor.
-        poll_args.push_back(listener_poller_fd);
-        for (Conn* conn : fd_to_conn) {
-            if (!conn) {
-                continue;
-            }
-            struct pollfd pfd = {};
-            // if we have send req, then we are open for reads i.e POLLIN
-            // else we are open for writes, i.e POLLOUT POLLOUT indicates that you want to 
-            // monitor the file descriptor for write readiness
-            pfd.fd = conn->fd; 
-            pfd.events = (conn->state == STATE_REQ) ? POLLIN: POLLOUT; 
-            pfd.events = pfd.events | POLLERR; // error conditions with the pollfd 
-            poll_args.push_back(pfd);
-        }
-        // poll for active fds 
-        // the timeout arguments doesn't matter here 
-
-        // typedef unsigned long int nfds_t;
-        // since poll take array as first element, thus .data() is used thus a pointer can hold this 
-        // poll signature: int poll(struct pollfd *fds, nfds_t nfds, int timeout);
-        int return_value = poll(poll_args.data(), (nfds_t)poll_args.size(), 1000);
-        if (return_value < 0) {
-            die("poll");
-        }
-
-        // now process all the active connections
-        for (size_t i = 1; i < poll_args.size(); ++i) {
-            if (poll_args[i].revents) {
-                Conn *conn = fd_to_conn[poll_args[i].fd];
-                connection_io(conn);
-                if (conn->state == STATE_END) {
-                    fd_to_conn[conn->fd] = NULL; // set mapping to null
-                    (void)close(conn->fd); // close the resource 
-                    free(conn); // free the memory allocated by malloc
-                }
-            }
+/// @brief create the reactors and their mailboxes, all of them exist before any thread runs
+static void create_shards() {
+    uint32_t n = g_config.threads;
+    for (uint32_t i = 0; i < n; i++) {
+        Shard *shard = new Shard();
+        shard->id = i;
+        shard->efd = eventfd(0, EFD_NONBLOCK);
+        if (shard->efd < 0) {
+            die("eventfd()");
         }
-
-        // try to accept a new connection if the listening fd is active 
-        if (poll_args[0].revents) {
-            (void)accept_new_connection(fd_to_conn, fd);
+        shard->inbox.resize(n, NULL);
+        for (uint32_t from = 0; from < n; from++) {
+            if (from != i) {
+                shard->inbox[from] = new SpscQueue();
+            }
         }
+        shard->backlog.resize(n);
+        shard->wake.resize(n, false);
+        g_shards.push_back(shard);
     }
+}
 
+/// @brief pin the calling thread to the cpu configured for reactor id
+static void pin_thread(uint32_t id) {
+    if (g_config.cpus.empty()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(g_config.cpus[id % g_config.cpus.size()], &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) {
+        errno = err;
+        die("pthread_setaffinity_np()");
+    }
+}
 
-    return 0;
+/// @brief body of reactor thread id
+static void reactor_main(uint32_t id, int fd) {
+    pin_thread(id);
+    epoll_event_loop(g_shards[id], fd);
 }
 
+int main(int argc, char **argv) {
+    parse_args(argc, argv);
+    signal(SIGPIPE, SIG_IGN); // a client gone while we write is reported by writev() as EPIPE
+    g_hash_seed = hash_seed_random();
+    slab_set_thp(g_config.thp);
+    printf("Server started \n");
+
+    if (g_config.io_uring) {
+        int fd = create_listener(false);
+        printf("Server started listening on port...\n");
+        uring_event_loop(fd);
+        return 0;
+    }
+
+    // shared nothing: every reactor has its own listening socket, loop and keyspace shard,
+    // all the sockets are bound before any thread starts so that a bind failure is fatal
+    create_shards();
+    std::vector<int> listeners;
+    for (uint32_t i = 0; i < g_config.threads; i++) {
+        listeners.push_back(create_listener(g_config.threads > 1));
+    }
+    printf("Server started listening on port...\n");
 
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < g_config.threads; i++) {
+        threads.emplace_back(reactor_main, i, listeners[i]);
+    }
+    reactor_main(0, listeners[0]); // the main thread is reactor 0
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    return 0;
+}
@@ -0,0 +1,258 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "slab.h"
+
+const size_t SLAB_BYTES = 64 * 1024;
+const size_t REGION_BYTES = 2 * 1024 * 1024; // a huge page
+const size_t SLAB_BATCH = 64; // objects moved between a thread and the depot at once
+const size_t SLAB_MAX_FREE = 4 * SLAB_BATCH; // free objects of a class a thread keeps
+
+// the classes: 16 bytes apart up to 256, where most of the entries are, then 4 per power of 2
+// up to SLAB_MAX, so that at most a fifth of a larger object is lost to the rounding
+static constexpr uint32_t CLASS_SIZES[] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240, 256,
+    320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+};
+const size_t NUM_CLASSES = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+static_assert(CLASS_SIZES[NUM_CLASSES - 1] == SLAB_MAX, "the last class is SLAB_MAX");
+
+// the class of every size, in steps of 16 bytes
+struct ClassIndex {
+    uint8_t of[SLAB_MAX / 16 + 1] = {};
+    constexpr ClassIndex() {
+        size_t cls = 0;
+        for (size_t i = 0; i <= SLAB_MAX / 16; i++) {
+            while (CLASS_SIZES[cls] < i * 16) {
+                cls++;
+            }
+            of[i] = (uint8_t)cls;
+        }
+    }
+};
+
+static constexpr ClassIndex CLASS_INDEX;
+
+static inline size_t size_class(size_t size) {
+    return CLASS_INDEX.of[(size + 15) / 16];
+}
+
+// a free object, the list goes through the objects themselves
+struct SlabFree {
+    SlabFree *next;
+};
+
+// a chain of SLAB_BATCH free objects in the depot
+struct SlabBatch {
+    SlabFree *head = NULL;
+    size_t count = 0;
+};
+
+struct SlabClass {
+    SlabFree *free = NULL;
+    size_t nfree = 0;
+    uint8_t *bump = NULL; // not yet handed out part of the slab being cut
+    uint8_t *bump_end = NULL;
+};
+
+// the lists of a thread. Like the buffer pools the counters are only written by the owner
+// thread, an object freed by another thread than the one it came from makes the per thread
+// live count off but the sum right
+struct SlabCache {
+    SlabClass classes[NUM_CLASSES];
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> live_bytes{0};
+    std::atomic<int64_t> cached{0};
+    std::atomic<int64_t> large{0};
+};
+
+static std::mutex g_slab_mu; // the regions, the depot and the list of caches
+static std::vector<SlabCache *> g_caches; // never freed
+static std::vector<SlabBatch> g_depot[NUM_CLASSES];
+static uint8_t *g_region = NULL; // the rest of the region slabs are cut out of
+static uint8_t *g_region_end = NULL;
+static int64_t g_slabs = 0;
+static int64_t g_region_bytes = 0;
+static int64_t g_depot_cached = 0;
+static bool g_thp = false;
+static thread_local SlabCache *t_cache = NULL;
+
+static SlabCache *cache_self() {
+    if (!t_cache) {
+        t_cache = new SlabCache();
+        std::lock_guard<std::mutex> lock(g_slab_mu);
+        g_caches.push_back(t_cache);
+    }
+    return t_cache;
+}
+
+static void counter_add(std::atomic<int64_t> &counter, int64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/**
+ * @brief map a region aligned to a huge page, more is mapped than needed and the ends are
+ * unmapped, as mmap only aligns to a page. With THP in madvise mode the kernel backs it with
+ * huge pages once we ask for them
+ * @return false if out of memory, g_slab_mu is held
+ */
+static bool region_new() {
+    uint8_t *mem = (uint8_t *)mmap(NULL, 2 * REGION_BYTES, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    uint8_t *start = (uint8_t *)(((uintptr_t)mem + REGION_BYTES - 1) & ~(uintptr_t)(REGION_BYTES - 1));
+    if (start > mem) {
+        munmap(mem, start - mem);
+    }
+    munmap(start + REGION_BYTES, mem + REGION_BYTES - start);
+    if (g_thp) {
+        madvise(start, REGION_BYTES, MADV_HUGEPAGE); // only a hint, 4KB pages if it fails
+    }
+    g_region = start;
+    g_region_end = start + REGION_BYTES;
+    g_region_bytes += REGION_BYTES;
+    return true;
+}
+
+/// @brief refill the list of a class from the depot, else start cutting a new slab
+/// @return false if out of memory
+static bool class_refill(SlabCache *cache, size_t cls) {
+    SlabClass *sc = &cache->classes[cls];
+    std::lock_guard<std::mutex> lock(g_slab_mu);
+    if (!g_depot[cls].empty()) {
+        SlabBatch batch = g_depot[cls].back();
+        g_depot[cls].pop_back();
+        g_depot_cached -= batch.count;
+        sc->free = batch.head;
+        sc->nfree = batch.count;
+        counter_add(cache->cached, batch.count);
+        return true;
+    }
+    if (g_region == g_region_end && !region_new()) {
+        return false;
+    }
+    sc->bump = g_region;
+    // the tail of a slab smaller than an object is left unused
+    sc->bump_end = g_region + SLAB_BYTES / CLASS_SIZES[cls] * CLASS_SIZES[cls];
+    g_region += SLAB_BYTES;
+    g_slabs++;
+    return true;
+}
+
+/// @brief hand SLAB_BATCH free objects of a class over to the depot, for the other threads
+static void class_flush(SlabCache *cache, size_t cls) {
+    SlabClass *sc = &cache->classes[cls];
+    SlabBatch batch;
+    batch.head = sc->free;
+    SlabFree *last = sc->free;
+    for (size_t i = 1; i < SLAB_BATCH; i++) {
+        last = last->next;
+    }
+    sc->free = last->next;
+    last->next = NULL;
+    batch.count = SLAB_BATCH;
+    sc->nfree -= SLAB_BATCH;
+    counter_add(cache->cached, -(int64_t)SLAB_BATCH);
+    std::lock_guard<std::mutex> lock(g_slab_mu);
+    g_depot[cls].push_back(batch);
+    g_depot_cached += SLAB_BATCH;
+}
+
+/// @brief the bytes an allocation of size really has, the caller may use all of them
+size_t slab_size(size_t size) {
+    return size > SLAB_MAX ? size : CLASS_SIZES[size_class(size)];
+}
+
+/**
+ * @brief an object of at least size bytes, aligned to 16 bytes
+ * @param size : slab_free() needs it back, or any size of the same slab_size()
+ * @return NULL if out of memory
+ */
+void *slab_alloc(size_t size) {
+    SlabCache *cache = cache_self();
+    if (size > SLAB_MAX) {
+        void *ptr = malloc(size);
+        if (ptr) {
+            counter_add(cache->large, 1);
+        }
+        return ptr;
+    }
+    size_t cls = size_class(size);
+    SlabClass *sc = &cache->classes[cls];
+    void *ptr = NULL;
+    if (!sc->free && sc->bump == sc->bump_end && !class_refill(cache, cls)) {
+        return NULL;
+    }
+    if (sc->free) {
+        SlabFree *obj = sc->free;
+        sc->free = obj->next;
+        sc->nfree--;
+        counter_add(cache->cached, -1);
+        ptr = obj;
+    }
+    else {
+        ptr = sc->bump;
+        sc->bump += CLASS_SIZES[cls];
+    }
+    counter_add(cache->live, 1);
+    counter_add(cache->live_bytes, CLASS_SIZES[cls]);
+    return ptr;
+}
+
+/// @brief give an object back to the list of this thread
+/// @param size : the size it was allocated with
+void slab_free(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    SlabCache *cache = cache_self();
+    if (size > SLAB_MAX) {
+        free(ptr);
+        counter_add(cache->large, -1);
+        return;
+    }
+    size_t cls = size_class(size);
+    SlabClass *sc = &cache->classes[cls];
+    SlabFree *obj = (SlabFree *)ptr;
+    obj->next = sc->free;
+    sc->free = obj;
+    sc->nfree++;
+    counter_add(cache->cached, 1);
+    counter_add(cache->live, -1);
+    counter_add(cache->live_bytes, -(int64_t)CLASS_SIZES[cls]);
+    if (sc->nfree > SLAB_MAX_FREE) {
+        class_flush(cache, cls);
+    }
+}
+
+/// @brief back the regions mapped from now on with transparent huge pages, before the first
+/// allocation. THP must be in madvise or always mode (/sys/kernel/mm/transparent_hugepage)
+void slab_set_thp(bool on) {
+    std::lock_guard<std::mutex> lock(g_slab_mu);
+    g_thp = on;
+}
+
+/// @brief usage of the slabs of all the threads
+SlabStats slab_stats() {
+    SlabStats stats = {};
+    std::lock_guard<std::mutex> lock(g_slab_mu);
+    stats.slabs = g_slabs;
+    stats.slab_bytes = g_slabs * SLAB_BYTES;
+    stats.region_bytes = g_region_bytes;
+    stats.cached = g_depot_cached;
+    stats.thp = g_thp;
+    for (SlabCache *cache : g_caches) {
+        stats.live += cache->live.load(std::memory_order_relaxed);
+        stats.live_bytes += cache->live_bytes.load(std::memory_order_relaxed);
+        stats.cached += cache->cached.load(std::memory_order_relaxed);
+        stats.large += cache->large.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
@@ -0,0 +1,34 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// allocator of the small fixed size objects of the store (entries, and the nodes of the sorted
+// sets to come): the sizes are rounded up to one of a few classes, and objects of a class are
+// cut out of 64KB slabs. Each thread keeps a free list per class, an allocation or a free is a
+// push or a pop without any lock. A thread which frees more than it allocates hands batches of
+// objects to a shared depot, which the other threads take them from. The slabs come out of 2MB
+// regions, which may be backed by transparent huge pages (slab_set_thp()), thus a large keyspace
+// needs far fewer TLB entries. The memory of the slabs is never given back to the system.
+// A size above SLAB_MAX goes to malloc
+
+static const size_t SLAB_MAX = 2048; // largest class
+
+// basic api to the slabs i.e alloc and free
+
+void *slab_alloc(size_t size);
+void slab_free(void *ptr, size_t size);
+size_t slab_size(size_t size);
+void slab_set_thp(bool on);
+
+// usage of the slabs, summed over all the threads
+struct SlabStats {
+    int64_t slabs = 0; // cut out of the regions so far
+    int64_t slab_bytes = 0;
+    int64_t region_bytes = 0; // mapped, slabs are cut out of them as needed
+    int64_t live = 0; // objects handed out and not freed yet
+    int64_t live_bytes = 0; // their sizes, rounded up to the class
+    int64_t cached = 0; // free objects in the lists of the threads and in the depot
+    int64_t large = 0; // live objects above SLAB_MAX, which malloc holds
+    bool thp = false;
+};
+
+SlabStats slab_stats();
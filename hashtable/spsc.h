@@ -0,0 +1,38 @@
+#include <stddef.h>
+#include <atomic>
+
+// bounded lock-free single producer / single consumer queue of pointers, this is the
+// mailbox between two reactor threads: only the sender pushes and only the receiver pops,
+// thus a release store of the own index and an acquire load of the other side is enough
+
+static const size_t SPSC_CAPACITY = 4096; // power of 2
+
+struct SpscQueue {
+    alignas(64) std::atomic<size_t> head{0}; // next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to push, written by the producer
+    alignas(64) void *slots[SPSC_CAPACITY];
+};
+
+/// @brief producer side, add item at the tail
+/// @return false if the queue is full
+static inline bool spsc_push(SpscQueue *q, void *item) {
+    size_t tail = q->tail.load(std::memory_order_relaxed);
+    if (tail - q->head.load(std::memory_order_acquire) == SPSC_CAPACITY) {
+        return false;
+    }
+    q->slots[tail & (SPSC_CAPACITY - 1)] = item;
+    q->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+/// @brief consumer side, take the item at the head
+/// @return NULL if the queue is empty
+static inline void *spsc_pop(SpscQueue *q) {
+    size_t head = q->head.load(std::memory_order_relaxed);
+    if (head == q->tail.load(std::memory_order_acquire)) {
+        return NULL;
+    }
+    void *item = q->slots[head & (SPSC_CAPACITY - 1)];
+    q->head.store(head + 1, std::memory_order_release);
+    return item;
+}
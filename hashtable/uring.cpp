@@ -0,0 +1,200 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+// glibc has no wrappers for these, thus the raw syscalls
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+        void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/// @brief create the ring and map the submission and completion queues
+/// @param ring : ring to initialize
+/// @param entries : size of the submission queue (power of 2)
+/// @return 0 on success, -errno on failure
+int uring_init(Uring *ring, unsigned entries) {
+    io_uring_params params = {};
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    int fd = sys_io_uring_setup(entries, &params);
+    if (fd < 0 && errno == EINVAL) {
+        // older kernel, run the completions the default way
+        params = io_uring_params{};
+        fd = sys_io_uring_setup(entries, &params);
+    }
+    if (fd < 0) {
+        return -errno;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_SUBMIT_STABLE)) {
+        close(fd);
+        return -ENOSYS; // too old, not worth supporting
+    }
+    ring->fd = fd;
+    ring->features = params.features;
+
+    // with SINGLE_MMAP both the rings live in one mapping
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = ring->sq_ring_size;
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    ring->cq_ring = ring->sq_ring;
+
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = (io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        int err = errno;
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(fd);
+        return -err;
+    }
+
+    uint8_t *sq = (uint8_t *)ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    // the indirection array is never used, slot i always points to sqe i
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    uint8_t *cq = (uint8_t *)ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/// @brief get a zeroed sqe to fill, it is handed to the kernel on the next submit, if the
+/// submission queue is full then the queued ones are pushed to the kernel first
+/// @param ring
+/// @return sqe, NULL if the queue is still full: the kernel refused the submission or took
+/// none of it (e.g. -EBUSY while its completion queue is full), the caller submits again later
+io_uring_sqe *uring_get_sqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        (void)uring_submit_and_wait(ring, 0, -1);
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sqe_tail - head >= ring->sq_entries) {
+            return NULL; // a partial submission leaves the rest in place, not overwritten
+        }
+    }
+    io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/// @brief publish all the queued sqes and wait for wait_nr completions, in one syscall
+/// @param timeout_ms : give up waiting after this long, -1 waits for ever (also when the kernel
+/// has no IORING_FEAT_EXT_ARG, as then the timeout would need a sqe of its own)
+/// @return number of submitted sqes, or -errno (-ETIME once the timeout expired)
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr, int timeout_ms) {
+    unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    __kernel_timespec ts = {};
+    io_uring_getevents_arg arg = {};
+    void *argp = NULL;
+    size_t argsz = 0;
+    if (wait_nr && timeout_ms >= 0 && (ring->features & IORING_FEAT_EXT_ARG)) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        argp = &arg;
+        argsz = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    int ret = 0;
+    do {
+        ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags, argp, argsz);
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? -errno : ret;
+}
+
+/// @brief look at the completion at position *head, the caller walks the queue by
+/// incrementing head and gives all the seen entries back with uring_cq_advance()
+/// @return NULL once all the completions are consumed
+io_uring_cqe *uring_peek_cqe(Uring *ring, unsigned *head) {
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (*head == tail) {
+        return NULL;
+    }
+    return &ring->cqes[*head & ring->cq_mask];
+}
+
+void uring_cq_advance(Uring *ring, unsigned head) {
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+void uring_destroy(Uring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    *ring = Uring{};
+}
+
+/// @brief queue a sqe handing count buffers, starting at bid, back to the kernel
+static int uring_provide(Uring *ring, UringBufGroup *bufs, uint16_t bid, unsigned count) {
+    io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe) {
+        return -EBUSY;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = (int)count;
+    sqe->addr = (uint64_t)(uintptr_t)uring_buf_addr(bufs, bid);
+    sqe->len = (uint32_t)bufs->buf_size;
+    sqe->off = bid;
+    sqe->buf_group = bufs->bgid;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS; // only a failure is worth a completion
+    sqe->user_data = 0;
+    return 0;
+}
+
+/// @brief allocate entries buffers of buf_size and hand them to the kernel as group bgid,
+/// the buffers are provided with the next submit
+/// @return 0 on success, -errno on failure
+int uring_setup_buffers(Uring *ring, UringBufGroup *bufs, uint16_t bgid, unsigned entries, size_t buf_size) {
+    assert(entries > 0 && entries <= 65536);
+    bufs->base = (uint8_t *)malloc(entries * buf_size);
+    if (!bufs->base) {
+        return -ENOMEM;
+    }
+    bufs->entries = entries;
+    bufs->buf_size = buf_size;
+    bufs->bgid = bgid;
+    return uring_provide(ring, bufs, 0, entries);
+}
+
+uint8_t *uring_buf_addr(UringBufGroup *bufs, uint16_t bid) {
+    return &bufs->base[bid * bufs->buf_size];
+}
+
+/// @brief hand buffer bid back to the kernel so that a later recv can pick it, this rides on
+/// the next submit, i.e. it costs no extra syscall
+int uring_buf_recycle(Uring *ring, UringBufGroup *bufs, uint16_t bid) {
+    return uring_provide(ring, bufs, bid, 1);
+}
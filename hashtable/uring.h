@@ -0,0 +1,52 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// a minimal io_uring wrapper (no liburing), just enough for the server event loop:
+// the two mmap-ed rings, sqe allocation, a single submit+wait syscall, and a
+// provided buffer group so that a recv picks its buffer only when data arrives
+
+struct Uring {
+    int fd = -1;
+    // submission queue, shared with the kernel
+    unsigned *sq_head = NULL;
+    unsigned *sq_tail = NULL;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    io_uring_sqe *sqes = NULL;
+    unsigned sqe_tail = 0; // local tail, published to *sq_tail on submit
+    unsigned features = 0; // IORING_FEAT_* of the kernel
+    // completion queue, shared with the kernel
+    unsigned *cq_head = NULL;
+    unsigned *cq_tail = NULL;
+    unsigned cq_mask = 0;
+    io_uring_cqe *cqes = NULL;
+    // mappings to undo on destroy
+    void *sq_ring = NULL;
+    size_t sq_ring_size = 0;
+    void *cq_ring = NULL;
+    size_t cq_ring_size = 0;
+    size_t sqes_size = 0;
+};
+
+// a group of equally sized buffers handed to the kernel, recv picks one (IOSQE_BUFFER_SELECT)
+// and reports its id in the cqe, the buffer goes back to the kernel with uring_buf_recycle()
+struct UringBufGroup {
+    uint8_t *base = NULL;
+    unsigned entries = 0;
+    size_t buf_size = 0;
+    uint16_t bgid = 0;
+};
+
+// basic api to the ring, i.e init, get_sqe, submit, completions and destroy
+
+int uring_init(Uring *ring, unsigned entries);
+io_uring_sqe *uring_get_sqe(Uring *ring);
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr, int timeout_ms);
+io_uring_cqe *uring_peek_cqe(Uring *ring, unsigned *head);
+void uring_cq_advance(Uring *ring, unsigned head);
+void uring_destroy(Uring *ring);
+
+int uring_setup_buffers(Uring *ring, UringBufGroup *bufs, uint16_t bgid, unsigned entries, size_t buf_size);
+uint8_t *uring_buf_addr(UringBufGroup *bufs, uint16_t bid);
+int uring_buf_recycle(Uring *ring, UringBufGroup *bufs, uint16_t bid);
@@ -0,0 +1,363 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "hashmap.h"
+#include "hash.h"
+#include "protocol.h"
+#include "slab.h"
+#include "avl.h"
+#include "btree.h"
+#include "zset.h"
+
+// a batch of members added at once whose size is at least this, and a quarter of the set, has
+// the tree built anew (see zset_add_many())
+static const size_t ZSET_BULK_MIN = 64;
+
+// the size from which a set is a B+tree, 0 for never, see zset_set_btree_min()
+static size_t g_btree_min = 1024;
+
+/// @brief the number of members from which a set moves from the AVL tree to a B+tree, 0 to keep
+/// them all AVL. Set before the threads start, it is read by all of them
+void zset_set_btree_min(size_t n) {
+    g_btree_min = n;
+}
+
+/// @brief the seed of the member hash, drawn once by the first thread which needs it
+static uint64_t zset_seed() {
+    static const uint64_t seed = hash_seed_random();
+    return seed;
+}
+
+struct ZMemberHash {
+    uint64_t operator()(Slice name) const {
+        return hash_bytes(name.ptr, name.len, zset_seed());
+    }
+};
+
+struct ZMemberEq {
+    bool operator()(const ZNode *znode, Slice name) const {
+        return znode->len == name.len && memcmp(znode + 1, name.ptr, name.len) == 0;
+    }
+};
+
+static size_t znode_size(size_t len) {
+    return sizeof(ZNode) + len;
+}
+
+/// @return NULL if out of memory
+static ZNode *znode_new(Slice name, uint64_t hcode, double score) {
+    void *mem = slab_alloc(znode_size(name.len));
+    if (!mem) {
+        return NULL;
+    }
+    ZNode *znode = new (mem) ZNode();
+    avl_init(&znode->tree);
+    znode->node.hcode = hcode;
+    znode->score = score;
+    znode->len = (uint32_t)name.len;
+    memcpy(znode + 1, name.ptr, name.len);
+    return znode;
+}
+
+static void znode_del(ZNode *znode) {
+    size_t size = znode_size(znode->len);
+    znode->~ZNode();
+    slab_free(znode, size);
+}
+
+/// @brief the order of the tree: by score, then by name
+static bool zless(const ZNode *znode, double score, Slice name) {
+    if (znode->score != score) {
+        return znode->score < score;
+    }
+    size_t n = znode->len < name.len ? znode->len : name.len;
+    int r = memcmp(znode + 1, name.ptr, n);
+    return r != 0 ? r < 0 : znode->len < name.len;
+}
+
+/// @brief the order of the B+tree for equal scores, by name
+static bool zname_less(const void *a, const void *b) {
+    const ZNode *znode = (const ZNode *)a;
+    return zless(znode, znode->score, znode_name((const ZNode *)b));
+}
+
+/// @brief put a node into the tree, walking down from the root like the add() of avl_tree
+static void tree_insert(ZSet *zset, ZNode *znode) {
+    Slice name = znode_name(znode);
+    AVLnode *parent = NULL;
+    AVLnode **from = &zset->tree;
+    while (*from) {
+        parent = *from;
+        from = zless(znode_of(parent), znode->score, name) ? &parent->right : &parent->left;
+    }
+    *from = &znode->tree;
+    znode->tree.parent = parent;
+    zset->tree = avl_fix(&znode->tree);
+}
+
+/// @return NULL if out of memory
+ZSet *zset_new() {
+    void *mem = slab_alloc(sizeof(ZSet));
+    if (!mem) {
+        return NULL;
+    }
+    ZSet *zset = new (mem) ZSet();
+    zset->btree.less = zname_less;
+    return zset;
+}
+
+static void tree_free(AVLnode *node) {
+    if (!node) {
+        return;
+    }
+    tree_free(node->left); // the depth is at most 1.44 log2(n)
+    tree_free(node->right);
+    znode_del(znode_of(node));
+}
+
+/// @brief free the set and all its members, O(n)
+void zset_del(ZSet *zset) {
+    if (zset->use_btree) {
+        for (BtPos pos = bt_at(&zset->btree, 0); pos.leaf;) {
+            ZNode *znode = (ZNode *)bt_item(pos);
+            bt_next(&pos);
+            znode_del(znode);
+        }
+        bt_free(&zset->btree);
+    }
+    tree_free(zset->tree);
+    // the nodes are gone, the tables are freed without popping them one by one
+    zset->members.map.ht1.size = zset->members.map.ht2.size = 0;
+    hmap_destroy(&zset->members);
+    zset->~ZSet();
+    slab_free(zset, sizeof(ZSet));
+}
+
+/**
+ * @brief move a set which has grown large from the AVL tree to a B+tree, built from its members
+ * in order in O(n). It stays an AVL tree if out of memory, trying again on the next add
+ */
+static void to_btree(ZSet *zset) {
+    std::vector<double> keys;
+    std::vector<void *> items;
+    keys.reserve(zset_len(zset));
+    items.reserve(zset_len(zset));
+    for (AVLnode *node = avl_at(zset->tree, 0); node; node = avl_next(node)) {
+        keys.push_back(znode_of(node)->score);
+        items.push_back(znode_of(node));
+    }
+    if (bt_build(&zset->btree, keys.data(), items.data(), items.size())) {
+        zset->tree = NULL;
+        zset->use_btree = true;
+    }
+}
+
+/**
+ * @brief add a member, or move it to its new score
+ * @param added : true if the member is new
+ * @return false if out of memory, the set is unchanged
+ */
+bool zset_add(ZSet *zset, Slice name, double score, bool *added) {
+    uint64_t hcode = ZMemberHash()(name);
+    ZNode *znode = hmap_lookup(&zset->members, name, hcode);
+    *added = !znode;
+    if (znode && znode->score == score) {
+        return true;
+    }
+    if (znode && zset->use_btree) {
+        // in at the new score first, the only step which allocates, then out of the old one
+        if (!bt_insert(&zset->btree, score, znode)) {
+            return false;
+        }
+        bt_delete(&zset->btree, znode->score, znode);
+        znode->score = score;
+        return true;
+    }
+    if (znode) {
+        zset->tree = avl_del(&znode->tree);
+        avl_init(&znode->tree);
+        znode->score = score;
+        tree_insert(zset, znode);
+        return true;
+    }
+    if (!(znode = znode_new(name, hcode, score))) {
+        return false;
+    }
+    if (zset->use_btree && !bt_insert(&zset->btree, score, znode)) {
+        znode_del(znode);
+        return false;
+    }
+    hmap_insert(&zset->members, znode);
+    if (!zset->use_btree) {
+        tree_insert(zset, znode);
+        if (g_btree_min > 0 && zset_len(zset) >= g_btree_min) {
+            to_btree(zset);
+        }
+    }
+    zset->mem += slab_size(znode_size(name.len));
+    return true;
+}
+
+// a member in the array the tree is built from, the score is copied there, thus sorting
+// touches the nodes only for the names of equal scores
+struct ZSorted {
+    double score;
+    ZNode *znode;
+};
+
+/**
+ * @brief add many members at once, or move them to their new scores. A batch which is large
+ * next to the set, e.g. a set loaded by a single ZADD, does not go into the tree one by one:
+ * the members go into the hashmap, then all the nodes, the old ones as well, are sorted as an
+ * array and avl_build(), or bt_build() for a set as large as zset_set_btree_min(), links them
+ * into a new tree in O(n). n inserts cost a cache miss per level of the tree each, the sort
+ * mostly reads the array
+ * @param added : members which are new
+ * @return false if out of memory, the members before the one which failed are in the set
+ */
+bool zset_add_many(ZSet *zset, const Slice *names, const double *scores, size_t n, size_t *added) {
+    *added = 0;
+    if (n < ZSET_BULK_MIN || n < zset_len(zset) / 4) {
+        for (size_t i = 0; i < n; i++) {
+            bool is_new = false;
+            if (!zset_add(zset, names[i], scores[i], &is_new)) {
+                return false;
+            }
+            *added += is_new;
+        }
+        return true;
+    }
+    std::vector<ZSorted> sorted;
+    sorted.reserve(zset_len(zset) + n);
+    for (ZIter it = zset_iter(zset, 0); it.znode; zset_iter_next(zset, &it)) {
+        sorted.push_back(ZSorted{0, it.znode});
+    }
+    bool ok = true;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t hcode = ZMemberHash()(names[i]);
+        ZNode *znode = hmap_lookup(&zset->members, names[i], hcode);
+        if (znode) {
+            znode->score = scores[i]; // the tree is built anew, the order does not matter yet
+            continue;
+        }
+        if (!(znode = znode_new(names[i], hcode, scores[i]))) {
+            ok = false;
+            break;
+        }
+        hmap_insert(&zset->members, znode);
+        zset->mem += slab_size(znode_size(names[i].len));
+        sorted.push_back(ZSorted{0, znode});
+        *added += 1;
+    }
+    for (ZSorted &item : sorted) {
+        item.score = item.znode->score;
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const ZSorted &a, const ZSorted &b) {
+        return a.score != b.score ? a.score < b.score : zless(a.znode, b.score, znode_name(b.znode));
+    });
+    if (zset->use_btree || (g_btree_min > 0 && sorted.size() >= g_btree_min)) {
+        std::vector<double> keys(sorted.size());
+        std::vector<void *> items(sorted.size());
+        for (size_t i = 0; i < sorted.size(); i++) {
+            keys[i] = sorted[i].score;
+            items[i] = sorted[i].znode;
+        }
+        bt_free(&zset->btree);
+        zset->use_btree = bt_build(&zset->btree, keys.data(), items.data(), items.size());
+        if (zset->use_btree) {
+            zset->tree = NULL;
+            return ok;
+        }
+        // out of memory, back to an AVL tree, which needs none
+    }
+    std::vector<AVLnode *> nodes(sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        nodes[i] = &sorted[i].znode->tree;
+    }
+    zset->tree = avl_build(nodes.data(), nodes.size());
+    return ok;
+}
+
+/// @return NULL if name is not a member
+ZNode *zset_lookup(ZSet *zset, Slice name) {
+    return hmap_lookup(&zset->members, name);
+}
+
+/// @brief remove a member
+/// @return false if name is not a member
+bool zset_pop(ZSet *zset, Slice name) {
+    ZNode *znode = hmap_pop(&zset->members, name);
+    if (!znode) {
+        return false;
+    }
+    if (zset->use_btree) {
+        bt_delete(&zset->btree, znode->score, znode);
+    }
+    else {
+        zset->tree = avl_del(&znode->tree);
+    }
+    zset->mem -= slab_size(znode_size(znode->len));
+    znode_del(znode);
+    return true;
+}
+
+/// @brief the position of a member in the order from 0, O(log n)
+uint64_t zset_rank(ZSet *zset, ZNode *znode) {
+    if (zset->use_btree) {
+        return bt_rank(&zset->btree, znode->score, znode);
+    }
+    return avl_rank(&znode->tree);
+}
+
+/// @brief the member at a position in the order, O(log n)
+/// @return NULL if past the end
+ZNode *zset_at(ZSet *zset, uint64_t rank) {
+    return zset_iter(zset, rank).znode;
+}
+
+/**
+ * @brief the rank of the first member of a score range, walking down from the root once
+ * @param after : the first one whose score is above score, else at least score
+ * @return the length of the set if every score is below
+ */
+uint64_t zset_seek(ZSet *zset, double score, bool after) {
+    if (zset->use_btree) {
+        return bt_seek(&zset->btree, score, after);
+    }
+    uint64_t rank = 0;
+    AVLnode *node = zset->tree;
+    while (node) {
+        double s = znode_of(node)->score;
+        if (after ? s > score : s >= score) {
+            node = node->left; // a candidate, a closer one may be on its left
+        }
+        else {
+            rank += avl_cnt(node->left) + 1;
+            node = node->right;
+        }
+    }
+    return rank;
+}
+
+/// @brief the position of a rank, to walk the members from there with zset_iter_next(), O(log n)
+ZIter zset_iter(ZSet *zset, uint64_t rank) {
+    ZIter it;
+    if (zset->use_btree) {
+        it.pos = bt_at(&zset->btree, rank);
+        it.znode = (ZNode *)bt_item(it.pos);
+    }
+    else {
+        it.znode = znode_of(avl_at(zset->tree, rank));
+    }
+    return it;
+}
+
+/// @brief bytes the set holds: its nodes, its tables and itself
+size_t zset_mem(const ZSet *zset) {
+    return slab_size(sizeof(ZSet)) + zset->mem + zset->btree.bytes + hmap_bytes(&zset->members);
+}
@@ -0,0 +1,79 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// a sorted set: members with a score, ordered by (score, member). A member is one ZNode, in a
+// hashmap by its name, which finds the node of a member in O(1) (ZSCORE, ZREM), and in an AVL
+// tree by (score, name), whose cnt fields give ranks (ZRANK, ZRANGE) in O(log n). A set which
+// grows to zset_set_btree_min() members moves to a B+tree (btree.h) for good, fewer cache misses
+// per lookup where the tree no longer fits in the cache. The nodes are cut out of the slabs
+// (slab.h), like the entries.
+// Goes after hashmap.h, protocol.h, slab.h, avl.h and btree.h, for HMap, Slice, AVLnode and BTree
+
+struct ZNode {
+    AVLnode tree; // in ZSet::tree, unused once the set is a B+tree
+    Hnode node; // in ZSet::members
+    double score = 0;
+    uint32_t len = 0;
+    // the name of the member
+};
+
+// the policies of the members map, with the seed of the set hash, in zset.cpp
+struct ZMemberHash;
+struct ZMemberEq;
+
+struct ZSet {
+    AVLnode *tree = NULL; // the root
+    BTree btree; // the order instead of tree with use_btree
+    bool use_btree = false;
+    HMap<ZNode, ZMemberHash, ZMemberEq> members;
+    size_t mem = 0; // bytes of the nodes, see zset_mem()
+};
+
+// a position in the order of a set, for walking a range
+struct ZIter {
+    ZNode *znode = NULL; // NULL past the end
+    BtPos pos; // of znode in a B+tree
+};
+
+static inline Slice znode_name(const ZNode *znode) {
+    Slice name;
+    name.ptr = (const uint8_t *)(znode + 1);
+    name.len = znode->len;
+    return name;
+}
+
+/// @brief the ZNode an AVLnode is embedded in, NULL for NULL
+static inline ZNode *znode_of(AVLnode *node) {
+    return node ? (ZNode *)((char *)node - offsetof(ZNode, tree)) : NULL;
+}
+
+static inline size_t zset_len(const ZSet *zset) {
+    return zset->use_btree ? zset->btree.len : avl_cnt(zset->tree);
+}
+
+/// @brief the member after the one of it, in O(1) on average
+static inline void zset_iter_next(ZSet *zset, ZIter *it) {
+    if (zset->use_btree) {
+        bt_next(&it->pos);
+        it->znode = (ZNode *)bt_item(it->pos);
+    }
+    else {
+        it->znode = znode_of(avl_next(&it->znode->tree));
+    }
+}
+
+// basic api to the sorted sets i.e new, add, lookup, pop, rank, select, seek and walk
+
+void zset_set_btree_min(size_t n);
+
+ZSet *zset_new();
+void zset_del(ZSet *zset);
+bool zset_add(ZSet *zset, Slice name, double score, bool *added);
+bool zset_add_many(ZSet *zset, const Slice *names, const double *scores, size_t n, size_t *added);
+ZNode *zset_lookup(ZSet *zset, Slice name);
+bool zset_pop(ZSet *zset, Slice name);
+uint64_t zset_rank(ZSet *zset, ZNode *znode);
+ZNode *zset_at(ZSet *zset, uint64_t rank);
+uint64_t zset_seek(ZSet *zset, double score, bool after);
+ZIter zset_iter(ZSet *zset, uint64_t rank);
+size_t zset_mem(const ZSet *zset);
@@ -0,0 +1,301 @@
+#undef NDEBUG // the asserts are the checks, keep them in any build
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "hashmap.h"
+#include "protocol.h"
+#include "slab.h"
+#include "avl.h"
+#include "btree.h"
+#include "zset.h"
+
+// randomized test of the sorted sets over both orders: random adds, moves, removes and bulk
+// adds, each one followed by a check of the tree (AVL or B+tree) and of the order, rank, select
+// and seek against a std::set model. Few scores, thus many members share a score and are
+// ordered by name.
+// Usage: ./zset_test [rounds] [seed]
+
+static const uint32_t SCORES = 50;
+
+struct Model {
+    std::set<std::pair<double, std::string>> order;
+    std::map<std::string, double> scores;
+};
+
+static Slice slice_of(const std::string &s) {
+    Slice slice;
+    slice.ptr = (const uint8_t *)s.data();
+    slice.len = s.size();
+    return slice;
+}
+
+static std::string name_of(const ZNode *znode) {
+    Slice name = znode_name(znode);
+    return std::string((const char *)name.ptr, name.len);
+}
+
+static double random_score() {
+    double score = rand() % SCORES;
+    return rand() % 8 ? score : score + 0.25 * (rand() % 4);
+}
+
+static void model_set(Model &m, const std::string &name, double score) {
+    auto it = m.scores.find(name);
+    if (it != m.scores.end()) {
+        m.order.erase({it->second, name});
+    }
+    m.scores[name] = score;
+    m.order.insert({score, name});
+}
+
+static void add(ZSet *zset, Model &m, const std::string &name, double score) {
+    bool added = false;
+    bool ok = zset_add(zset, slice_of(name), score, &added);
+    assert(ok);
+    assert(added == !m.scores.count(name));
+    model_set(m, name, score);
+}
+
+static void del(ZSet *zset, Model &m, const std::string &name) {
+    auto it = m.scores.find(name);
+    bool popped = zset_pop(zset, slice_of(name));
+    assert(popped == (it != m.scores.end()));
+    if (it != m.scores.end()) {
+        m.order.erase({it->second, name});
+        m.scores.erase(it);
+    }
+}
+
+// a batch as ZADD sends it, the names may repeat and the last score wins
+static void add_many(ZSet *zset, Model &m, uint32_t ids) {
+    size_t n = 64 + rand() % 256;
+    std::vector<std::string> names(n);
+    std::vector<Slice> slices(n);
+    std::vector<double> scores(n);
+    std::set<std::string> fresh;
+    for (size_t i = 0; i < n; i++) {
+        names[i] = "m" + std::to_string(rand() % ids);
+        scores[i] = random_score();
+        if (!m.scores.count(names[i])) {
+            fresh.insert(names[i]);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        slices[i] = slice_of(names[i]);
+    }
+    size_t added = 0;
+    bool ok = zset_add_many(zset, slices.data(), scores.data(), n, &added);
+    assert(ok);
+    assert(added == fresh.size());
+    for (size_t i = 0; i < n; i++) {
+        model_set(m, names[i], scores[i]);
+    }
+}
+
+// the parent links, sizes and balance of an AVL subtree, its nodes appended in order
+static void verify_avl(AVLnode *node, AVLnode *parent, std::vector<AVLnode *> &out) {
+    if (!node) {
+        return;
+    }
+    assert(node->parent == parent);
+    verify_avl(node->left, node, out);
+    out.push_back(node);
+    verify_avl(node->right, node, out);
+    uint32_t l = avl_depth(node->left);
+    uint32_t r = avl_depth(node->right);
+    assert(l <= r + 1 && r <= l + 1);
+    assert(node->depth == 1 + std::max(l, r));
+    assert(node->cnt == 1 + avl_cnt(node->left) + avl_cnt(node->right));
+}
+
+// the fill, separators and counts of a B+tree subtree, the items appended in order, returns
+// the items under it
+static uint64_t verify_btree(BtNode *node, bool root, uint32_t depth, uint32_t *leaf_depth,
+                             std::vector<ZNode *> &out) {
+    assert(node->n > 0 && node->n <= BT_FANOUT);
+    assert(root || node->n >= BT_MIN);
+    if (node->leaf) {
+        if (*leaf_depth == 0) {
+            *leaf_depth = depth;
+        }
+        assert(*leaf_depth == depth);
+        for (uint32_t i = 0; i < node->n; i++) {
+            ZNode *znode = (ZNode *)node->items[i];
+            assert(node->keys[i] == znode->score);
+            out.push_back(znode);
+        }
+        return node->n;
+    }
+    BtInner *inner = (BtInner *)node;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < node->n; i++) {
+        BtNode *child = inner->children[i];
+        assert(node->keys[i] == child->keys[0] && node->items[i] == child->items[0]);
+        uint64_t cnt = verify_btree(child, false, depth + 1, leaf_depth, out);
+        assert(cnt == inner->counts[i]);
+        total += cnt;
+    }
+    return total;
+}
+
+static void verify(ZSet *zset, const Model &m) {
+    assert(zset_len(zset) == m.order.size());
+    std::vector<ZNode *> nodes;
+    if (zset->use_btree) {
+        assert(!zset->tree);
+        uint32_t leaf_depth = 0;
+        if (zset->btree.root) {
+            uint64_t cnt = verify_btree(zset->btree.root, true, 1, &leaf_depth, nodes);
+            assert(cnt == m.order.size());
+        }
+        // the leaf links give the same order as the walk down
+        size_t i = 0;
+        BtLeaf *prev = NULL;
+        for (BtPos pos = bt_at(&zset->btree, 0); pos.leaf; bt_next(&pos), i++) {
+            if (pos.slot == 0) {
+                assert(pos.leaf->prev == prev);
+                prev = pos.leaf;
+            }
+            assert(i < nodes.size() && bt_item(pos) == nodes[i]);
+        }
+        assert(i == nodes.size());
+    }
+    else {
+        std::vector<AVLnode *> avl_nodes;
+        verify_avl(zset->tree, NULL, avl_nodes);
+        for (AVLnode *node : avl_nodes) {
+            nodes.push_back(znode_of(node));
+        }
+    }
+
+    // the order, and the members map agrees with it
+    std::vector<double> scores;
+    size_t i = 0;
+    for (const auto &member : m.order) {
+        ZNode *znode = nodes[i++];
+        assert(znode->score == member.first && name_of(znode) == member.second);
+        assert(zset_lookup(zset, slice_of(member.second)) == znode);
+        scores.push_back(member.first);
+    }
+
+    // rank and select, of every member in a small set and a sample in a large one
+    size_t n = nodes.size();
+    for (size_t k = 0; k < std::min<size_t>(n, 64); k++) {
+        uint64_t rank = n <= 64 ? k : rand() % n;
+        assert(zset_rank(zset, nodes[rank]) == rank);
+        assert(zset_at(zset, rank) == nodes[rank]);
+    }
+    assert(!zset_at(zset, n));
+
+    // the walks of the AVL tree from a node: a step back and k steps either way, NULL out of it
+    for (size_t k = 0; !zset->use_btree && k < std::min<size_t>(n, 16); k++) {
+        int64_t rank = rand() % n;
+        int64_t offset = (int64_t)(rand() % (n + 2)) - rank - 1;
+        AVLnode *node = &nodes[rank]->tree;
+        assert(avl_prev(node) == (rank ? &nodes[rank - 1]->tree : NULL));
+        AVLnode *to = avl_offset(node, offset);
+        bool in = rank + offset >= 0 && rank + offset < (int64_t)n;
+        assert(to == (in ? &nodes[rank + offset]->tree : NULL));
+    }
+
+    // seek to scores held by members, between them and out of range, then walk from there
+    for (uint32_t k = 0; k < 8; k++) {
+        double score = (double)(rand() % (SCORES + 2)) - 1;
+        if (k & 1) {
+            score += 0.125;
+        }
+        bool after = k & 2;
+        uint64_t want = after ? std::upper_bound(scores.begin(), scores.end(), score) - scores.begin()
+                              : std::lower_bound(scores.begin(), scores.end(), score) - scores.begin();
+        assert(zset_seek(zset, score, after) == want);
+        ZIter it = zset_iter(zset, want);
+        for (size_t j = want; j < std::min<size_t>(n, want + 16); j++) {
+            assert(it.znode == nodes[j]);
+            zset_iter_next(zset, &it);
+        }
+        if (want + 16 >= n) {
+            assert(!it.znode);
+        }
+    }
+}
+
+/// @brief avl_build() over n nodes in order, for every n up to max
+static void run_avl_build(size_t max) {
+    std::vector<AVLnode> pool(max);
+    std::vector<AVLnode *> nodes(max);
+    for (size_t n = 0; n <= max; n++) {
+        for (size_t i = 0; i < n; i++) {
+            pool[i] = AVLnode();
+            nodes[i] = &pool[i];
+        }
+        AVLnode *root = avl_build(nodes.data(), n);
+        std::vector<AVLnode *> order;
+        verify_avl(root, NULL, order);
+        assert(order.size() == n);
+        for (size_t i = 0; i < n; i++) {
+            assert(order[i] == nodes[i] && avl_at(root, i) == nodes[i] && avl_rank(nodes[i]) == i);
+        }
+    }
+    printf("avl_build: every size up to %zu\n", max);
+}
+
+/**
+ * @brief one set through rounds of random operations, adds first then removes, then emptied
+ * member by member. The set must be a B+tree from the first time it holds btree_min members
+ * (0 for never) on, whatever it shrinks to.
+ */
+static void run(size_t btree_min, uint32_t ids, uint32_t rounds) {
+    zset_set_btree_min(btree_min);
+    ZSet *zset = zset_new();
+    Model m;
+    bool grown = false;
+    size_t most = 0;
+    for (uint32_t r = 0; r < rounds; r++) {
+        uint32_t op = rand() % 16;
+        std::string name = "m" + std::to_string(rand() % ids);
+        if (r >= rounds / 2) {
+            op = op < 5 ? op : 8 + op % 8; // mostly removes
+        }
+        if (op < 8) {
+            add(zset, m, name, random_score());
+        }
+        else if (op < 15) {
+            del(zset, m, name);
+        }
+        else {
+            add_many(zset, m, ids);
+        }
+        grown = grown || (btree_min > 0 && m.order.size() >= btree_min);
+        most = std::max(most, m.order.size());
+        assert(zset->use_btree == grown);
+        verify(zset, m);
+    }
+    while (!m.scores.empty()) {
+        auto it = m.scores.begin();
+        std::advance(it, rand() % m.scores.size());
+        del(zset, m, std::string(it->first));
+        assert(zset->use_btree == grown);
+        verify(zset, m);
+    }
+    zset_del(zset);
+    printf("btree_min %zu: %u rounds, up to %zu members, %s\n", btree_min, rounds, most,
+           grown ? "B+tree" : "AVL");
+}
+
+int main(int argc, char **argv) {
+    uint32_t rounds = argc > 1 ? atoi(argv[1]) : 20000;
+    uint32_t seed = argc > 2 ? atoi(argv[2]) : 1;
+    srand(seed);
+    run_avl_build(1100);
+    run(0, 400, rounds); // AVL only
+    run(1, 400, rounds); // B+tree from the first member
+    run(16, 400, rounds); // switch on the small sets
+    run(1024, 3000, rounds); // the default switch, crossed by the adds
+    printf("ok, seed %u\n", seed);
+    return 0;
+}